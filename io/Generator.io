@@ -1,41 +1,56 @@
-BigNum asSequence := method(
-  segments := list
-  source := self
-  while(source != 0,
-    segments append(source % 256)
-    source = source / 256
+// Compact bytecode keeps immediates seven bits to a byte, least significant first, with
+// the top bit set on every byte but the last.
+Number leb128 := method(
+  bytes := Sequence clone
+  value := self
+  while(value >= 128,
+    bytes append(value % 128 + 128)
+    value = (value / 128) floor
   )
-  if(segments isEmpty, segments append(0))
-  segments map(asNumber asCharacter) reduce(..)
+  bytes append(value)
 )
 
+// Jump offsets can be negative, so they are zig-zagged first: 0, -1, 1, -2 become 0, 1, 2, 3.
+Number zigzag := method(if(self < 0, -2 * self - 1, 2 * self))
+
 Opcode := Object clone do(
   name ::= "opcode"
   number ::= 0
+  registers ::= list
   operand ::= nil
-    
+  signed ::= false
+
+  // The opcode, the registers two to a byte with the first in the high nibble, then the
+  // operand.
   binary := method(
-    buffer := Sequence clone
-    operand isNil ifTrue(
-      buffer = buffer ..((number << 1) asCharacter)
-    ) ifFalse(
-      buffer = buffer ..(Sequence clone atPut(0,1) bitwiseOr((number << 1) asCharacter))
-      buffer = buffer ..(Sequence clone atPut(7,0) bitwiseOr(operand asSequence exclusiveSlice(0,8)))
+    buffer := Sequence clone append(number)
+    registers foreach(i, r,
+      if(i % 2 == 0,
+        buffer append(r * 16)
+      ,
+        buffer atPut(buffer size - 1, buffer at(buffer size - 1) + r)
+      )
+    )
+    operand isNil ifFalse(
+      buffer = buffer ..(if(signed, operand zigzag, operand) leb128)
     )
     buffer
   )
-  textual := method(name .. if(operand isNil, "", ":" .. operand asString))
+  textual := method(name .. registers map(r, " r" .. r asString) join .. if(operand isNil, "", ":" .. operand asString))
 )
 
 Generator := Object clone do(
   buffer := list
 	
-  version ::= 0
+  // Only compact bytecode is written; see docs/bytecode.md.
+  version ::= 2
     
   init := method(buffer = list)
 
-  binaryHeader := method("Caribou!" ..(version asCharacter) ..(Sequence clone atPut(3,0)))
-  textualHeader := method("Caribou! Version:" ..(version asString))
+  // "CRBU", the version, and the sizes of the constant pool and the custom header, which
+  // are both empty.
+  binaryHeader := method("CRBU" ..(version asCharacter) ..(Sequence clone setSize(8)))
+  textualHeader := method("CRBU version " ..(version asString))
     
   binary  := method(
     output := binaryHeader
@@ -50,44 +65,61 @@ Generator := Object clone do(
     output
   )
 
-  register := method(number, name, operand,
-    buffer push(Opcode clone setName(name) setNumber(number) setOperand(operand))
+  register := method(number, name, registers, operand,
+    buffer push(Opcode clone setName(name) setNumber(number) setRegisters(registers) setOperand(operand))
+    self
+  )
+
+  // The offset is in bytes, from the start of the jump.
+  jump := method(number, name, offset,
+    buffer push(Opcode clone setName(name) setNumber(number) setOperand(offset) setSigned(true))
     self
   )
     
-  noop         := method(   register(0x00, "NOOP"))
-  move         := method(   register(0x01, "MOVE"))
-  loadi        := method(v, register(0x02, "LOADI", if(v isNil, BigNum with(0), v)))
+  noop         := method(       register(0x00, "NOOP",      list))
+  move         := method(a, b,  register(0x01, "MOVE",      list(a, b)))
+  loadi        := method(a, i,  register(0x02, "LOADI",     list(a), if(i isNil, 0, i)))
   
-  push         := method(v, register(0x10, "PUSH", if(v isNil, BigNum with(0), v)))
-  pop          := method(   register(0x11, "POP"))
-  swap         := method(   register(0x12, "SWAP"))
-  rotate       := method(   register(0x13, "ROTATE"))
-  dup          := method(   register(0x14, "DUP"))
+  push         := method(v,     register(0x10, "PUSH",      list, if(v isNil, 0, v)))
+  pop          := method(a,     register(0x11, "POP",       list(a)))
+  swap         := method(       register(0x12, "SWAP",      list))
+  rotate       := method(a,     register(0x13, "ROTATE",    list(a)))
+  dup          := method(       register(0x14, "DUP",       list))
   
-  add          := method(   register(0x20, "ADD"))
-  sub          := method(   register(0x21, "SUB"))
-  mul          := method(   register(0x22, "MUL"))
-  div          := method(   register(0x23, "DIV"))
-  mod          := method(   register(0x24, "MOD"))
-  pow          := method(   register(0x25, "POW"))
-  not          := method(   register(0x26, "NOT"))
+  add          := method(a,b,c, register(0x20, "ADD",       list(a, b, c)))
+  sub          := method(a,b,c, register(0x21, "SUB",       list(a, b, c)))
+  mul          := method(a,b,c, register(0x22, "MUL",       list(a, b, c)))
+  div          := method(a,b,c, register(0x23, "DIV",       list(a, b, c)))
+  mod          := method(a,b,c, register(0x24, "MOD",       list(a, b, c)))
+  pow          := method(a,b,c, register(0x25, "POW",       list(a, b, c)))
+  not          := method(a, b,  register(0x26, "NOT",       list(a, b)))
 
-  eq           := method(   register(0x30, "EQ"))
-  lt           := method(   register(0x31, "LT"))
-  lte          := method(   register(0x32, "LTE"))
-  gt           := method(   register(0x33, "GT"))
-  gte          := method(   register(0x34, "GTE"))
+  eq           := method(a,b,c, register(0x30, "EQ",        list(a, b, c)))
+  lt           := method(a,b,c, register(0x31, "LT",        list(a, b, c)))
+  lte          := method(a,b,c, register(0x32, "LTE",       list(a, b, c)))
+  gt           := method(a,b,c, register(0x33, "GT",        list(a, b, c)))
+  gte          := method(a,b,c, register(0x34, "GTE",       list(a, b, c)))
 
-  halt         := method(   register(0x40, "HALT"))
-  send         := method(   register(0x41, "SEND"))
-  ret          := method(   register(0x42, "RET"))
-  jmp          := method(v, register(0x43, "JMP", v))
-  save         := method(   register(0x44, "SAVE"))
-  restore      := method(   register(0x45, "RESTORE"))
+  halt         := method(       register(0x40, "HALT",      list))
+  send         := method(a,b,c, register(0x41, "SEND",      list(a, b, c)))
+  ret          := method(       register(0x42, "RET",       list))
+  jmp          := method(o,     jump(0x43, "JMP", o))
+  save         := method(a,     register(0x44, "SAVE",      list(a)))
+  restore      := method(a,     register(0x45, "RESTORE",   list(a)))
+  asend        := method(a,b,c, register(0x46, "ASEND",     list(a, b, c)))
+  await        := method(a, b,  register(0x47, "AWAIT",     list(a, b)))
+  sendafter    := method(a,b,c, register(0x48, "SENDAFTER", list(a, b, c)))
+  awaitfor     := method(a,b,c, register(0x49, "AWAITFOR",  list(a, b, c)))
+  mark         := method(a,     register(0x4A, "MARK",      list(a)))
+  escape       := method(a,     register(0x4B, "ESCAPE",    list(a)))
+  coroutine    := method(a,b,c, register(0x4C, "COROUTINE", list(a, b, c)))
+  resume       := method(a, b,  register(0x4D, "RESUME",    list(a, b)))
+  yield        := method(a,     register(0x4E, "YIELD",     list(a)))
+  tailsend     := method(a,b,c, register(0x4F, "TAILSEND",  list(a, b, c)))
 
-  addsym       := method(   register(0x50, "ADDSYM"))
-  findsym      := method(   register(0x51, "FINDSYM"))
-  array        := method(   register(0x52, "ARRAY"))
-  string       := method(   register(0x53, "STRING"))
+  addsym       := method(a, b,  register(0x50, "ADDSYM",    list(a, b)))
+  findsym      := method(a, b,  register(0x51, "FINDSYM",   list(a, b)))
+  array        := method(a,     register(0x52, "ARRAY",     list(a)))
+  string       := method(a,     register(0x53, "STRING",    list(a)))
+  actor        := method(a,b,c, register(0x54, "ACTOR",     list(a, b, c)))
 )
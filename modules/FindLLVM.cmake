@@ -19,7 +19,7 @@ execute_process(
 	OUTPUT_STRIP_TRAILING_WHITESPACE
 )
 execute_process(
-	COMMAND ${LLVM_CONFIG_EXECUTABLE} --libs core jit native
+	COMMAND ${LLVM_CONFIG_EXECUTABLE} --libs core mcjit native
 	OUTPUT_VARIABLE LLVM_JIT_LIBS
 	OUTPUT_STRIP_TRAILING_WHITESPACE
 )
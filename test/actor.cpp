@@ -0,0 +1,318 @@
+/*
+ * Caribou Virtual Machine
+ * Copyright (c) 2011, Jeremy Tregunna, All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include "harness.hpp"
+#include "boolean.hpp"
+#include "future.hpp"
+#include "mailbox.hpp"
+#include "nil.hpp"
+#include "object_space.hpp"
+
+using namespace Caribou;
+
+// A send to a passive object is a call, which returns right away. Once the object is an
+// actor, the same send is queued, and only runs when the scheduler gets to it. That holds
+// even when the send names the actor as its sender: the method sending it isn't running on
+// the actor's behalf, since its receiver has been replaced with zero.
+static void sends_to_actors_are_queued()
+{
+	TestProgram p(
+		"  .method answer 0 answer\n"
+		"  .integer zero 0\n"
+		"  .string n \"answer\"\n"
+		"  .message m n\n"
+		"  MOVE r6, r0\n"
+		"  LOADI r0, zero\n"
+		"  LOADI r2, zero\n"
+		"  LOADI r3, m\n"
+		"  SEND r6, r3, r1\n"
+		"  MOVE r4, r2\n"
+		"  LOADI r2, zero\n"
+		"  ACTOR r6, r2, r2\n"
+		"  SEND r6, r3, r1\n"
+		"  MOVE r5, r2\n"
+		"  LOADI r2, zero\n"
+		"  SEND r6, r3, r6\n"
+		"  MOVE r7, r2\n"
+		"  HALT\n"
+		"answer:\n"
+		"  PUSH 42\n"
+		"  RET\n");
+	ObjectSpace* space = p.image.get_object_space();
+
+	CHECK(!space->is_actor());
+	p.run();
+	CHECK(space->is_actor());
+	CHECK(p.reg(4) == reinterpret_cast<Object*>(42));
+	CHECK(p.integer(5) == 0);
+	CHECK(p.integer(7) == 0);
+	CHECK(space->mailbox->is_empty());
+}
+
+// A send from an actor to itself is a call, and a tail send one which hands its result
+// straight back, however the sending context is named.
+static void self_sends_are_calls()
+{
+	TestProgram p(
+		"  .method answer 0 answer\n"
+		"  .method pass 0 pass\n"
+		"  .integer zero 0\n"
+		"  .string n1 \"answer\"\n"
+		"  .string n2 \"pass\"\n"
+		"  .message m1 n1\n"
+		"  .message m2 n2\n"
+		"  LOADI r2, zero\n"
+		"  ACTOR r0, r2, r2\n"
+		"  LOADI r3, m1\n"
+		"  SEND r0, r3, r1\n"
+		"  MOVE r4, r2\n"
+		"  LOADI r2, zero\n"
+		"  LOADI r3, m2\n"
+		"  SEND r0, r3, r1\n"
+		"  MOVE r5, r2\n"
+		"  HALT\n"
+		"pass:\n"
+		"  LOADI r3, m1\n"
+		"  TAILSEND r0, r3, r1\n"
+		"answer:\n"
+		"  PUSH 42\n"
+		"  RET\n");
+
+	p.run();
+	CHECK(p.reg(4) == reinterpret_cast<Object*>(42));
+	CHECK(p.reg(5) == reinterpret_cast<Object*>(42));
+	CHECK(p.image.get_object_space()->mailbox->is_empty());
+}
+
+// Makes the object space an actor whose mailbox holds one message, with the given overflow
+// policy in r5, sends it two messages with ASEND, and leaves what each send left in r6
+// and r7.
+static std::string two_sends(MailboxOverflowPolicy policy, const std::string& after)
+{
+	std::ostringstream text;
+
+	text <<
+		"  .method answer 0 answer\n"
+		"  .integer one 1\n"
+		"  .integer policy " << policy << "\n"
+		"  .string n \"answer\"\n"
+		"  .message m n\n"
+		"  LOADI r3, m\n"
+		"  LOADI r4, one\n"
+		"  LOADI r5, policy\n"
+		"  ACTOR r0, r4, r5\n"
+		"  ASEND r0, r3, r1\n"
+		"  MOVE r6, r2\n"
+		"  ASEND r0, r3, r1\n"
+		"  MOVE r7, r2\n"
+		<< after <<
+		"  HALT\n"
+		"answer:\n"
+		"  PUSH 42\n"
+		"  RET\n";
+	return text.str();
+}
+
+static Object* resolution(Object* future)
+{
+	Future* f = dynamic_cast<Future*>(future);
+
+	CHECK(f != nullptr);
+	return f->is_resolved() ? f->get_value() : nullptr;
+}
+
+// The second send waits for the first message to be handled, then gets in.
+static void full_mailbox_blocks()
+{
+	TestProgram p(two_sends(kMailboxOverflowBlock, "  AWAIT r7, r7\n"));
+
+	p.run();
+	CHECK(p.image.get_object_space()->mailbox->get_capacity() == 1);
+	CHECK(resolution(p.reg(6)) == reinterpret_cast<Object*>(42));
+	CHECK(p.reg(7) == reinterpret_cast<Object*>(42));
+}
+
+// The second send pushes the first message out, so nothing ever answers the first.
+static void full_mailbox_drops_oldest()
+{
+	TestProgram p(two_sends(kMailboxOverflowDropOldest, "  AWAIT r7, r7\n  AWAIT r6, r6\n"));
+
+	p.run();
+	CHECK(p.reg(7) == reinterpret_cast<Object*>(42));
+	CHECK(p.reg(6) == Nil::instance());
+}
+
+// The second send is turned away.
+static void full_mailbox_rejects()
+{
+	TestProgram p(two_sends(kMailboxOverflowFail, ""));
+
+	p.run();
+	CHECK(resolution(p.reg(6)) == reinterpret_cast<Object*>(42));
+	CHECK(dynamic_cast<Boolean*>(p.reg(7)) != nullptr);
+	CHECK(!static_cast<Boolean*>(p.reg(7))->value());
+}
+
+// An actor which sends itself a message and waits for the answer doesn't get one: the
+// message waits in its mailbox until the actor is done with the one it is handling, so
+// the wait times out, and the handler returns 1. Had the second message been handled in
+// the meantime, the wait would have got an array instead, and the handler returned 2.
+static void busy_actors_take_no_mail()
+{
+	TestProgram p(
+		"  .method first 0 first\n"
+		"  .method second 0 second\n"
+		"  .method nothing 0 nothing\n"
+		"  .integer zero 0\n"
+		"  .integer wait 20\n"
+		"  .string n1 \"first\"\n"
+		"  .string n2 \"second\"\n"
+		"  .string n3 \"nothing\"\n"
+		"  .message m1 n1\n"
+		"  .message m2 n2\n"
+		"  .message m3 n3\n"
+		"  LOADI r2, zero\n"
+		"  ACTOR r0, r2, r2\n"
+		"  LOADI r3, m1\n"
+		"  ASEND r0, r3, r1\n"
+		"  AWAIT r4, r2\n"
+		"  HALT\n"
+		"first:\n"
+		"  LOADI r3, m3\n"
+		"  SEND r0, r3, r0\n"
+		"  MOVE r7, r2\n"
+		"  LOADI r3, m2\n"
+		"  ASEND r0, r3, r0\n"
+		"  MOVE r5, r2\n"
+		"  LOADI r4, wait\n"
+		"  AWAITFOR r6, r5, r4\n"
+		"  EQ r3, r6, r7\n"
+		"  JMP timed_out\n"
+		"  PUSH 2\n"
+		"  RET\n"
+		"timed_out:\n"
+		"  PUSH 1\n"
+		"  RET\n"
+		"second:\n"
+		"  LOADI r3, zero\n"
+		"  ARRAY r3\n"
+		"  RET\n"
+		"nothing:\n"
+		"  RET\n");
+	Mailbox* mailbox = p.image.get_object_space()->mailbox;
+
+	p.run();
+	CHECK(p.reg(4) == reinterpret_cast<Object*>(1));
+	CHECK(mailbox->is_empty());
+	CHECK(!mailbox->is_busy());
+}
+
+// An actor which notices whenever it is compared with anything, and whether it is still
+// in the middle of an earlier comparison when it is.
+class Probe : public Object
+{
+public:
+	Probe() : inside(false), overlapped(false), compared(0) {}
+
+	int compare(Object* other)
+	{
+		if(inside.exchange(true))
+			overlapped = true;
+		std::this_thread::sleep_for(std::chrono::microseconds(200));
+		inside = false;
+		compared++;
+		return Object::compare(other);
+	}
+
+	std::atomic<bool> inside;
+	std::atomic<bool> overlapped;
+	std::atomic<int>  compared;
+};
+
+// Two machines, each on a thread of its own, send the same actor message after message.
+// Whichever machine takes a message on, the actor is busy until the method handling it
+// returns, so it never handles two at once, and every message is handled.
+static void actors_run_on_one_machine_at_a_time()
+{
+	const int each = 50;
+	std::ostringstream text;
+
+	text <<
+		"  .method work 0 work\n"
+		"  .string n1 \"work\"\n"
+		"  .string n2 \"probe\"\n"
+		"  .message m1 n1\n"
+		"  .message m2 n2\n"
+		"  LOADI r3, m2\n"
+		"  SEND r0, r3, r0\n"
+		"  MOVE r6, r2\n"
+		"  LOADI r3, m1\n";
+	for(int i = 0; i < each; i++)
+		text << "  ASEND r6, r3, r0\n  AWAIT r4, r2\n";
+	text <<
+		"  HALT\n"
+		"work:\n"
+		"  EQ r3, r0, r0\n"
+		"  JMP done\n"
+		"done:\n"
+		"  RET\n";
+
+	TestProgram p(text.str());
+	ObjectSpace* space = p.image.get_object_space();
+	Object* context;
+
+	collector = p.image.get_heap();
+	Probe* probe = new Probe();
+	collector = nullptr;
+
+	probe->add_slot("work", space->lookup("work", context));
+	probe->set_actor(true);
+	space->add_slot("probe", probe);
+
+	Machine other(&p.image);
+	std::thread first([&]() { p.run(); });
+	std::thread second([&]() { other.execute(); });
+
+	first.join();
+	second.join();
+
+	CHECK(!probe->overlapped);
+	CHECK(probe->compared == 2 * each);
+	CHECK(probe->mailbox->is_empty());
+	CHECK(!probe->mailbox->is_busy());
+}
+
+int main()
+{
+	sends_to_actors_are_queued();
+	self_sends_are_calls();
+	full_mailbox_blocks();
+	full_mailbox_drops_oldest();
+	full_mailbox_rejects();
+	busy_actors_take_no_mail();
+	actors_run_on_one_machine_at_a_time();
+	return 0;
+}
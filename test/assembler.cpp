@@ -0,0 +1,56 @@
+/*
+ * Caribou Virtual Machine
+ * Copyright (c) 2011, Jeremy Tregunna, All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#include <sstream>
+#include "harness.hpp"
+
+using namespace Caribou;
+
+static bool assembles(const std::string& text)
+{
+	std::istringstream in(text);
+	AsmProgram program;
+
+	try
+	{
+		program.assemble(in);
+	}
+	catch(const AssemblerError&)
+	{
+		return false;
+	}
+	return true;
+}
+
+int main()
+{
+	// There are only as many registers as a context has.
+	CHECK(assembles("  MOVE r3, r7\n"));
+	CHECK(!assembles("  MOVE r3, r8\n"));
+	CHECK(!assembles("  POP r15\n"));
+
+	// Variable instructions take the register holding their count.
+	CHECK(assembles("  ROTATE r3\n"));
+	CHECK(!assembles("  ROTATE 3\n"));
+	return 0;
+}
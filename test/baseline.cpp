@@ -0,0 +1,123 @@
+/*
+ * Caribou Virtual Machine
+ * Copyright (c) 2011, Jeremy Tregunna, All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#include "harness.hpp"
+
+using namespace Caribou;
+
+/* Sends same and differ n times each, one after the other, leaving what each returned the
+   first time in r6 and r7, and the last time in r4 and r5. Each compares two registers and
+   returns which way the comparison went: same takes the JMP after it, and differ steps
+   over it. Once they have been called often enough, they run as compiled code, and have
+   to return what they did when they were interpreted. */
+static std::string comparing(int n, bool fixed)
+{
+	std::ostringstream text;
+
+	if(fixed)
+		text << "  .version 1\n";
+	text <<
+		"  .method same 0 same\n"
+		"  .method differ 0 differ\n"
+		"  .integer one 1\n"
+		"  .integer two 2\n"
+		"  .string n1 \"same\"\n"
+		"  .string n2 \"differ\"\n"
+		"  .message m1 n1\n"
+		"  .message m2 n2\n"
+		"  LOADI r2, m1\n"
+		"  LOADI r3, m2\n";
+	for(int i = 0; i < n; i++)
+	{
+		text <<
+			"  SEND r0, r2, r1\n"
+			"  MOVE r4, r2\n"
+			"  LOADI r2, m1\n"
+			"  SEND r0, r3, r1\n"
+			"  MOVE r5, r2\n"
+			"  LOADI r2, m1\n";
+		if(i == 0)
+			text <<
+				"  MOVE r6, r4\n"
+				"  MOVE r7, r5\n";
+	}
+	text <<
+		"  HALT\n"
+		"same:\n"
+		"  LOADI r3, one\n"
+		"  MOVE r4, r3\n"
+		"  EQ r5, r3, r4\n"
+		"  JMP equal\n"
+		"  PUSH 2\n"
+		"  RET\n"
+		"equal:\n"
+		"  PUSH 1\n"
+		"  RET\n"
+		"differ:\n"
+		"  LOADI r3, one\n"
+		"  LOADI r4, two\n"
+		"  EQ r5, r3, r4\n"
+		"  JMP unequal\n"
+		"  PUSH 4\n"
+		"  RET\n"
+		"unequal:\n"
+		"  PUSH 3\n"
+		"  RET\n";
+	return text.str();
+}
+
+static void compiled_as_interpreted(bool fixed)
+{
+	// Interpreted every time, and compiled the last few.
+	const int counts[] = { 1, CARIBOU_WARM_METHOD + 4 };
+
+	for(int n : counts)
+	{
+		TestProgram p(comparing(n, fixed));
+
+		p.run();
+		CHECK(p.reg(6) == reinterpret_cast<Object*>(1));
+		CHECK(p.reg(7) == reinterpret_cast<Object*>(4));
+		CHECK(p.reg(4) == reinterpret_cast<Object*>(1));
+		CHECK(p.reg(5) == reinterpret_cast<Object*>(4));
+
+#ifdef CARIBOU_BASELINE_JIT
+		const NativeFunction* table = p.machine->get_baseline_jit().get_table();
+		size_t methods = 0;
+
+		for(uintptr_t ip = 0; ip < p.image.get_instruction_count(); ip++)
+		{
+			if(table[ip] != nullptr)
+				methods++;
+		}
+		CHECK((methods != 0) == (n >= CARIBOU_WARM_METHOD));
+#endif
+	}
+}
+
+int main()
+{
+	compiled_as_interpreted(false);
+	compiled_as_interpreted(true);
+	return 0;
+}
@@ -0,0 +1,117 @@
+/*
+ * Caribou Virtual Machine
+ * Copyright (c) 2011, Jeremy Tregunna, All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#include <algorithm>
+#include <dirent.h>
+#include <fstream>
+#include <iterator>
+#include <vector>
+#include "harness.hpp"
+#include "image_cache.hpp"
+
+using namespace Caribou;
+
+// A program the verifier can't vouch for, as ROTATE pops however many a register says.
+static const char* program =
+	"  .integer two 2\n"
+	"  PUSH 1\n"
+	"  PUSH 2\n"
+	"  LOADI r3, two\n"
+	"  ROTATE r3\n"
+	"  HALT\n";
+
+static bool verified(const std::string& cache, const std::string& path)
+{
+	Image image;
+
+	ImageCache(cache).load(image, path.c_str());
+	return image.get_entry_facts().verified;
+}
+
+// The one image in the cache.
+static std::string cached(const std::string& cache)
+{
+	DIR* dir = opendir(cache.c_str());
+	std::string name;
+
+	while(struct dirent* entry = readdir(dir))
+	{
+		if(entry->d_name[0] != '.')
+			name = entry->d_name;
+	}
+	closedir(dir);
+	CHECK(!name.empty());
+	return cache + "/" + name;
+}
+
+static std::vector<char> contents(const std::string& path)
+{
+	std::ifstream in(path.c_str(), std::ios::binary);
+	return std::vector<char>(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+}
+
+static void rewrite(const std::string& path, const std::vector<char>& bytes)
+{
+	std::ofstream out(path.c_str(), std::ios::binary | std::ios::trunc);
+	out.write(bytes.data(), bytes.size());
+}
+
+// What is recorded about a cached image is trusted, but only while its code is what the
+// record was made about.
+static void trusts_only_the_code_it_vouched_for()
+{
+	char dir[] = "/tmp/caribou-cache-XXXXXX";
+	std::string cache = mkdtemp(dir);
+	std::string path = cache + ".crbu";
+	std::istringstream in(program);
+	AsmProgram assembled;
+
+	assembled.assemble(in);
+	assembled.write(path.c_str());
+
+	CHECK(!verified(cache, path));
+	std::string copy = cached(cache);
+
+	// Claim the code verified, and the claim is believed.
+	std::vector<char> bytes = contents(copy);
+	std::vector<char>::iterator record = std::search(bytes.begin(), bytes.end(), "CRBC", "CRBC" + 4);
+	CHECK(record != bytes.end());
+	record[24] = 1;
+	rewrite(copy, bytes);
+	CHECK(verified(cache, path));
+
+	// Change the code as well, and it isn't.
+	bytes.back() = Instructions::NOOP;
+	rewrite(copy, bytes);
+	CHECK(!verified(cache, path));
+
+	unlink(copy.c_str());
+	rmdir(cache.c_str());
+	unlink(path.c_str());
+}
+
+int main()
+{
+	trusts_only_the_code_it_vouched_for();
+	return 0;
+}
@@ -0,0 +1,78 @@
+/*
+ * Caribou Virtual Machine
+ * Copyright (c) 2011, Jeremy Tregunna, All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#include "harness.hpp"
+#include "verifier.hpp"
+
+using namespace Caribou;
+
+// Whether running the program stops with an InvalidBytecodeError.
+static bool rejected(const std::string& text)
+{
+	TestProgram p(text);
+
+	CHECK(!p.image.get_entry_facts().verified);
+	try
+	{
+		p.run();
+	}
+	catch(const InvalidBytecodeError&)
+	{
+		return true;
+	}
+	return false;
+}
+
+int main()
+{
+	// More than there is on the stack.
+	CHECK(rejected(
+		"  .integer big 1000000000\n"
+		"  LOADI r3, big\n"
+		"  ROTATE r3\n"));
+	CHECK(rejected(
+		"  .integer two 2\n"
+		"  PUSH 1\n"
+		"  LOADI r3, two\n"
+		"  ARRAY r3\n"));
+	CHECK(rejected(
+		"  .integer minus -1\n"
+		"  LOADI r3, minus\n"
+		"  STRING r3\n"));
+
+	// Not a count at all.
+	CHECK(rejected(
+		"  .string s \"two\"\n"
+		"  LOADI r3, s\n"
+		"  ARRAY r3\n"));
+
+	// Just enough.
+	CHECK(!rejected(
+		"  .integer two 2\n"
+		"  PUSH 1\n"
+		"  PUSH 2\n"
+		"  LOADI r3, two\n"
+		"  ROTATE r3\n"
+		"  HALT\n"));
+	return 0;
+}
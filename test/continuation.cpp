@@ -0,0 +1,139 @@
+/*
+ * Caribou Virtual Machine
+ * Copyright (c) 2011, Jeremy Tregunna, All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#include "harness.hpp"
+#include "continuation.hpp"
+#include "coroutine.hpp"
+
+using namespace Caribou;
+
+// The registers of the coroutine running the keeper, which is in r5.
+static Object** keeper(TestProgram& p)
+{
+	Coroutine* co = dynamic_cast<Coroutine*>(p.reg(5));
+
+	CHECK(co != nullptr);
+	return co->get_stack()->top()->registers;
+}
+
+// A continuation is restored twice. Each time, the frame carries on from the SAVE with the
+// registers it had then; the continuation only ever went into the copy that carried on
+// after the SAVE the first time. The keeper coroutine holds on to the continuation across
+// restores, hands it back twice, and keeps what it was given in r3 each time after that.
+static void restored_twice()
+{
+	TestProgram p(
+		"  .method keep 0 keep\n"
+		"  .integer five 5\n"
+		"  .integer nine 9\n"
+		"  .string n \"keep\"\n"
+		"  .message m n\n"
+		"  LOADI r3, five\n"
+		"  LOADI r4, nine\n"
+		"  LOADI r6, m\n"
+		"  COROUTINE r5, r0, r6\n"
+		"  SAVE r3\n"
+		"  RESUME r5, r3\n"
+		"  EQ r7, r2, r0\n"
+		"  JMP done\n"
+		"  RESTORE r2\n"
+		"done:\n"
+		"  HALT\n"
+		"keep:\n"
+		"  MOVE r4, r2\n"
+		"  YIELD r4\n"
+		"  MOVE r6, r2\n"
+		"  YIELD r4\n"
+		"  MOVE r7, r2\n"
+		"  YIELD r0\n"
+		"  RET\n");
+
+	p.run();
+	Object** kept = keeper(p);
+
+	CHECK(dynamic_cast<Continuation*>(kept[4]) != nullptr);
+	CHECK(p.integer(3) == 5);
+	CHECK(p.integer(4) == 9);
+	CHECK(kept[6] == p.reg(3));
+	CHECK(kept[7] == p.reg(3));
+}
+
+// Restoring a continuation on another return stack than it was saved on is an error,
+// whichever way round it is done. Were it allowed, the frame which saved it would carry on
+// from the SAVE, find r3 no longer holding the continuation, and finish: returning from
+// the coroutine's method outside of the coroutine, or halting inside it.
+static bool restored_elsewhere(const std::string& text)
+{
+	TestProgram p(
+		"  .method inner 0 inner\n"
+		"  .string n \"inner\"\n"
+		"  .message m n\n"
+		"  LOADI r6, m\n"
+		"  COROUTINE r5, r0, r6\n"
+		+ text);
+
+	try
+	{
+		p.run();
+	}
+	catch(const CoroutineError&)
+	{
+		return true;
+	}
+	return false;
+}
+
+static void restored_on_another_stack()
+{
+	// Saved in a coroutine, restored outside it.
+	CHECK(restored_elsewhere(
+		"  RESUME r5, r0\n"
+		"  RESTORE r2\n"
+		"inner:\n"
+		"  MOVE r3, r0\n"
+		"  SAVE r3\n"
+		"  EQ r4, r3, r0\n"
+		"  JMP done\n"
+		"  YIELD r3\n"
+		"done:\n"
+		"  RET\n"));
+
+	// Saved outside, restored in a coroutine.
+	CHECK(restored_elsewhere(
+		"  MOVE r3, r0\n"
+		"  SAVE r3\n"
+		"  EQ r4, r3, r0\n"
+		"  JMP done\n"
+		"  RESUME r5, r3\n"
+		"done:\n"
+		"  HALT\n"
+		"inner:\n"
+		"  RESTORE r2\n"));
+}
+
+int main()
+{
+	restored_twice();
+	restored_on_another_stack();
+	return 0;
+}
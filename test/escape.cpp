@@ -0,0 +1,81 @@
+/*
+ * Caribou Virtual Machine
+ * Copyright (c) 2011, Jeremy Tregunna, All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#include "harness.hpp"
+#include "verifier.hpp"
+
+using namespace Caribou;
+
+// Resuming drops whatever was pushed after the ESCAPE.
+static void resumes_at_its_depth()
+{
+	TestProgram p(
+		"  .integer a 1\n"
+		"  .integer b 2\n"
+		"  LOADI r3, a\n"
+		"  LOADI r4, b\n"
+		"  MOVE r7, r3\n"
+		"  ESCAPE r6\n"
+		"  EQ r5, r7, r4\n"
+		"  JMP done\n"
+		"  MOVE r7, r4\n"
+		"  PUSH 1\n"
+		"  PUSH 2\n"
+		"  RESTORE r6\n"
+		"done:\n"
+		"  HALT\n");
+
+	CHECK(p.image.get_entry_facts().verified);
+	p.run();
+	CHECK(p.machine->get_current_context()->sp == 0);
+	CHECK(p.reg(2) == reinterpret_cast<Object*>(2));
+}
+
+// Something the verifier counted on being there at the resume point has been popped.
+static void popped_below_its_depth()
+{
+	TestProgram p(
+		"  PUSH 5\n"
+		"  ESCAPE r6\n"
+		"  POP r3\n"
+		"  RESTORE r6\n");
+	bool thrown = false;
+
+	CHECK(p.image.get_entry_facts().verified);
+	try
+	{
+		p.run();
+	}
+	catch(const InvalidBytecodeError&)
+	{
+		thrown = true;
+	}
+	CHECK(thrown);
+}
+
+int main()
+{
+	resumes_at_its_depth();
+	popped_below_its_depth();
+	return 0;
+}
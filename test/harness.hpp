@@ -0,0 +1,93 @@
+/*
+ * Caribou Virtual Machine
+ * Copyright (c) 2011, Jeremy Tregunna, All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef __CARIBOU__TEST_HARNESS_HPP__
+#define __CARIBOU__TEST_HARNESS_HPP__
+
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <stdlib.h>
+#include <unistd.h>
+#include "assembler.hpp"
+#include "image.hpp"
+#include "input_reader.hpp"
+#include "integer.hpp"
+#include "machine.hpp"
+#include "peephole.hpp"
+
+namespace Caribou
+{
+	// Fails the test, saying what didn't hold, unless it does.
+	#define CHECK(cond) do { if(!(cond)) { std::cerr << __FILE__ << ":" << __LINE__ << ": " #cond << std::endl; exit(1); } } while(0)
+
+	/* A program assembled from text, optimised the way casm -O does if asked, and loaded
+	   the way vm loads it, from a file, with a machine to run it on. */
+	class TestProgram
+	{
+	public:
+		TestProgram(const std::string& text, bool optimise = false)
+		{
+			char path[] = "/tmp/caribou-test-XXXXXX";
+			int fd = mkstemp(path);
+			std::istringstream in(text);
+			AsmProgram program;
+
+			close(fd);
+			program.assemble(in);
+			if(optimise)
+				PeepholeOptimizer(program).run();
+			program.write(path);
+			InputReader(image).load(path);
+			unlink(path);
+
+			machine = new Machine(&image);
+		}
+
+		~TestProgram()
+		{
+			delete machine;
+		}
+
+		// Runs the program until it halts.
+		void run()
+		{
+			machine->execute();
+		}
+
+		Object* reg(uint8_t r)
+		{
+			return machine->get_current_context()->registers[r];
+		}
+
+		intptr_t integer(uint8_t r)
+		{
+			return static_cast<Integer*>(reg(r))->c_int();
+		}
+
+		Image    image;
+		Machine* machine;
+	};
+}
+
+#endif /* !__CARIBOU__TEST_HARNESS_HPP__ */
@@ -0,0 +1,58 @@
+/*
+ * Caribou Virtual Machine
+ * Copyright (c) 2011, Jeremy Tregunna, All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#include <fstream>
+#include "harness.hpp"
+
+using namespace Caribou;
+
+// The image a file loads into, given its header and what follows.
+static size_t instructions_loaded(const std::string& header)
+{
+	char path[] = "/tmp/caribou-test-XXXXXX";
+	int fd = mkstemp(path);
+	Image image;
+
+	close(fd);
+	{
+		std::ofstream out(path, std::ios::binary);
+		out << header << std::string(64, '\x40');
+	}
+	InputReader(image).load(path);
+	unlink(path);
+	return image.get_instruction_count();
+}
+
+int main()
+{
+	// Magic, version, then pool and custom sizes, little-endian.
+	std::string sizes("\0\0\0\0\0\0\0\0", 8);
+
+	CHECK(instructions_loaded(std::string("CRBU\x02", 5) + sizes) == 64);
+
+	// Nothing of a file which isn't an image is run, whether it is mapped or read.
+	CHECK(instructions_loaded(std::string("XXXX\x02", 5) + sizes) == 0);
+	CHECK(instructions_loaded(std::string("CRBU\x09", 5) + sizes) == 0);
+	CHECK(instructions_loaded(std::string("CRBU\x02\xff\xff\0\0", 9) + std::string("\0\0\0\0", 4)) == 0);
+	return 0;
+}
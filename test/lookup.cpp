@@ -0,0 +1,109 @@
+/*
+ * Caribou Virtual Machine
+ * Copyright (c) 2011, Jeremy Tregunna, All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#include <atomic>
+#include <thread>
+#include <vector>
+#include "harness.hpp"
+
+using namespace Caribou;
+
+// Hands out a different object each time it is resolved, so that two machines which each
+// put what they resolved in the same slot would see different things there. It lets the
+// other threads run before handing it out, so that they come across the stub meanwhile.
+class CountingStub : public Stub
+{
+public:
+	CountingStub(std::vector<Object*>& o) : objects(o), resolved(0) {}
+
+	Object* resolve()
+	{
+		Object* obj = objects[resolved++];
+		std::this_thread::yield();
+		return obj;
+	}
+
+	std::vector<Object*>& objects;
+	std::atomic<int>      resolved;
+};
+
+// Several threads look up the same stubbed slot and trait at once. Whichever of them
+// resolves a stub first has what it made kept; all the rest are given that too.
+static void stubs_resolve_once()
+{
+	const int threads = 8, rounds = 200;
+	TestProgram p("  HALT\n");
+
+	p.run();
+
+	for(int round = 0; round < rounds; round++)
+	{
+		std::vector<Object*> slots, traits;
+		for(int i = 0; i < threads; i++)
+		{
+			slots.push_back(new Object());
+			traits.push_back(new Object());
+			traits.back()->add_slot("inherited", traits.back());
+		}
+
+		CountingStub* slot = new CountingStub(slots);
+		CountingStub* trait = new CountingStub(traits);
+		Object* obj = new Object();
+		obj->add_slot("local", slot);
+		obj->add_trait(trait);
+
+		std::vector<Object*> local(threads), inherited(threads);
+		std::vector<std::thread> running;
+		std::atomic<int> ready(0);
+
+		for(int t = 0; t < threads; t++)
+			running.push_back(std::thread([&, t]() {
+				Object* context;
+
+				ready++;
+				while(ready < threads)
+					;
+				local[t] = obj->lookup("local", context);
+				inherited[t] = obj->lookup("inherited", context);
+			}));
+
+		for(std::thread& t : running)
+			t.join();
+
+		Object* context;
+		CHECK(obj->slot_table()["local"] == local[0]);
+		CHECK(obj->trait_list()[0] == inherited[0]);
+		for(int t = 0; t < threads; t++)
+		{
+			CHECK(local[t] == local[0]);
+			CHECK(inherited[t] == inherited[0]);
+		}
+		CHECK(obj->lookup("local", context) == local[0]);
+	}
+}
+
+int main()
+{
+	stubs_resolve_once();
+	return 0;
+}
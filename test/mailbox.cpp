@@ -0,0 +1,83 @@
+/*
+ * Caribou Virtual Machine
+ * Copyright (c) 2011, Jeremy Tregunna, All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#include <atomic>
+#include <thread>
+#include <vector>
+#include "harness.hpp"
+#include "mailbox.hpp"
+
+using namespace Caribou;
+
+// Several threads deliver to one mailbox while several others take messages out of it.
+// Every message comes out exactly once, from whoever sent it. The mailbox never looks
+// at what it is given, so numbers stand in for messages and senders.
+static void many_senders_and_receivers()
+{
+	const int senders = 4, receivers = 2, each = 20000;
+	Mailbox mailbox;
+	std::vector<std::atomic<int>> seen(senders * each);
+	std::atomic<int> taken(0);
+	std::vector<std::thread> threads;
+
+	for(int i = 0; i < senders * each; i++)
+		seen[i] = 0;
+
+	for(int s = 0; s < senders; s++)
+		threads.push_back(std::thread([&, s]() {
+			for(int i = 0; i < each; i++)
+			{
+				intptr_t n = s * each + i + 1;
+				CHECK(mailbox.deliver(reinterpret_cast<Message*>(n), reinterpret_cast<Object*>(n)) == kMailboxDelivered);
+			}
+		}));
+
+	for(int r = 0; r < receivers; r++)
+		threads.push_back(std::thread([&]() {
+			Message* msg;
+			Object* sender;
+			Future* reply;
+
+			while(taken < senders * each)
+			{
+				if(!mailbox.receive(msg, sender, reply))
+					continue;
+				CHECK(reinterpret_cast<intptr_t>(msg) == reinterpret_cast<intptr_t>(sender));
+				seen[reinterpret_cast<intptr_t>(sender) - 1]++;
+				taken++;
+			}
+		}));
+
+	for(std::thread& t : threads)
+		t.join();
+
+	CHECK(mailbox.is_empty());
+	for(int i = 0; i < senders * each; i++)
+		CHECK(seen[i] == 1);
+}
+
+int main()
+{
+	many_senders_and_receivers();
+	return 0;
+}
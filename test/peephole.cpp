@@ -0,0 +1,95 @@
+/*
+ * Caribou Virtual Machine
+ * Copyright (c) 2011, Jeremy Tregunna, All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#include <sstream>
+#include "harness.hpp"
+#include "peephole.hpp"
+
+using namespace Caribou;
+
+static AsmProgram optimised(const std::string& text)
+{
+	std::istringstream in(text);
+	AsmProgram program;
+
+	program.assemble(in);
+	PeepholeOptimizer(program).run();
+	return program;
+}
+
+// RET returns the top of the stack, not what the SEND left in r2.
+static void send_before_ret_is_kept()
+{
+	AsmProgram program = optimised(
+		"  SEND r3, r4, r0\n"
+		"  RET\n");
+
+	CHECK(program.code[0].opcode == Instructions::SEND);
+}
+
+// Only the sum nothing but arithmetic reads is folded.
+static void folds_what_only_arithmetic_reads()
+{
+	AsmProgram program = optimised(
+		"  .integer one 1\n"
+		"  LOADI r3, one\n"
+		"  ADD r4, r3, r3\n"
+		"  ADD r4, r4, r3\n"
+		"  HALT\n");
+
+	CHECK(program.code[1].opcode == Instructions::LOADI);
+	CHECK(program.code[2].opcode == Instructions::ADD);
+}
+
+// A comparison can tell the constant a sum would be folded into apart from the sum.
+static void comparison_sees_the_same_sum()
+{
+	const char* text =
+		"  .integer one 1\n"
+		"  .integer two 2\n"
+		"  LOADI r3, one\n"
+		"  ADD r4, r3, r3\n"
+		"  LOADI r5, two\n"
+		"  EQ r6, r4, r5\n"
+		"  JMP same\n"
+		"  LOADI r7, one\n"
+		"  HALT\n"
+		"same:\n"
+		"  LOADI r7, two\n"
+		"  HALT\n";
+	TestProgram plain(text);
+	TestProgram optimised(text, true);
+
+	plain.run();
+	optimised.run();
+	CHECK(plain.integer(7) == 1);
+	CHECK(optimised.integer(7) == 1);
+}
+
+int main()
+{
+	send_before_ret_is_kept();
+	folds_what_only_arithmetic_reads();
+	comparison_sees_the_same_sum();
+	return 0;
+}
@@ -0,0 +1,107 @@
+/*
+ * Caribou Virtual Machine
+ * Copyright (c) 2011, Jeremy Tregunna, All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#include "harness.hpp"
+#include "continuation.hpp"
+#include "persistence.hpp"
+
+using namespace Caribou;
+
+// Marks a continuation with 7 on the stack, into r6.
+static const char* marked =
+	"  PUSH 7\n"
+	"  MARK r6\n"
+	"  HALT\n";
+
+// Goes on pushing and popping long after the mark.
+static void churn(Context* ctx, size_t times)
+{
+	for(size_t i = 0; i < times; i++)
+	{
+		ctx->push(reinterpret_cast<Object*>(i));
+		ctx->push(reinterpret_cast<Object*>(i));
+		ctx->pop();
+		ctx->pop();
+	}
+}
+
+// Only what the continuation needs is kept, however long the program goes on.
+static void kept_for_a_live_continuation()
+{
+	TestProgram p(marked);
+	p.run();
+	Context* ctx = p.machine->get_current_context();
+	RevisionLog& log = p.machine->get_revision_log();
+	PersistentContinuation* k = static_cast<PersistentContinuation*>(p.reg(6));
+
+	churn(ctx, 100000);
+	CHECK(log.is_recording());
+	CHECK(log.size() < 4 * CARIBOU_CHECKPOINT_INTERVAL);
+
+	// It's found on the stack as well as in a register.
+	ctx->push(k);
+	ctx->registers[6] = nullptr;
+	churn(ctx, 100000);
+	CHECK(log.size() < 4 * CARIBOU_CHECKPOINT_INTERVAL);
+
+	CHECK(k->is_valid());
+	log.restore(k);
+	ctx = p.machine->get_current_context();
+	CHECK(ctx->sp == 1);
+	CHECK(ctx->top() == reinterpret_cast<Object*>(7));
+}
+
+// Once nothing holds on to the continuation, recording stops, and the continuation can't
+// be restored.
+static void stops_once_none_are_left()
+{
+	TestProgram p(marked);
+	p.run();
+	Context* ctx = p.machine->get_current_context();
+	RevisionLog& log = p.machine->get_revision_log();
+	PersistentContinuation* k = static_cast<PersistentContinuation*>(p.reg(6));
+	bool thrown = false;
+
+	ctx->registers[6] = nullptr;
+	churn(ctx, 100000);
+	CHECK(!log.is_recording());
+	CHECK(log.size() == 0);
+	CHECK(ctx->log == nullptr);
+
+	try
+	{
+		log.restore(k);
+	}
+	catch(const DeadContinuationError&)
+	{
+		thrown = true;
+	}
+	CHECK(thrown);
+}
+
+int main()
+{
+	kept_for_a_live_continuation();
+	stops_once_none_are_left();
+	return 0;
+}
@@ -0,0 +1,111 @@
+/*
+ * Caribou Virtual Machine
+ * Copyright (c) 2011, Jeremy Tregunna, All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#include <fstream>
+#include <iterator>
+#include <vector>
+#include "harness.hpp"
+#include "endian.hpp"
+#include "object_space.hpp"
+#include "snapshot.hpp"
+#include "verifier.hpp"
+#include "vmmethod.hpp"
+
+using namespace Caribou;
+
+// Where the header says the code starts.
+#define CODE_OFFSET_AT 50
+
+static const char* program =
+	"  .method answer 0 answer\n"
+	"  HALT\n"
+	"answer:\n"
+	"  PUSH 42\n"
+	"  RET\n";
+
+// Runs the program until it halts, and snapshots it.
+static std::vector<uint8_t> snapshot(uintptr_t& start)
+{
+	TestProgram p(program);
+	char path[] = "/tmp/caribou-test-XXXXXX";
+	Object* context;
+
+	close(mkstemp(path));
+	p.run();
+	start = dynamic_cast<VMMethod*>(p.image.get_object_space()->lookup("answer", context))->get_start_ip();
+	SnapshotWriter(p.image).dump(path, 1);
+
+	std::ifstream in(path, std::ios::binary);
+	std::vector<uint8_t> bytes((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+	unlink(path);
+	return bytes;
+}
+
+// The method the snapshot holds, as looked up once it is opened.
+static VMMethod* reopened(const std::vector<uint8_t>& bytes)
+{
+	char path[] = "/tmp/caribou-test-XXXXXX";
+	int fd = mkstemp(path);
+	Image* image = new Image();
+	Object* context;
+
+	CHECK(write(fd, bytes.data(), bytes.size()) == (ssize_t)bytes.size());
+	close(fd);
+	InputReader(*image).load(path);
+	unlink(path);
+
+	CHECK(image->get_object_space() != nullptr);
+	return dynamic_cast<VMMethod*>(image->get_object_space()->lookup("answer", context));
+}
+
+// Methods are verified again as they come out of a snapshot.
+static void methods_are_verified()
+{
+	uintptr_t start;
+	VMMethod* method = reopened(snapshot(start));
+
+	CHECK(method != nullptr);
+	CHECK(method->get_start_ip() == start);
+	CHECK(method->facts.verified);
+	CHECK(method->facts.max_stack == 1);
+}
+
+// Code changed since the snapshot was written isn't taken on trust.
+static void changed_code_is_checked()
+{
+	uintptr_t start;
+	std::vector<uint8_t> bytes = snapshot(start);
+
+	bytes[read_uint64(bytes.data() + CODE_OFFSET_AT) + start] = 0xff;
+
+	VMMethod* method = reopened(bytes);
+	CHECK(method != nullptr);
+	CHECK(!method->facts.verified);
+}
+
+int main()
+{
+	methods_are_verified();
+	changed_code_is_checked();
+	return 0;
+}
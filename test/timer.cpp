@@ -0,0 +1,102 @@
+/*
+ * Caribou Virtual Machine
+ * Copyright (c) 2011, Jeremy Tregunna, All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#include <stdlib.h>
+#include <vector>
+#include "harness.hpp"
+#include "timer_wheel.hpp"
+
+using namespace Caribou;
+
+// With only a timer far in the future, the wheel says to sleep until that timer, not until
+// the next time one of its levels wraps, and gets there in one go.
+static void far_timers_wake_once()
+{
+	const uint64_t out[] = { 300, 100000, 50000000, 1ULL << 33 };
+
+	for(uint64_t delay : out)
+	{
+		TimerWheel wheel(1000);
+		Timer t(kTimerTimeout, 1000 + delay);
+		std::vector<Timer*> expired;
+
+		wheel.insert(&t);
+		CHECK(wheel.next_tick() == 1000 + delay);
+
+		wheel.advance(1000 + delay - 1, expired);
+		CHECK(expired.empty());
+		CHECK(wheel.next_tick() == 1000 + delay);
+
+		wheel.advance(1000 + delay, expired);
+		CHECK(expired.size() == 1 && expired[0] == &t && t.fired);
+		CHECK(wheel.is_empty());
+	}
+}
+
+// Timers spread over every level fire on the first advance to reach them, and the wheel
+// always says the next one is due when the earliest of those left is.
+static void timers_fire_in_order()
+{
+	const int n = 2000;
+	std::vector<Timer*> timers;
+	TimerWheel wheel(0);
+	uint64_t now = 0;
+
+	srand(1);
+	for(int i = 0; i < n; i++)
+	{
+		uint64_t delay = (uint64_t)rand() << (rand() % 24);
+		timers.push_back(new Timer(kTimerTimeout, delay));
+		wheel.insert(timers.back());
+	}
+
+	while(!wheel.is_empty())
+	{
+		uint64_t earliest = UINT64_MAX;
+		for(Timer* t : timers)
+		{
+			if(!t->fired && t->expires < earliest)
+				earliest = t->expires;
+		}
+		CHECK(wheel.next_tick() == earliest);
+
+		now = rand() % 2 ? earliest : now + rand() % (earliest - now + 1);
+
+		std::vector<Timer*> expired;
+		wheel.advance(now, expired);
+		for(Timer* t : expired)
+			CHECK(t->expires <= now);
+		for(Timer* t : timers)
+			CHECK(t->fired == (t->expires <= now));
+	}
+
+	for(Timer* t : timers)
+		delete t;
+}
+
+int main()
+{
+	far_timers_wake_once();
+	timers_fire_in_order();
+	return 0;
+}
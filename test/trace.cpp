@@ -0,0 +1,139 @@
+/*
+ * Caribou Virtual Machine
+ * Copyright (c) 2011, Jeremy Tregunna, All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#include "harness.hpp"
+#include "nil.hpp"
+
+using namespace Caribou;
+
+// The trace compiled for a loop in the program, if there is one.
+static Trace* compiled(TestProgram& p)
+{
+	TraceRecorder& recorder = p.machine->get_trace_recorder();
+
+	for(uintptr_t ip = 0; ip < p.image.get_instruction_count(); ip++)
+	{
+		Trace* trace = recorder.find(ip);
+		if(trace != nullptr && trace->function != nullptr)
+			return trace;
+	}
+	return nullptr;
+}
+
+/* Sends spin n times, leaving what the first send returned in r7 and what the last one
+   returned in r2. Spin's loop turns r0, r1, r2, r3 and r6 round by one register each time,
+   through r4, and goes round until the two it starts with in r6 reaches r0: three jumps
+   back, and out the fourth time round. Taken says whether it comes out by taking the
+   comparison's JMP, or by stepping over it. Once the loop is traced, every call leaves the
+   trace on the way out, and what spin returns says whether the registers were all back in
+   the frame by then: Nil if they were, or which one wasn't otherwise. */
+static std::string spinning(int n, bool taken, bool fixed)
+{
+	std::ostringstream text;
+
+	if(fixed)
+		text << "  .version 1\n";
+	text <<
+		"  .method spin 0 spin\n"
+		"  .integer one 1\n"
+		"  .integer two 2\n"
+		"  .string name \"spin\"\n"
+		"  .message m name\n"
+		"  LOADI r3, m\n";
+	for(int i = 0; i < n; i++)
+	{
+		text << "  SEND r0, r3, r1\n";
+		if(i == 0)
+			text << "  MOVE r7, r2\n";
+	}
+	text <<
+		"  HALT\n"
+		"spin:\n"
+		"  LOADI r5, one\n"
+		"  LOADI r7, two\n"
+		"  MOVE r0, r5\n"
+		"  MOVE r1, r5\n"
+		"  MOVE r2, r5\n"
+		"  MOVE r3, r5\n"
+		"  MOVE r6, r7\n"
+		"loop:\n"
+		"  MOVE r4, r0\n"
+		"  MOVE r0, r1\n"
+		"  MOVE r1, r2\n"
+		"  MOVE r2, r3\n"
+		"  MOVE r3, r6\n"
+		"  MOVE r6, r4\n";
+	if(taken)
+		text <<
+			"  EQ r4, r7, r0\n"
+			"  JMP out\n"
+			"  JMP loop\n";
+	else
+		text <<
+			"  EQ r4, r5, r0\n"
+			"  JMP loop\n"
+			"  JMP out\n";
+	text << "out:\n";
+
+	const char* regs[] = { "r0", "r1", "r2", "r3", "r6" };
+	for(int i = 0; i < 5; i++)
+	{
+		text <<
+			"  EQ r4, " << (i == 0 ? "r7" : "r5") << ", " << regs[i] << "\n"
+			"  JMP checked" << i << "\n"
+			"  PUSH " << 10 + i << "\n"
+			"  RET\n"
+			"checked" << i << ":\n";
+	}
+	text << "  RET\n";
+	return text.str();
+}
+
+static void leaves_the_trace(bool taken, bool fixed)
+{
+	// Calls jump back three times each, and the last of them is followed by the time round
+	// which leaves the loop. The time recorded has to be one which stays in it.
+	CHECK(CARIBOU_HOT_LOOP % 3 != 0);
+
+	// Too few times round to be worth tracing, and enough to be traced and then some.
+	const int counts[] = { 4, 40 };
+
+	for(int n : counts)
+	{
+		TestProgram p(spinning(n, taken, fixed));
+
+		p.run();
+		CHECK((compiled(p) != nullptr) == (3 * n > CARIBOU_HOT_LOOP));
+		CHECK(p.reg(7) == Nil::instance());
+		CHECK(p.reg(2) == Nil::instance());
+	}
+}
+
+int main()
+{
+	leaves_the_trace(false, false);
+	leaves_the_trace(false, true);
+	leaves_the_trace(true, false);
+	leaves_the_trace(true, true);
+	return 0;
+}
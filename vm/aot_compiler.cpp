@@ -0,0 +1,335 @@
+/*
+ * Caribou Virtual Machine
+ * Copyright (c) 2011, Jeremy Tregunna, All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#include <algorithm>
+#include <set>
+#include <utility>
+#include "aot_compiler.hpp"
+#include "image.hpp"
+#include "module.hpp"
+#include "verifier.hpp"
+#include "native_code.hpp"
+
+namespace Caribou
+{
+	size_t AotCompiler::compile(std::ostream& out)
+	{
+		const std::vector<uint8_t>& custom = image.get_custom_section();
+		size_t icount = image.get_instruction_count();
+		std::vector<std::pair<uintptr_t, size_t> > roots;
+		std::vector<std::pair<uintptr_t, uintptr_t> > entries;
+		std::set<uintptr_t> covered;
+		ModuleTables tables;
+		MethodDirectory directory;
+		size_t methods = 0;
+
+		roots.push_back(std::make_pair(image.get_entry_point(), icount));
+		if(ModuleTables::present(custom.data(), custom.size()) && tables.parse(custom.data(), custom.size()))
+		{
+			for(const ModuleExport& e : tables.exports)
+				roots.push_back(std::make_pair(e.offset, icount));
+		}
+		if(directory.parse(custom.data(), custom.size()))
+		{
+			for(const MethodEntry& m : directory.methods)
+				roots.push_back(std::make_pair(m.offset, std::min<uint64_t>(m.offset + m.length, icount)));
+		}
+
+		out << "// Compiled ahead of time by caot. Build it into a shared object next to the image," << std::endl;
+		out << "// named after the image with \".so\" on the end, against the VM's headers." << std::endl;
+		out << "#include \"machine.hpp\"" << std::endl;
+		out << "#include \"native_code.hpp\"" << std::endl;
+		out << std::endl;
+		out << "using Caribou::Machine;" << std::endl;
+		out << "using Caribou::Object;" << std::endl;
+
+		for(const std::pair<uintptr_t, size_t>& root : roots)
+		{
+			Verifier verifier(image.get_instructions(), root.second, image.get_constant_count(), image.get_bytecode_version());
+			std::vector<uintptr_t> offsets;
+			MethodFacts facts;
+
+			if(covered.count(root.first) != 0)
+				continue;
+			if(!verifier.verify(root.first, facts) || !facts.verified)
+				continue;
+			if(!reachable(root.first, root.second, offsets))
+				continue;
+
+			method(out, root.first, root.second, offsets);
+			methods++;
+
+			for(uintptr_t offset : offsets)
+			{
+				if(!covered.insert(offset).second)
+					continue;
+				if(compiled(image.get_instructions()[offset]))
+					entries.push_back(std::make_pair(offset, root.first));
+			}
+		}
+
+		out << std::endl;
+		out << "const uint64_t caribou_native_fingerprint = " << NativeCode::fingerprint(image) << "ULL;" << std::endl;
+		out << "const char caribou_native_stamp[] = \"" << NativeCode::stamp(NativeCode::fingerprint(image)) << "\";" << std::endl;
+		out << "const Caribou::NativeEntry caribou_native_entries[] =" << std::endl;
+		out << "{" << std::endl;
+		for(const std::pair<uintptr_t, uintptr_t>& entry : entries)
+			out << "\t{ " << entry.first << ", method_" << entry.second << " }," << std::endl;
+		if(entries.empty())
+			out << "\t{ 0, nullptr }" << std::endl;
+		out << "};" << std::endl;
+		out << "const size_t caribou_native_entry_count = " << entries.size() << ";" << std::endl;
+
+		return methods;
+	}
+
+	bool AotCompiler::compiled(uint8_t opcode)
+	{
+		switch(opcode)
+		{
+			case Instructions::NOOP:
+			case Instructions::MOVE:
+			case Instructions::LOADI:
+			case Instructions::PUSH:
+			case Instructions::POP:
+			case Instructions::SWAP:
+			case Instructions::ROTATE:
+			case Instructions::DUP:
+			case Instructions::ADD:
+			case Instructions::SUB:
+			case Instructions::MUL:
+			case Instructions::DIV:
+			case Instructions::MOD:
+			case Instructions::POW:
+			case Instructions::NOT:
+			case Instructions::EQ:
+			case Instructions::LT:
+			case Instructions::LTE:
+			case Instructions::GT:
+			case Instructions::GTE:
+			case Instructions::JMP:
+			case Instructions::ADDSYM:
+			case Instructions::FINDSYM:
+			case Instructions::ARRAY:
+			case Instructions::STRING:
+				return true;
+			default:
+				return false;
+		}
+	}
+
+	// Every instruction the method can get to from start, in order. Fails on an
+	// instruction the verifier would have failed on.
+	bool AotCompiler::reachable(uintptr_t start, size_t count, std::vector<uintptr_t>& offsets)
+	{
+		const uint8_t* code = image.get_instructions();
+		uint8_t version = image.get_bytecode_version();
+		std::set<uintptr_t> seen;
+		std::vector<uintptr_t> pending(1, start);
+
+		while(!pending.empty())
+		{
+			uintptr_t offset = pending.back();
+			DecodedInstruction insn;
+
+			pending.pop_back();
+			if(!seen.insert(offset).second)
+				continue;
+			if(!decode_instruction(code, count, offset, version, insn))
+				return false;
+
+			const InstructionInfo& info = instruction_info(insn.opcode);
+			uintptr_t next = offset + insn.length;
+
+			if(info.flags & kInsnJump)
+				pending.push_back(insn.immediate);
+
+			if(info.flags & kInsnSkip)
+			{
+				DecodedInstruction skipped;
+				uintptr_t skip = instruction_info(Instructions::JMP).length;
+
+				if(version == kBytecodeCompact)
+				{
+					if(!decode_instruction(code, count, next, version, skipped))
+						return false;
+					skip = skipped.length;
+				}
+
+				pending.push_back(next);
+				pending.push_back(next + skip);
+			}
+			else if(!(info.flags & kInsnTerminator))
+				pending.push_back(next);
+		}
+
+		offsets.assign(seen.begin(), seen.end());
+		return true;
+	}
+
+	void AotCompiler::method(std::ostream& out, uintptr_t start, size_t count, const std::vector<uintptr_t>& offsets)
+	{
+		const uint8_t* code = image.get_instructions();
+		uint8_t version = image.get_bytecode_version();
+		std::set<uintptr_t> labels;
+
+		// Instructions left to the interpreter only need a label if something jumps to them.
+		for(size_t i = 0; i < offsets.size(); i++)
+		{
+			DecodedInstruction insn;
+
+			decode_instruction(code, count, offsets[i], version, insn);
+			const InstructionInfo& info = instruction_info(insn.opcode);
+			uintptr_t next = offsets[i] + insn.length;
+
+			if(compiled(insn.opcode))
+				labels.insert(offsets[i]);
+			if(info.flags & kInsnJump)
+				labels.insert(insn.immediate);
+			if(info.flags & kInsnSkip)
+				labels.insert(skip_target(next, count));
+			if(i + 1 == offsets.size() || offsets[i + 1] != next)
+				labels.insert(next);
+		}
+
+		out << std::endl;
+		out << "static void method_" << start << "(Machine* m, Object** regs)" << std::endl;
+		out << "{" << std::endl;
+		out << "\tswitch(m->get_instruction_pointer())" << std::endl;
+		out << "\t{" << std::endl;
+		for(uintptr_t offset : offsets)
+		{
+			if(compiled(code[offset]))
+				out << "\t\tcase " << offset << ": goto L" << offset << ";" << std::endl;
+		}
+		out << "\t\tdefault: return;" << std::endl;
+		out << "\t}" << std::endl;
+
+		for(size_t i = 0; i < offsets.size(); i++)
+		{
+			DecodedInstruction insn;
+
+			decode_instruction(code, count, offsets[i], version, insn);
+			out << std::endl;
+			if(labels.count(offsets[i]) != 0)
+				out << "L" << offsets[i] << ":";
+			out << "\t// " << instruction_info(insn.opcode).name << std::endl;
+			instruction(out, insn, offsets[i], count);
+
+			// Carry on with the next instruction, wherever it was put.
+			const InstructionInfo& info = instruction_info(insn.opcode);
+			uintptr_t next = offsets[i] + insn.length;
+			if(compiled(insn.opcode) && !(info.flags & kInsnTerminator) && (i + 1 == offsets.size() || offsets[i + 1] != next))
+				out << "\tgoto L" << next << ";" << std::endl;
+		}
+
+		out << "}" << std::endl;
+	}
+
+	// Where a failed comparison carries on, given where the instruction after it starts.
+	uintptr_t AotCompiler::skip_target(uintptr_t next, size_t count)
+	{
+		DecodedInstruction skipped;
+
+		if(image.get_bytecode_version() == kBytecodeCompact && decode_instruction(image.get_instructions(), count, next, kBytecodeCompact, skipped))
+			return next + skipped.length;
+		return next + instruction_info(Instructions::JMP).length;
+	}
+
+	void AotCompiler::instruction(std::ostream& out, const DecodedInstruction& insn, uintptr_t offset, size_t count)
+	{
+		static const char* const arithmetic[] = { "add", "sub", "mul", "div", "mod", "pow" };
+		static const char* const comparison[] = { "eq", "lt", "lte", "gt", "gte" };
+		const uint8_t* r = insn.registers;
+		uintptr_t next = offset + insn.length;
+
+		switch(insn.opcode)
+		{
+			case Instructions::NOOP:
+				out << "\t;" << std::endl;
+				break;
+			case Instructions::MOVE:
+				out << "\tm->move(regs, " << (int)r[0] << ", " << (int)r[1] << ");" << std::endl;
+				break;
+			case Instructions::LOADI:
+				out << "\tm->loadi(regs, " << (int)r[0] << ", " << insn.immediate << "ULL);" << std::endl;
+				break;
+			case Instructions::PUSH:
+				out << "\tm->push(regs, " << insn.immediate << "ULL);" << std::endl;
+				break;
+			case Instructions::POP:
+				out << "\tm->pop(regs, " << (int)r[0] << ");" << std::endl;
+				break;
+			case Instructions::SWAP:
+				out << "\tm->swap();" << std::endl;
+				break;
+			case Instructions::ROTATE:
+				out << "\tm->rotate(regs, " << (int)r[0] << ");" << std::endl;
+				break;
+			case Instructions::DUP:
+				out << "\tm->dup();" << std::endl;
+				break;
+			case Instructions::ADD:
+			case Instructions::SUB:
+			case Instructions::MUL:
+			case Instructions::DIV:
+			case Instructions::MOD:
+			case Instructions::POW:
+				out << "\tm->" << arithmetic[insn.opcode - Instructions::ADD] << "(regs, " << (int)r[0] << ", " << (int)r[1] << ", " << (int)r[2] << ");" << std::endl;
+				break;
+			case Instructions::NOT:
+				out << "\tm->bitwise_not(regs, " << (int)r[0] << ", " << (int)r[1] << ");" << std::endl;
+				break;
+			case Instructions::EQ:
+			case Instructions::LT:
+			case Instructions::LTE:
+			case Instructions::GT:
+			case Instructions::GTE:
+				// The handler skips the next instruction by moving ip past it.
+				out << "\tm->set_instruction_pointer(" << next << ");" << std::endl;
+				out << "\tm->" << comparison[insn.opcode - Instructions::EQ] << "(regs, " << (int)r[0] << ", " << (int)r[1] << ", " << (int)r[2] << ");" << std::endl;
+				out << "\tif(m->get_instruction_pointer() != " << next << ")" << std::endl;
+				out << "\t\tgoto L" << skip_target(next, count) << ";" << std::endl;
+				break;
+			case Instructions::JMP:
+				out << "\tgoto L" << insn.immediate << ";" << std::endl;
+				break;
+			case Instructions::ADDSYM:
+				out << "\tm->addsym(regs, " << (int)r[0] << ", " << (int)r[1] << ");" << std::endl;
+				break;
+			case Instructions::FINDSYM:
+				out << "\tm->findsym(regs, " << (int)r[0] << ", " << (int)r[1] << ");" << std::endl;
+				break;
+			case Instructions::ARRAY:
+				out << "\tm->make_array(regs, " << (int)r[0] << ");" << std::endl;
+				break;
+			case Instructions::STRING:
+				out << "\tm->make_string(regs, " << (int)r[0] << ");" << std::endl;
+				break;
+			default:
+				out << "\tm->set_instruction_pointer(" << offset << ");" << std::endl;
+				out << "\treturn;" << std::endl;
+				break;
+		}
+	}
+}
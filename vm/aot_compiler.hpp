@@ -0,0 +1,65 @@
+/*
+ * Caribou Virtual Machine
+ * Copyright (c) 2011, Jeremy Tregunna, All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef __CARIBOU__AOT_COMPILER_HPP__
+#define __CARIBOU__AOT_COMPILER_HPP__
+
+#include <stdint.h>
+#include <ostream>
+#include <vector>
+#include "instructions.hpp"
+
+namespace Caribou
+{
+	class Image;
+
+	/* Translates a loaded image into C++, to be compiled into a shared object the machine
+	   runs instead of interpreting the image. Every method which verifies, from the entry
+	   point, the exports of a module and the methods in the directory, becomes a function
+	   with a label for each of its instructions. Moves, arithmetic, stack operations,
+	   comparisons and jumps call the same handlers the interpreter does, and jumps become
+	   gotos. Everything else, sends and returns and the rest, is left to the interpreter:
+	   the function stops with ip on it, and the machine goes native again once it gets to
+	   the instruction after. */
+	class AotCompiler
+	{
+	public:
+		AotCompiler(Image& image) : image(image) {}
+
+		// Returns how many methods were compiled.
+		size_t compile(std::ostream& out);
+
+		// Whether the compiled code runs the instruction itself.
+		static bool compiled(uint8_t opcode);
+
+	private:
+		bool reachable(uintptr_t start, size_t count, std::vector<uintptr_t>& offsets);
+		void method(std::ostream& out, uintptr_t start, size_t count, const std::vector<uintptr_t>& offsets);
+		void instruction(std::ostream& out, const DecodedInstruction& insn, uintptr_t offset, size_t count);
+		uintptr_t skip_target(uintptr_t next, size_t count);
+
+		Image& image;
+	};
+}
+
+#endif /* !__CARIBOU__AOT_COMPILER_HPP__ */
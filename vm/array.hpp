@@ -37,6 +37,9 @@ namespace Caribou
 		Array() : data(nullptr), count(0) {}
 		Array(Object** ary, size_t len) : data(ary), count(len) {}
 
+		size_t size() { return count; }
+		Object* at(size_t i) { return data[i]; }
+
 		virtual const std::string object_name();
 		virtual void walk();
 
@@ -0,0 +1,657 @@
+/*
+ * Caribou Virtual Machine
+ * Copyright (c) 2011, Jeremy Tregunna, All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <set>
+#include <sstream>
+#include "assembler.hpp"
+#include "instructions.hpp"
+#include "endian.hpp"
+#include "image.hpp"
+#include "context.hpp"
+#include "module.hpp"
+#include "output_writer.hpp"
+
+namespace Caribou
+{
+	// Splits a line into words, at spaces and commas, up to any comment. A quoted string
+	// is one word, which keeps its quotes so it can be told apart, and its escapes.
+	static std::vector<std::string> tokenize(const std::string& source, size_t line)
+	{
+		std::vector<std::string> tokens;
+		size_t i = 0;
+
+		while(i < source.size())
+		{
+			char ch = source[i];
+
+			if(ch == ';')
+				break;
+			if(isspace((unsigned char)ch) || ch == ',')
+			{
+				i++;
+				continue;
+			}
+
+			size_t start = i;
+			if(ch == '"')
+			{
+				for(i++; i < source.size() && source[i] != '"'; i++)
+				{
+					if(source[i] == '\\')
+						i++;
+				}
+				if(i >= source.size())
+					throw AssemblerError(line, "unterminated string");
+				i++;
+			}
+			else
+			{
+				while(i < source.size() && !isspace((unsigned char)source[i]) && source[i] != ',' && source[i] != ';')
+					i++;
+			}
+			tokens.push_back(source.substr(start, i - start));
+		}
+
+		return tokens;
+	}
+
+	static std::string unquote(const std::string& token, size_t line)
+	{
+		std::string text;
+
+		if(token.size() < 2 || token[0] != '"')
+			throw AssemblerError(line, "expected a string, not " + token);
+
+		for(size_t i = 1; i + 1 < token.size(); i++)
+		{
+			char ch = token[i];
+
+			if(ch != '\\')
+			{
+				text += ch;
+				continue;
+			}
+
+			switch(token[++i])
+			{
+				case 'n':
+					text += '\n';
+					break;
+				case 't':
+					text += '\t';
+					break;
+				case 'x':
+					text += (char)strtoul(token.substr(i + 1, 2).c_str(), NULL, 16);
+					i += 2;
+					break;
+				default:
+					text += token[i];
+					break;
+			}
+		}
+
+		return text;
+	}
+
+	static std::string quote(const std::string& text)
+	{
+		std::string token = "\"";
+		char hex[5];
+
+		for(unsigned char ch : text)
+		{
+			if(ch == '"' || ch == '\\')
+			{
+				token += '\\';
+				token += ch;
+			}
+			else if(ch == '\n')
+				token += "\\n";
+			else if(ch == '\t')
+				token += "\\t";
+			else if(ch < 0x20 || ch >= 0x7f)
+			{
+				snprintf(hex, sizeof(hex), "\\x%02x", ch);
+				token += hex;
+			}
+			else
+				token += ch;
+		}
+
+		return token + "\"";
+	}
+
+	static uint64_t number(const std::string& token, size_t line)
+	{
+		char* end;
+		uint64_t value = token[0] == '-' ? (uint64_t)strtoll(token.c_str(), &end, 0) : strtoull(token.c_str(), &end, 0);
+
+		if(token.empty() || *end != '\0')
+			throw AssemblerError(line, "expected a number, not " + token);
+		return value;
+	}
+
+	static int opcode_named(std::string name)
+	{
+		for(char& ch : name)
+			ch = toupper((unsigned char)ch);
+
+		for(int op = 0; op < 256; op++)
+		{
+			const InstructionInfo& info = instruction_info(op);
+			if(info.length != 0 && name == info.name)
+				return op;
+		}
+		return -1;
+	}
+
+	static std::string label_at(uintptr_t offset)
+	{
+		return "L" + std::to_string(offset);
+	}
+
+	static uintptr_t label_offset(const std::map<std::string, uintptr_t>& labels, const std::string& label)
+	{
+		auto it = labels.find(label);
+
+		if(it == labels.end())
+			throw AssemblerError("no label named " + label);
+		return it->second;
+	}
+
+	void AsmProgram::assemble(std::istream& in)
+	{
+		std::vector<std::string> pending;
+		std::string source;
+		size_t line = 0;
+
+		while(std::getline(in, source))
+		{
+			std::vector<std::string> tokens = tokenize(source, ++line);
+
+			while(!tokens.empty() && tokens[0].size() > 1 && tokens[0].back() == ':')
+			{
+				pending.push_back(tokens[0].substr(0, tokens[0].size() - 1));
+				tokens.erase(tokens.begin());
+			}
+
+			if(tokens.empty())
+				continue;
+
+			if(tokens[0][0] == '.')
+			{
+				directive(tokens, line);
+				continue;
+			}
+
+			instruction(tokens, line);
+			code.back().labels = pending;
+			pending.clear();
+		}
+
+		if(!pending.empty())
+			throw AssemblerError(line, "label " + pending[0] + " doesn't name an instruction");
+	}
+
+	size_t AsmProgram::find_constant(const std::string& name, size_t line)
+	{
+		for(size_t i = 0; i < constants.size(); i++)
+		{
+			if(constants[i].name == name)
+				return i;
+		}
+		throw AssemblerError(line, "no constant named " + name);
+	}
+
+	void AsmProgram::directive(const std::vector<std::string>& tokens, size_t line)
+	{
+		const std::string& d = tokens[0];
+		size_t needed = (d == ".version" || d == ".module" || d == ".uses") ? 2 : 3;
+
+		if(tokens.size() < needed)
+			throw AssemblerError(line, d + " is missing an operand");
+
+		if(d == ".version")
+		{
+			version = number(tokens[1], line);
+			if(version != kBytecodeFixed && version != kBytecodeCompact)
+				throw AssemblerError(line, "no such bytecode version");
+			return;
+		}
+		if(d == ".module")
+		{
+			module = tokens[1];
+			return;
+		}
+		if(d == ".uses")
+		{
+			uses.push_back(tokens[1]);
+			return;
+		}
+		if(d == ".export")
+		{
+			if(tokens.size() != 4)
+				throw AssemblerError(line, ".export takes a name, an argument count and a label");
+			exports.push_back(AsmExport { tokens[1], (uint32_t)number(tokens[2], line), tokens[3] });
+			return;
+		}
+		if(d == ".method")
+		{
+			if(tokens.size() != 4 && tokens.size() != 5)
+				throw AssemblerError(line, ".method takes a name, an argument count, a label and maybe where it ends");
+			methods.push_back(AsmMethod { tokens[1], (uint32_t)number(tokens[2], line), tokens[3], tokens.size() == 5 ? tokens[4] : "" });
+			return;
+		}
+
+		AsmConstant c;
+		c.name  = tokens[1];
+		c.value = 0;
+
+		for(const AsmConstant& other : constants)
+		{
+			if(other.name == c.name)
+				throw AssemblerError(line, "there is already a constant named " + c.name);
+		}
+
+		if(d == ".integer")
+		{
+			c.kind  = kConstantInteger;
+			c.value = (intptr_t)number(tokens[2], line);
+		}
+		else if(d == ".string" || d == ".symbol")
+		{
+			c.kind = d == ".string" ? kConstantString : kConstantSymbol;
+			c.text = unquote(tokens[2], line);
+		}
+		else if(d == ".message")
+		{
+			ConstantKind name = constants[find_constant(tokens[2], line)].kind;
+
+			if(name != kConstantString && name != kConstantSymbol)
+				throw AssemblerError(line, "a message is named by a string or a symbol");
+			c.kind = kConstantMessage;
+			for(size_t i = 2; i < tokens.size(); i++)
+			{
+				if(i > 2 && constants[find_constant(tokens[i], line)].kind != kConstantMessage)
+					throw AssemblerError(line, "the arguments of a message are messages");
+				c.references.push_back(tokens[i]);
+			}
+		}
+		else if(d == ".import")
+		{
+			if(constants[find_constant(tokens[2], line)].kind != kConstantString)
+				throw AssemblerError(line, "an import is named by a string");
+			c.kind = kConstantImport;
+			c.references.push_back(tokens[2]);
+		}
+		else
+			throw AssemblerError(line, "no such directive " + d);
+
+		constants.push_back(c);
+	}
+
+	// Operands follow the instruction table: the registers first, then a constant for
+	// LOADI, a number for PUSH or a label for a jump.
+	void AsmProgram::instruction(const std::vector<std::string>& tokens, size_t line)
+	{
+		int op = opcode_named(tokens[0]);
+
+		if(op < 0)
+			throw AssemblerError(line, "no such instruction " + tokens[0]);
+
+		const InstructionInfo& info = instruction_info(op);
+		AsmInstruction insn;
+		size_t wanted;
+
+		insn.opcode    = op;
+		insn.nregs     = register_operands(info);
+		insn.immediate = 0;
+		memset(insn.registers, 0, sizeof(insn.registers));
+		wanted = 1 + insn.nregs + ((info.flags & (kInsnJump | kInsnImmediate)) ? 1 : 0);
+
+		if(tokens.size() != wanted)
+			throw AssemblerError(line, std::string(info.name) + " takes " + std::to_string(wanted - 1) + " operands");
+
+		for(uint8_t i = 0; i < insn.nregs; i++)
+		{
+			const std::string& reg = tokens[1 + i];
+			char* end;
+			unsigned long r = strtoul(reg.c_str() + 1, &end, 10);
+
+			if(reg.size() < 2 || (reg[0] != 'r' && reg[0] != 'R') || *end != '\0' || r >= CARIBOU_NUM_REGISTERS)
+				throw AssemblerError(line, "no such register " + reg);
+			insn.registers[i] = r;
+		}
+
+		const std::string& operand = tokens.back();
+		if(info.flags & kInsnJump)
+			insn.target = operand;
+		else if(op == Instructions::LOADI)
+			insn.immediate = operand[0] == '#' ? number(operand.substr(1), line) : find_constant(operand, line);
+		else if(info.flags & kInsnImmediate)
+			insn.immediate = number(operand, line);
+
+		code.push_back(insn);
+	}
+
+	void AsmProgram::disassemble(Image& image)
+	{
+		std::vector<uint8_t> fixed;
+		std::vector<uintptr_t> moved;
+		std::map<uintptr_t, size_t> starts;
+		std::set<uintptr_t> targets;
+		ModuleTables tables;
+		MethodDirectory directory;
+		ConstantPool& pool = image.get_constant_pool();
+		const std::vector<uint8_t>& custom = image.get_custom_section();
+
+		*this = AsmProgram();
+		version = image.get_bytecode_version();
+
+		if(!expand_instructions(image.get_instructions(), image.get_instruction_count(), version, fixed, &moved))
+			throw AssemblerError("the instructions can't be decoded");
+
+		if(ModuleTables::present(custom.data(), custom.size()))
+		{
+			if(!tables.parse(custom.data(), custom.size()))
+				throw AssemblerError("the module header is malformed");
+			module = tables.name;
+			uses   = tables.imports;
+		}
+		directory.parse(custom.data(), custom.size());
+
+		for(size_t i = 0; i < pool.size(); i++)
+		{
+			AsmConstant c;
+
+			c.kind  = pool.kind_of(i);
+			c.name  = "k" + std::to_string(i);
+			c.value = c.kind == kConstantInteger ? pool.integer_of(i) : 0;
+			if(c.kind == kConstantString || c.kind == kConstantSymbol)
+				c.text = pool.text_of(i);
+			for(uint32_t r : pool.references_of(i))
+				c.references.push_back("k" + std::to_string(r));
+			constants.push_back(c);
+		}
+
+		for(uintptr_t offset = 0; offset < fixed.size();)
+		{
+			DecodedInstruction decoded;
+			AsmInstruction insn;
+
+			decode_instruction(fixed.data(), fixed.size(), offset, kBytecodeFixed, decoded);
+			insn.opcode    = decoded.opcode;
+			insn.nregs     = decoded.nregs;
+			insn.immediate = 0;
+			memcpy(insn.registers, decoded.registers, sizeof(insn.registers));
+
+			if(instruction_info(insn.opcode).flags & kInsnJump)
+			{
+				insn.target = label_at(decoded.immediate);
+				targets.insert(decoded.immediate);
+			}
+			else
+				insn.immediate = decoded.immediate;
+
+			starts[offset] = code.size();
+			code.push_back(insn);
+			offset += decoded.length;
+		}
+
+		for(const ModuleExport& e : tables.exports)
+		{
+			if(e.offset >= moved.size() || moved[e.offset] == UINTPTR_MAX)
+				throw AssemblerError("export " + e.name + " doesn't start an instruction");
+			exports.push_back(AsmExport { e.name, e.nargs, label_at(moved[e.offset]) });
+			targets.insert(moved[e.offset]);
+		}
+
+		if(!directory.relocate(moved, 0))
+			throw AssemblerError("a method in the directory doesn't start and end on an instruction");
+
+		for(const MethodEntry& m : directory.methods)
+		{
+			uintptr_t end = fixed.size();
+
+			// An end is only spelled out if it isn't where the method would end anyway.
+			for(const MethodEntry& other : directory.methods)
+			{
+				if(other.offset > m.offset && other.offset < end)
+					end = other.offset;
+			}
+
+			methods.push_back(AsmMethod { m.name, m.nargs, label_at(m.offset), "" });
+			targets.insert(m.offset);
+
+			if(m.offset + m.length != end)
+			{
+				methods.back().end = label_at(m.offset + m.length);
+				targets.insert(m.offset + m.length);
+			}
+		}
+
+		for(uintptr_t target : targets)
+		{
+			auto it = starts.find(target);
+
+			if(it == starts.end())
+				throw AssemblerError("a label lands outside of the code");
+			code[it->second].labels.push_back(label_at(target));
+		}
+	}
+
+	void AsmProgram::print(std::ostream& out)
+	{
+		out << ".version " << (int)version << std::endl;
+		if(!module.empty())
+			out << ".module " << module << std::endl;
+		for(const std::string& name : uses)
+			out << ".uses " << name << std::endl;
+		for(const AsmExport& e : exports)
+			out << ".export " << e.name << " " << e.nargs << " " << e.label << std::endl;
+		for(const AsmMethod& m : methods)
+			out << ".method " << m.name << " " << m.nargs << " " << m.label << (m.end.empty() ? "" : " " + m.end) << std::endl;
+		out << std::endl;
+
+		for(const AsmConstant& c : constants)
+		{
+			switch(c.kind)
+			{
+				case kConstantInteger:
+					out << ".integer " << c.name << " " << c.value;
+					break;
+				case kConstantString:
+					out << ".string " << c.name << " " << quote(c.text);
+					break;
+				case kConstantSymbol:
+					out << ".symbol " << c.name << " " << quote(c.text);
+					break;
+				case kConstantMessage:
+					out << ".message " << c.name;
+					break;
+				case kConstantImport:
+					out << ".import " << c.name;
+					break;
+			}
+			for(const std::string& r : c.references)
+				out << " " << r;
+			out << std::endl;
+		}
+		if(!constants.empty())
+			out << std::endl;
+
+		for(const AsmInstruction& insn : code)
+		{
+			const InstructionInfo& info = instruction_info(insn.opcode);
+			std::vector<std::string> operands;
+
+			for(const std::string& label : insn.labels)
+				out << label << ":" << std::endl;
+
+			for(uint8_t i = 0; i < insn.nregs; i++)
+				operands.push_back("r" + std::to_string(insn.registers[i]));
+
+			if(info.flags & kInsnJump)
+				operands.push_back(insn.target);
+			else if(insn.opcode == Instructions::LOADI)
+				operands.push_back(insn.immediate < constants.size() ? constants[insn.immediate].name : "#" + std::to_string(insn.immediate));
+			else if(info.flags & kInsnImmediate)
+				operands.push_back(std::to_string(insn.immediate));
+
+			out << "\t" << info.name;
+			for(size_t i = 0; i < operands.size(); i++)
+				out << (i == 0 ? " " : ", ") << operands[i];
+			out << std::endl;
+		}
+	}
+
+	size_t AsmProgram::integer_constant(intptr_t value)
+	{
+		for(size_t i = 0; i < constants.size(); i++)
+		{
+			if(constants[i].kind == kConstantInteger && constants[i].value == value)
+				return i;
+		}
+
+		AsmConstant c;
+		c.kind  = kConstantInteger;
+		c.name  = "$" + std::to_string(value);
+		c.value = value;
+		constants.push_back(c);
+		return constants.size() - 1;
+	}
+
+	// Lays the instructions out as fixed bytecode, which the writer compacts if need be.
+	void AsmProgram::layout(std::vector<uint8_t>& bytes, std::map<std::string, uintptr_t>& labels)
+	{
+		uintptr_t offset = 0;
+
+		for(const AsmInstruction& insn : code)
+		{
+			for(const std::string& label : insn.labels)
+			{
+				if(!labels.insert(std::make_pair(label, offset)).second)
+					throw AssemblerError("label " + label + " is used twice");
+			}
+			offset += instruction_info(insn.opcode).length;
+		}
+
+		for(const AsmInstruction& insn : code)
+		{
+			const InstructionInfo& info = instruction_info(insn.opcode);
+			uintptr_t value = insn.immediate;
+
+			bytes.push_back(insn.opcode);
+			bytes.insert(bytes.end(), insn.registers, insn.registers + insn.nregs);
+
+			if(info.flags & kInsnJump)
+				value = label_offset(labels, insn.target);
+
+			if(info.flags & (kInsnJump | kInsnImmediate))
+			{
+				bytes.resize(bytes.size() + sizeof(uintptr_t));
+				write_intptr(bytes.data() + bytes.size() - sizeof(uintptr_t), value);
+			}
+		}
+	}
+
+	void AsmProgram::write(const char* filename)
+	{
+		std::vector<uint8_t> bytes;
+		std::map<std::string, uintptr_t> labels;
+		ConstantPoolBuilder pool;
+
+		layout(bytes, labels);
+
+		for(const AsmConstant& c : constants)
+		{
+			std::vector<uint32_t> references;
+
+			for(const std::string& r : c.references)
+				references.push_back(find_constant(r, 0));
+
+			switch(c.kind)
+			{
+				case kConstantInteger:
+					pool.add_integer(c.value);
+					break;
+				case kConstantString:
+					pool.add_string(c.text);
+					break;
+				case kConstantSymbol:
+					pool.add_symbol(c.text);
+					break;
+				case kConstantMessage:
+					pool.add_message(references[0], std::vector<uint32_t>(references.begin() + 1, references.end()));
+					break;
+				case kConstantImport:
+					pool.add_import(references[0]);
+					break;
+			}
+		}
+
+		OutputWriter writer(version);
+
+		if(module.empty() && exports.empty() && uses.empty() && methods.empty())
+		{
+			writer.dump(filename, pool.build(), bytes.data(), bytes.size());
+			return;
+		}
+
+		ModuleTables tables;
+		tables.name    = module;
+		tables.imports = uses;
+		for(const AsmExport& e : exports)
+			tables.exports.push_back(ModuleExport { e.name, e.nargs, label_offset(labels, e.label) });
+
+		MethodDirectory directory;
+		for(const AsmMethod& m : methods)
+		{
+			uintptr_t start = label_offset(labels, m.label);
+			uintptr_t end = bytes.size();
+
+			if(!m.end.empty())
+				end = label_offset(labels, m.end);
+			else
+			{
+				for(const AsmMethod& other : methods)
+				{
+					uintptr_t at = label_offset(labels, other.label);
+					if(at > start && at < end)
+						end = at;
+				}
+			}
+
+			if(end <= start)
+				throw AssemblerError("method " + m.name + " ends before it starts");
+			directory.methods.push_back(MethodEntry { m.name, m.nargs, start, end - start });
+		}
+
+		bool is_module = !module.empty() || !exports.empty() || !uses.empty();
+		writer.dump(filename, pool.build(), is_module ? &tables : nullptr, directory, bytes.data(), bytes.size());
+	}
+}
@@ -0,0 +1,144 @@
+/*
+ * Caribou Virtual Machine
+ * Copyright (c) 2011, Jeremy Tregunna, All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef __CARIBOU__ASSEMBLER_HPP__
+#define __CARIBOU__ASSEMBLER_HPP__
+
+#include <stdint.h>
+#include <iostream>
+#include <map>
+#include <string>
+#include <vector>
+#include "bytecode.hpp"
+#include "constant_pool.hpp"
+
+namespace Caribou
+{
+	class Image;
+
+	struct AsmConstant
+	{
+		ConstantKind             kind;
+		std::string              name;
+		// Integers.
+		intptr_t                 value;
+		// Strings and symbols.
+		std::string              text;
+		// The names of the constants a message or an import refers to: for a message its
+		// name and then its arguments, for an import the name of the module.
+		std::vector<std::string> references;
+	};
+
+	struct AsmInstruction
+	{
+		uint8_t                  opcode;
+		uint8_t                  nregs;
+		uint8_t                  registers[3];
+		// The index of the constant LOADI loads, or the value PUSH pushes.
+		uintptr_t                immediate;
+		// The label a jump goes to.
+		std::string              target;
+		// The labels which name this instruction.
+		std::vector<std::string> labels;
+	};
+
+	struct AsmExport
+	{
+		std::string name;
+		uint32_t    nargs;
+		std::string label;
+	};
+
+	struct AsmMethod
+	{
+		std::string name;
+		uint32_t    nargs;
+		std::string label;
+		// Where the method ends, if not where the next one starts or at the end of the code.
+		std::string end;
+	};
+
+	/* A program in between its text and its image. Anything the instruction table knows
+	   about can be assembled, by name, one instruction to a line:
+
+	     ; Comments run to the end of the line.
+	     .version 2                    ; compact, the default, or 1 for fixed
+	     .module Math                  ; the module's name, if it is one
+	     .uses Lists                   ; a module it imports from
+	     .export five 0 five           ; a method, its argument count and its label
+	     .method six 0 six             ; a method in the directory, and where it ends
+	     .integer k0 5                 ; constants, each with a name of its own
+	     .string k1 "five"
+	     .symbol k2 "five"
+	     .message k3 k1                ; its name, then any arguments
+	     .import k4 k5                 ; the string naming the module
+	   five:
+	     LOADI r3, k0
+	     JMP five
+
+	   Registers are r0 to r7. LOADI takes the name of a constant, or #n for an index with
+	   no constant behind it, PUSH a number and JMP a label. ROTATE, ARRAY and STRING take
+	   a register holding how many to pop. Disassembling gives text which assembles back
+	   into the same image. */
+	class AsmProgram
+	{
+	public:
+		uint8_t                     version;
+		std::string                 module;
+		std::vector<std::string>    uses;
+		std::vector<AsmExport>      exports;
+		std::vector<AsmMethod>      methods;
+		std::vector<AsmConstant>    constants;
+		std::vector<AsmInstruction> code;
+
+		AsmProgram() : version(kBytecodeCompact) {}
+
+		void assemble(std::istream& in);
+		void disassemble(Image& image);
+		void print(std::ostream& out);
+		// Writes the image out through an OutputWriter.
+		void write(const char* filename);
+
+		// The index of the integer constant with value, which is added if there isn't one.
+		size_t integer_constant(intptr_t value);
+
+	private:
+		size_t find_constant(const std::string& name, size_t line);
+		void directive(const std::vector<std::string>& tokens, size_t line);
+		void instruction(const std::vector<std::string>& tokens, size_t line);
+		void layout(std::vector<uint8_t>& bytes, std::map<std::string, uintptr_t>& labels);
+	};
+
+	class AssemblerError
+	{
+	private:
+		std::string reason;
+
+	public:
+		AssemblerError(std::string why) : reason(why) {}
+		AssemblerError(size_t line, std::string why) : reason("line " + std::to_string(line) + ": " + why) {}
+		const std::string message() const { return reason; }
+	};
+}
+
+#endif /* !__CARIBOU__ASSEMBLER_HPP__ */
@@ -0,0 +1,444 @@
+/*
+ * Caribou Virtual Machine
+ * Copyright (c) 2011, Jeremy Tregunna, All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#include <set>
+#include "baseline_jit.hpp"
+#include "machine.hpp"
+#include "vmmethod.hpp"
+
+// Set as a method's count once it has been compiled, or never will be.
+#define DONE_COUNTING UINT32_MAX
+
+namespace Caribou
+{
+	// What the templates call. Every helper takes the machine and the registers, then up
+	// to four operands, whether it uses them or not, so that one template does for all.
+	static void jit_move(Machine* m, Object** regs, uintptr_t a, uintptr_t b, uintptr_t, uintptr_t)
+	{
+		m->move(regs, a, b);
+	}
+
+	static void jit_loadi(Machine* m, Object** regs, uintptr_t a, uintptr_t i, uintptr_t, uintptr_t)
+	{
+		m->loadi(regs, a, i);
+	}
+
+	static void jit_push(Machine* m, Object** regs, uintptr_t a, uintptr_t, uintptr_t, uintptr_t)
+	{
+		m->push(regs, a);
+	}
+
+	static void jit_pop(Machine* m, Object** regs, uintptr_t a, uintptr_t, uintptr_t, uintptr_t)
+	{
+		m->pop(regs, a);
+	}
+
+	static void jit_swap(Machine* m, Object**, uintptr_t, uintptr_t, uintptr_t, uintptr_t)
+	{
+		m->swap();
+	}
+
+	static void jit_rotate(Machine* m, Object** regs, uintptr_t a, uintptr_t, uintptr_t, uintptr_t)
+	{
+		m->rotate(regs, a);
+	}
+
+	static void jit_dup(Machine* m, Object**, uintptr_t, uintptr_t, uintptr_t, uintptr_t)
+	{
+		m->dup();
+	}
+
+	template <void (Machine::*handler)(Object**, uint8_t, uint8_t, uint8_t)>
+	static void jit_arithmetic(Machine* m, Object** regs, uintptr_t a, uintptr_t b, uintptr_t c, uintptr_t)
+	{
+		(m->*handler)(regs, a, b, c);
+	}
+
+	static void jit_not(Machine* m, Object** regs, uintptr_t a, uintptr_t b, uintptr_t, uintptr_t)
+	{
+		m->bitwise_not(regs, a, b);
+	}
+
+	// Whether the comparison failed, and the instruction after it is to be skipped. The
+	// handler skips it by moving ip past it, so ip has to be on it to begin with.
+	template <void (Machine::*handler)(Object**, uint8_t, uint8_t, uint8_t)>
+	static bool jit_compare(Machine* m, Object** regs, uintptr_t a, uintptr_t b, uintptr_t c, uintptr_t next)
+	{
+		m->set_instruction_pointer(next);
+		(m->*handler)(regs, a, b, c);
+		return m->get_instruction_pointer() != next;
+	}
+
+	static void jit_addsym(Machine* m, Object** regs, uintptr_t a, uintptr_t b, uintptr_t, uintptr_t)
+	{
+		m->addsym(regs, a, b);
+	}
+
+	static void jit_findsym(Machine* m, Object** regs, uintptr_t a, uintptr_t b, uintptr_t, uintptr_t)
+	{
+		m->findsym(regs, a, b);
+	}
+
+	static void jit_array(Machine* m, Object** regs, uintptr_t a, uintptr_t, uintptr_t, uintptr_t)
+	{
+		m->make_array(regs, a);
+	}
+
+	static void jit_string(Machine* m, Object** regs, uintptr_t a, uintptr_t, uintptr_t, uintptr_t)
+	{
+		m->make_string(regs, a);
+	}
+
+	// Hands the instruction at a back to the interpreter.
+	static void jit_leave(Machine* m, Object**, uintptr_t a, uintptr_t, uintptr_t, uintptr_t)
+	{
+		m->set_instruction_pointer(a);
+	}
+
+	// Every entry into a method saves the registers the machine and the registers of the
+	// frame are kept in, then jumps to the instruction it starts at. rbp is only saved to
+	// keep the stack aligned for the calls.
+	static const uint8_t prologue_template[] =
+	{
+		0x53,                   // push rbx
+		0x41, 0x54,             // push r12
+		0x55,                   // push rbp
+		0x48, 0x89, 0xfb,       // mov rbx, rdi
+		0x49, 0x89, 0xf4,       // mov r12, rsi
+		0xe9, 0, 0, 0, 0        // jmp rel32
+	};
+
+	static const uint8_t epilogue_template[] =
+	{
+		0x5d,                   // pop rbp
+		0x41, 0x5c,             // pop r12
+		0x5b,                   // pop rbx
+		0xc3                    // ret
+	};
+
+	// helper(machine, registers, a, b, c, d)
+	static const uint8_t call_template[] =
+	{
+		0x48, 0x89, 0xdf,                   // mov rdi, rbx
+		0x4c, 0x89, 0xe6,                   // mov rsi, r12
+		0x48, 0xba, 0, 0, 0, 0, 0, 0, 0, 0, // mov rdx, a
+		0x48, 0xb9, 0, 0, 0, 0, 0, 0, 0, 0, // mov rcx, b
+		0x49, 0xb8, 0, 0, 0, 0, 0, 0, 0, 0, // mov r8, c
+		0x49, 0xb9, 0, 0, 0, 0, 0, 0, 0, 0, // mov r9, d
+		0x48, 0xb8, 0, 0, 0, 0, 0, 0, 0, 0, // mov rax, helper
+		0xff, 0xd0                          // call rax
+	};
+
+	// Where the operands of a call go, then the helper.
+	static const size_t call_operands[] = { 8, 18, 28, 38, 48 };
+
+	// Taken when a comparison's helper says it failed.
+	static const uint8_t skip_template[] =
+	{
+		0x84, 0xc0,                  // test al, al
+		0x0f, 0x85, 0, 0, 0, 0       // jnz rel32
+	};
+
+	static const uint8_t jump_template[] =
+	{
+		0xe9, 0, 0, 0, 0             // jmp rel32
+	};
+
+	static void emit(std::vector<uint8_t>& out, const uint8_t* bytes, size_t length)
+	{
+		out.insert(out.end(), bytes, bytes + length);
+	}
+
+	static void call(std::vector<uint8_t>& out, uintptr_t helper, uintptr_t a, uintptr_t b = 0, uintptr_t c = 0, uintptr_t d = 0)
+	{
+		const uintptr_t operands[] = { a, b, c, d, helper };
+		size_t at = out.size();
+
+		emit(out, call_template, sizeof(call_template));
+		for(size_t i = 0; i < 5; i++)
+			memcpy(&out[at + call_operands[i]], &operands[i], sizeof(uintptr_t));
+	}
+
+	// A jump whose displacement is the last four bytes of what was emitted, to be patched
+	// once where it goes is known.
+	static void patch(std::vector<uint8_t>& out, size_t end, size_t target)
+	{
+		int32_t displacement = static_cast<int32_t>(target - end);
+		memcpy(&out[end - 4], &displacement, sizeof(displacement));
+	}
+
+	BaselineJit::BaselineJit() : code(nullptr), count(0), version(kBytecodeFixed)
+	{
+	}
+
+	BaselineJit::~BaselineJit()
+	{
+		release();
+	}
+
+	void BaselineJit::release()
+	{
+		for(const std::pair<void*, size_t>& p : pages)
+			munmap(p.first, p.second);
+		pages.clear();
+	}
+
+	void BaselineJit::reset(const uint8_t* c, size_t n, uint8_t v)
+	{
+		release();
+		calls.clear();
+		code    = c;
+		count   = n;
+		version = v;
+		table.assign(n, nullptr);
+	}
+
+	void BaselineJit::entered(VMMethod* method)
+	{
+		uintptr_t start = method->get_start_ip();
+
+		if(start >= count || table[start] != nullptr || !method->facts.verified)
+			return;
+
+		uint32_t& n = calls[start];
+		if(n == DONE_COUNTING)
+			return;
+		if(++n == CARIBOU_WARM_METHOD)
+		{
+			compile(start);
+			n = DONE_COUNTING;
+		}
+	}
+
+	// Every instruction the method can get to from start, in order.
+	bool BaselineJit::reachable(uintptr_t start, std::vector<uintptr_t>& offsets)
+	{
+		std::set<uintptr_t> seen;
+		std::vector<uintptr_t> pending(1, start);
+
+		while(!pending.empty())
+		{
+			uintptr_t offset = pending.back();
+			DecodedInstruction insn;
+
+			pending.pop_back();
+			if(!seen.insert(offset).second)
+				continue;
+			if(!decode_instruction(code, count, offset, version, insn))
+				return false;
+
+			const InstructionInfo& info = instruction_info(insn.opcode);
+			uintptr_t next = offset + insn.length;
+
+			if(info.flags & kInsnJump)
+				pending.push_back(insn.immediate);
+			if(info.flags & kInsnSkip)
+				pending.push_back(skip_target(next));
+			if(!(info.flags & kInsnTerminator))
+				pending.push_back(next);
+		}
+
+		offsets.assign(seen.begin(), seen.end());
+		return true;
+	}
+
+	// Where a failed comparison carries on, given where the instruction after it starts.
+	uintptr_t BaselineJit::skip_target(uintptr_t next)
+	{
+		DecodedInstruction skipped;
+
+		if(version == kBytecodeCompact && decode_instruction(code, count, next, version, skipped))
+			return next + skipped.length;
+		return next + instruction_info(Instructions::JMP).length;
+	}
+
+	void BaselineJit::compile(uintptr_t start)
+	{
+		static const uintptr_t arithmetic[] =
+		{
+			reinterpret_cast<uintptr_t>(jit_arithmetic<&Machine::add>),
+			reinterpret_cast<uintptr_t>(jit_arithmetic<&Machine::sub>),
+			reinterpret_cast<uintptr_t>(jit_arithmetic<&Machine::mul>),
+			reinterpret_cast<uintptr_t>(jit_arithmetic<&Machine::div>),
+			reinterpret_cast<uintptr_t>(jit_arithmetic<&Machine::mod>),
+			reinterpret_cast<uintptr_t>(jit_arithmetic<&Machine::pow>)
+		};
+		static const uintptr_t comparison[] =
+		{
+			reinterpret_cast<uintptr_t>(jit_compare<&Machine::eq>),
+			reinterpret_cast<uintptr_t>(jit_compare<&Machine::lt>),
+			reinterpret_cast<uintptr_t>(jit_compare<&Machine::lte>),
+			reinterpret_cast<uintptr_t>(jit_compare<&Machine::gt>),
+			reinterpret_cast<uintptr_t>(jit_compare<&Machine::gte>)
+		};
+		std::vector<uintptr_t> offsets;
+		std::vector<uint8_t> out;
+		// Where the code for each instruction starts, the jumps to instructions and the
+		// jumps to the epilogue, by where they end.
+		std::unordered_map<uintptr_t, size_t> position;
+		std::vector<std::pair<size_t, uintptr_t> > jumps;
+		std::vector<size_t> leaves;
+		std::vector<uintptr_t> entries;
+
+		if(!reachable(start, offsets))
+			return;
+
+		for(size_t i = 0; i < offsets.size(); i++)
+		{
+			DecodedInstruction insn;
+			uintptr_t offset = offsets[i];
+
+			decode_instruction(code, count, offset, version, insn);
+			const uint8_t* r = insn.registers;
+			uintptr_t next = offset + insn.length;
+			bool runs = true;
+
+			position[offset] = out.size();
+			switch(insn.opcode)
+			{
+				case Instructions::NOOP:
+					break;
+				case Instructions::MOVE:
+					call(out, reinterpret_cast<uintptr_t>(jit_move), r[0], r[1]);
+					break;
+				case Instructions::LOADI:
+					call(out, reinterpret_cast<uintptr_t>(jit_loadi), r[0], insn.immediate);
+					break;
+				case Instructions::PUSH:
+					call(out, reinterpret_cast<uintptr_t>(jit_push), insn.immediate);
+					break;
+				case Instructions::POP:
+					call(out, reinterpret_cast<uintptr_t>(jit_pop), r[0]);
+					break;
+				case Instructions::SWAP:
+					call(out, reinterpret_cast<uintptr_t>(jit_swap), 0);
+					break;
+				case Instructions::ROTATE:
+					call(out, reinterpret_cast<uintptr_t>(jit_rotate), r[0]);
+					break;
+				case Instructions::DUP:
+					call(out, reinterpret_cast<uintptr_t>(jit_dup), 0);
+					break;
+				case Instructions::ADD:
+				case Instructions::SUB:
+				case Instructions::MUL:
+				case Instructions::DIV:
+				case Instructions::MOD:
+				case Instructions::POW:
+					call(out, arithmetic[insn.opcode - Instructions::ADD], r[0], r[1], r[2]);
+					break;
+				case Instructions::NOT:
+					call(out, reinterpret_cast<uintptr_t>(jit_not), r[0], r[1]);
+					break;
+				case Instructions::EQ:
+				case Instructions::LT:
+				case Instructions::LTE:
+				case Instructions::GT:
+				case Instructions::GTE:
+					call(out, comparison[insn.opcode - Instructions::EQ], r[0], r[1], r[2], next);
+					emit(out, skip_template, sizeof(skip_template));
+					jumps.push_back(std::make_pair(out.size(), skip_target(next)));
+					break;
+				case Instructions::JMP:
+					// Jumps backwards are left to the interpreter, to count and trace.
+					if(insn.immediate > offset)
+					{
+						emit(out, jump_template, sizeof(jump_template));
+						jumps.push_back(std::make_pair(out.size(), insn.immediate));
+					}
+					else
+						runs = false;
+					break;
+				case Instructions::ADDSYM:
+					call(out, reinterpret_cast<uintptr_t>(jit_addsym), r[0], r[1]);
+					break;
+				case Instructions::FINDSYM:
+					call(out, reinterpret_cast<uintptr_t>(jit_findsym), r[0], r[1]);
+					break;
+				case Instructions::ARRAY:
+					call(out, reinterpret_cast<uintptr_t>(jit_array), r[0]);
+					break;
+				case Instructions::STRING:
+					call(out, reinterpret_cast<uintptr_t>(jit_string), r[0]);
+					break;
+				default:
+					runs = false;
+					break;
+			}
+
+			if(!runs)
+			{
+				call(out, reinterpret_cast<uintptr_t>(jit_leave), offset);
+				emit(out, jump_template, sizeof(jump_template));
+				leaves.push_back(out.size());
+				continue;
+			}
+
+			entries.push_back(offset);
+
+			// Carry on with the next instruction, wherever it was put.
+			if(insn.opcode != Instructions::JMP && (i + 1 == offsets.size() || offsets[i + 1] != next))
+			{
+				emit(out, jump_template, sizeof(jump_template));
+				jumps.push_back(std::make_pair(out.size(), next));
+			}
+		}
+
+		size_t epilogue = out.size();
+		emit(out, epilogue_template, sizeof(epilogue_template));
+
+		std::vector<size_t> stubs;
+		for(uintptr_t offset : entries)
+		{
+			stubs.push_back(out.size());
+			emit(out, prologue_template, sizeof(prologue_template));
+			patch(out, out.size(), position[offset]);
+		}
+
+		for(const std::pair<size_t, uintptr_t>& j : jumps)
+			patch(out, j.first, position[j.second]);
+		for(size_t end : leaves)
+			patch(out, end, epilogue);
+
+		// Written, then made executable; never both at once.
+		size_t page = sysconf(_SC_PAGESIZE);
+		size_t length = (out.size() + page - 1) / page * page;
+		void* memory = mmap(nullptr, length, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		if(memory == MAP_FAILED)
+			return;
+
+		memcpy(memory, out.data(), out.size());
+		if(mprotect(memory, length, PROT_READ | PROT_EXEC) != 0)
+		{
+			munmap(memory, length);
+			return;
+		}
+		pages.push_back(std::make_pair(memory, length));
+
+		for(size_t i = 0; i < entries.size(); i++)
+			table[entries[i]] = reinterpret_cast<NativeFunction>(static_cast<uint8_t*>(memory) + stubs[i]);
+	}
+}
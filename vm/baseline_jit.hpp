@@ -0,0 +1,82 @@
+/*
+ * Caribou Virtual Machine
+ * Copyright (c) 2011, Jeremy Tregunna, All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef __CARIBOU__BASELINE_JIT_HPP__
+#define __CARIBOU__BASELINE_JIT_HPP__
+
+#include <stdint.h>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+#include "native_code.hpp"
+
+// How many times a method has to be called before it is compiled.
+#define CARIBOU_WARM_METHOD 8
+
+namespace Caribou
+{
+	class VMMethod;
+
+	/* Compiles methods which have been called a few times to x86-64 machine code, without
+	   LLVM. Nothing is optimised: every instruction has a template of machine code which
+	   calls the interpreter's own handler for it, and compiling a method is copying those
+	   templates out one after the other, filling in their operands and patching up the
+	   jumps between them. That is cheap enough to be worth doing for methods which are
+	   only warm, and does away with decoding and dispatching each instruction.
+
+	   Compiled code is run the same way code compiled ahead of time is, from a table of
+	   functions indexed by instruction. The instructions left to the interpreter are the
+	   same too, along with jumps backwards, so that loops are still counted and traced. */
+	class BaselineJit
+	{
+	public:
+		BaselineJit();
+		~BaselineJit();
+
+		// Forgets everything compiled, for the given instructions.
+		void reset(const uint8_t* code, size_t count, uint8_t version);
+
+		// Counts a call to a method, and compiles it once it's warm.
+		void entered(VMMethod* method);
+
+		// The function to run for each offset into the instructions, or nullptr.
+		const NativeFunction* get_table() { return table.data(); }
+
+	private:
+		bool reachable(uintptr_t start, std::vector<uintptr_t>& offsets);
+		void compile(uintptr_t start);
+		void release();
+		uintptr_t skip_target(uintptr_t next);
+
+		const uint8_t*                          code;
+		size_t                                  count;
+		uint8_t                                 version;
+		std::vector<NativeFunction>             table;
+		// How many times each method has been called, by where it starts.
+		std::unordered_map<uintptr_t, uint32_t> calls;
+		// The executable memory compiled methods are in, and how big each piece is.
+		std::vector<std::pair<void*, size_t> >  pages;
+	};
+}
+
+#endif /* !__CARIBOU__BASELINE_JIT_HPP__ */
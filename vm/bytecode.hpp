@@ -28,13 +28,24 @@
 
 namespace Caribou
 {
+	// How instructions are encoded, as given by the version in the header.
+	enum BytecodeVersion
+	{
+		// Registers take a byte each, and immediates are pointer sized and big-endian.
+		// Jumps are to an absolute offset.
+		kBytecodeFixed   = 1,
+		// Registers are packed two to a byte, immediates are LEB128, and jumps are
+		// relative to the jump.
+		kBytecodeCompact = 2
+	};
+
 	struct __attribute__((packed, aligned(1))) BytecodeHeader
 	{
 		// Magic string.
 		char     name[4];
 
 		// The following field represents a version number of the bytecode image.
-		// It's a serial number incrementing from 0.
+		// It's a serial number incrementing from 0, and picks a BytecodeVersion.
 		uint8_t  version;
 
 		// Denotes the space required for the constants pool which follows.
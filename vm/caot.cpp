@@ -0,0 +1,63 @@
+/*
+ * Caribou Virtual Machine
+ * Copyright (c) 2011, Jeremy Tregunna, All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#include <iostream>
+#include <fstream>
+#include <stdlib.h>
+#include "aot_compiler.hpp"
+#include "input_reader.hpp"
+#include "image.hpp"
+
+using namespace Caribou;
+
+// Writes out the C++ for an image, to be compiled into a shared object named after the
+// image with ".so" on the end; see docs/architecture.md.
+int main(int argc, char* argv[])
+{
+	if(argc != 3)
+	{
+		std::cout << "Usage: " << argv[0] << " image output" << std::endl;
+		exit(1);
+	}
+
+	Image image;
+	InputReader reader(image);
+	reader.load(argv[1]);
+	if(image.get_instruction_count() == 0)
+	{
+		std::cerr << "Can't read " << argv[1] << std::endl;
+		exit(1);
+	}
+
+	std::ofstream out(argv[2]);
+	if(!out)
+	{
+		std::cerr << "Can't write " << argv[2] << std::endl;
+		exit(1);
+	}
+
+	if(AotCompiler(image).compile(out) == 0)
+		std::cerr << "Nothing in " << argv[1] << " verifies; it will all be interpreted." << std::endl;
+
+	return 0;
+}
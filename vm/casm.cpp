@@ -0,0 +1,123 @@
+/*
+ * Caribou Virtual Machine
+ * Copyright (c) 2011, Jeremy Tregunna, All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#include <iostream>
+#include <fstream>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "assembler.hpp"
+#include "peephole.hpp"
+#include "input_reader.hpp"
+#include "image.hpp"
+
+using namespace Caribou;
+
+// Whether the file is an image rather than text, going by its magic number.
+static bool is_image(const char* filename)
+{
+	std::ifstream in(filename, std::ios::binary);
+	char magic[4];
+
+	return in.read(magic, sizeof(magic)) && memcmp(magic, "CRBU", sizeof(magic)) == 0;
+}
+
+int main(int argc, char* argv[])
+{
+	AsmProgram program;
+	bool disassemble = false;
+	bool optimise = false;
+	int version = 0;
+	int ch;
+
+	while((ch = getopt(argc, argv, "dOv:")) != -1)
+	{
+		switch(ch)
+		{
+			case 'd':
+				disassemble = true;
+				break;
+			case 'O':
+				optimise = true;
+				break;
+			case 'v':
+				version = strtoul(optarg, NULL, 10);
+				break;
+			default:
+				std::cout << "Usage: " << argv[0] << " [-d] [-O] [-v 1|2] input [output]" << std::endl;
+				exit(1);
+		}
+	}
+
+	if(argv[optind] == NULL || (!disassemble && argv[optind + 1] == NULL))
+	{
+		std::cout << "Need an input and an output." << std::endl;
+		exit(1);
+	}
+
+	// Images are read back into text form, so they can be disassembled, optimised or
+	// written out again in another encoding.
+	try
+	{
+		if(is_image(argv[optind]))
+		{
+			Image image;
+			InputReader reader(image);
+			reader.load(argv[optind]);
+			program.disassemble(image);
+		}
+		else
+		{
+			std::ifstream in(argv[optind]);
+			if(!in)
+			{
+				std::cerr << "Can't read " << argv[optind] << std::endl;
+				exit(1);
+			}
+			program.assemble(in);
+		}
+
+		if(version != 0)
+			program.version = version;
+
+		if(optimise)
+			PeepholeOptimizer(program).run();
+
+		if(!disassemble)
+			program.write(argv[optind + 1]);
+		else if(argv[optind + 1] == NULL)
+			program.print(std::cout);
+		else
+		{
+			std::ofstream out(argv[optind + 1]);
+			program.print(out);
+		}
+	}
+	catch(const AssemblerError& e)
+	{
+		std::cerr << e.message() << std::endl;
+		exit(1);
+	}
+
+	return 0;
+}
@@ -0,0 +1,328 @@
+/*
+ * Caribou Virtual Machine
+ * Copyright (c) 2011, Jeremy Tregunna, All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#include "constant_pool.hpp"
+#include "endian.hpp"
+#include "gc.hpp"
+#include "symtab.hpp"
+#include "integer.hpp"
+#include "message.hpp"
+#include "linker.hpp"
+
+namespace Caribou
+{
+	ConstantPool::~ConstantPool()
+	{
+		delete[] values;
+	}
+
+	bool ConstantPool::load(std::vector<uint8_t>&& pool)
+	{
+		owned = std::move(pool);
+		return load(owned.data(), owned.size());
+	}
+
+	bool ConstantPool::load(const uint8_t* pool, size_t pool_length)
+	{
+		bytes  = pool;
+		length = pool_length;
+		entries.clear();
+		delete[] values;
+		values = nullptr;
+		count  = 0;
+
+		if(!index(pool, pool_length))
+		{
+			entries.clear();
+			length = 0;
+			return false;
+		}
+
+		count  = entries.size();
+		values = new std::atomic<Object*>[count];
+		for(size_t i = 0; i < count; i++)
+			values[i].store(nullptr, std::memory_order_relaxed);
+		return true;
+	}
+
+	// Finds where each entry starts, making sure everything in it is within the pool.
+	bool ConstantPool::index(const uint8_t* pool, size_t length)
+	{
+		size_t offset = 4;
+		uint32_t n;
+
+		if(length == 0)
+			return true;
+		if(length < 4)
+			return false;
+
+		n = read_uint32(pool);
+		for(uint32_t i = 0; i < n; i++)
+		{
+			if(offset >= length)
+				return false;
+
+			Entry e = { static_cast<ConstantKind>(pool[offset]), static_cast<uint32_t>(offset + 1) };
+			size_t end = e.offset;
+
+			switch(e.kind)
+			{
+				case kConstantInteger:
+					end += sizeof(uintptr_t);
+					break;
+				case kConstantString:
+				case kConstantSymbol:
+					if(end + 4 > length)
+						return false;
+					end += 4 + read_uint32(pool + end);
+					break;
+				case kConstantMessage:
+				{
+					if(end + 8 > length)
+						return false;
+
+					uint32_t name = read_uint32(pool + end);
+					uint32_t argc = read_uint32(pool + end + 4);
+
+					if(name >= i || (entries[name].kind != kConstantString && entries[name].kind != kConstantSymbol))
+						return false;
+					if(end + 8 + (size_t)argc * 4 > length)
+						return false;
+					for(uint32_t a = 0; a < argc; a++)
+					{
+						uint32_t arg = read_uint32(pool + end + 8 + a * 4);
+						if(arg >= i || entries[arg].kind != kConstantMessage)
+							return false;
+					}
+					end += 8 + (size_t)argc * 4;
+					break;
+				}
+				case kConstantImport:
+				{
+					if(end + 4 > length)
+						return false;
+
+					uint32_t name = read_uint32(pool + end);
+					if(name >= i || entries[name].kind != kConstantString)
+						return false;
+					end += 4;
+					break;
+				}
+				default:
+					return false;
+			}
+
+			if(end > length)
+				return false;
+
+			entries.push_back(e);
+			offset = end;
+		}
+
+		return true;
+	}
+
+	// Any number of machines may ask for the same constant at once; only one of them makes it.
+	Object* ConstantPool::materialise(size_t i)
+	{
+		std::lock_guard<std::mutex> guard(lock);
+		GarbageCollector* previous = collector;
+
+		Object* value;
+
+		collector = heap;
+		try
+		{
+			value = make(i);
+		}
+		catch(...)
+		{
+			collector = previous;
+			throw;
+		}
+		collector = previous;
+
+		return value;
+	}
+
+	Object* ConstantPool::make(size_t i)
+	{
+		Object* value = values[i].load(std::memory_order_relaxed);
+
+		if(value != nullptr)
+			return value;
+
+		const Entry& e = entries[i];
+		const uint8_t* p = bytes + e.offset;
+
+		switch(e.kind)
+		{
+			case kConstantInteger:
+				value = new Integer(static_cast<intptr_t>(read_intptr(p)));
+				break;
+			case kConstantString:
+				value = symtab->lookup(symtab->intern(text(e)));
+				break;
+			case kConstantSymbol:
+				value = new Integer(symtab->intern(text(e)));
+				break;
+			case kConstantMessage:
+			{
+				std::vector<Message*> arguments;
+				uint32_t argc = read_uint32(p + 4);
+
+				for(uint32_t a = 0; a < argc; a++)
+					arguments.push_back(static_cast<Message*>(make(read_uint32(p + 8 + a * 4))));
+				value = new Message(text(entries[read_uint32(p)]), arguments);
+				break;
+			}
+			case kConstantImport:
+			{
+				std::string module = text(entries[read_uint32(p)]);
+
+				if(resolver == nullptr)
+					throw LinkError("no module " + module + " has been linked in");
+				value = resolver->resolve(module);
+				break;
+			}
+		}
+
+		values[i].store(value, std::memory_order_release);
+		return value;
+	}
+
+	intptr_t ConstantPool::integer_of(size_t i)
+	{
+		return static_cast<intptr_t>(read_intptr(bytes + entries[i].offset));
+	}
+
+	std::vector<uint32_t> ConstantPool::references_of(size_t i)
+	{
+		const uint8_t* p = bytes + entries[i].offset;
+		std::vector<uint32_t> references;
+
+		if(entries[i].kind == kConstantMessage)
+		{
+			references.push_back(read_uint32(p));
+			for(uint32_t a = 0; a < read_uint32(p + 4); a++)
+				references.push_back(read_uint32(p + 8 + a * 4));
+		}
+		else if(entries[i].kind == kConstantImport)
+			references.push_back(read_uint32(p));
+
+		return references;
+	}
+
+	void ConstantPool::append_to(std::vector<uint8_t>& out, uint32_t base)
+	{
+		for(size_t i = 0; i < entries.size(); i++)
+		{
+			const Entry& e = entries[i];
+			const uint8_t* p = bytes + e.offset;
+			size_t end = i + 1 < entries.size() ? entries[i + 1].offset - 1 : length;
+			uint32_t refs = 0;
+
+			// References come first in the entries which have them.
+			if(e.kind == kConstantMessage)
+				refs = 2 + read_uint32(p + 4);
+			else if(e.kind == kConstantImport)
+				refs = 1;
+
+			out.push_back(e.kind);
+			for(uint32_t r = 0; r < refs; r++)
+			{
+				uint32_t value = read_uint32(p + r * 4);
+
+				// The argument count of a message isn't a reference.
+				if(!(e.kind == kConstantMessage && r == 1))
+					value += base;
+				for(int shift = 24; shift >= 0; shift -= 8)
+					out.push_back((value >> shift) & 0xff);
+			}
+			out.insert(out.end(), p + refs * 4, bytes + end);
+		}
+	}
+
+	std::string ConstantPool::text(const Entry& e)
+	{
+		const uint8_t* p = bytes + e.offset;
+		return std::string(reinterpret_cast<const char*>(p + 4), read_uint32(p));
+	}
+
+	void ConstantPoolBuilder::put32(uint32_t value)
+	{
+		for(int shift = 24; shift >= 0; shift -= 8)
+			entries.push_back((value >> shift) & 0xff);
+	}
+
+	uint32_t ConstantPoolBuilder::add_integer(intptr_t value)
+	{
+		entries.push_back(kConstantInteger);
+		for(int i = sizeof(uintptr_t) - 1; i >= 0; i--)
+			entries.push_back(((uintptr_t)value >> (i * 8)) & 0xff);
+		return count++;
+	}
+
+	uint32_t ConstantPoolBuilder::add_string(const std::string& str)
+	{
+		entries.push_back(kConstantString);
+		put32(str.size());
+		entries.insert(entries.end(), str.begin(), str.end());
+		return count++;
+	}
+
+	uint32_t ConstantPoolBuilder::add_symbol(const std::string& str)
+	{
+		entries.push_back(kConstantSymbol);
+		put32(str.size());
+		entries.insert(entries.end(), str.begin(), str.end());
+		return count++;
+	}
+
+	uint32_t ConstantPoolBuilder::add_message(uint32_t name, const std::vector<uint32_t>& arguments)
+	{
+		entries.push_back(kConstantMessage);
+		put32(name);
+		put32(arguments.size());
+		for(uint32_t arg : arguments)
+			put32(arg);
+		return count++;
+	}
+
+	uint32_t ConstantPoolBuilder::add_import(uint32_t module)
+	{
+		entries.push_back(kConstantImport);
+		put32(module);
+		return count++;
+	}
+
+	std::vector<uint8_t> ConstantPoolBuilder::build()
+	{
+		std::vector<uint8_t> section;
+
+		for(int shift = 24; shift >= 0; shift -= 8)
+			section.push_back((count >> shift) & 0xff);
+		section.insert(section.end(), entries.begin(), entries.end());
+		return section;
+	}
+}
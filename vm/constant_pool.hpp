@@ -0,0 +1,165 @@
+/*
+ * Caribou Virtual Machine
+ * Copyright (c) 2011, Jeremy Tregunna, All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef __CARIBOU__CONSTANT_POOL_HPP__
+#define __CARIBOU__CONSTANT_POOL_HPP__
+
+#include <stdint.h>
+#include <atomic>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace Caribou
+{
+	class Object;
+	class GarbageCollector;
+	class Symtab;
+
+	// What a constant in the pool is. Each entry is its kind, one byte, followed by:
+	//  kConstantInteger  a pointer sized immediate, the same as in an instruction
+	//  kConstantString   a 32-bit length and that many bytes
+	//  kConstantSymbol   a 32-bit length and that many bytes
+	//  kConstantMessage  the 32-bit index of a string or symbol constant for the name, a
+	//                    32-bit argument count, and the 32-bit index of each argument,
+	//                    which must be a message constant
+	//  kConstantImport   the 32-bit index of a string constant naming a module; it gives
+	//                    the object holding what that module exports
+	// All of them are big-endian. Constants may only refer to constants before them.
+	enum ConstantKind
+	{
+		kConstantInteger = 0,
+		kConstantString,
+		kConstantSymbol,
+		kConstantMessage,
+		kConstantImport
+	};
+
+	// Finds the module an import constant names. Whoever links modules together provides one.
+	class ImportResolver
+	{
+	public:
+		virtual ~ImportResolver() {}
+		virtual Object* resolve(const std::string& module) = 0;
+	};
+
+	// The constant pool section of an image. It is indexed when the image is loaded, but
+	// nothing in it is made into an object until LOADI first asks for it. Strings and
+	// symbols are interned in the image's symbol table: a string constant gives the
+	// interned String, a symbol constant its index, like ADDSYM does.
+	class ConstantPool
+	{
+	public:
+		ConstantPool() : bytes(nullptr), length(0), values(nullptr), count(0), heap(nullptr), symtab(nullptr), resolver(nullptr) {}
+		~ConstantPool();
+
+		// Indexes the pool, which has to stay where it is for as long as the pool does.
+		// Returns false, leaving the pool empty, if it is malformed.
+		bool load(const uint8_t* pool, size_t length);
+		// The same, for a pool which was read in rather than mapped.
+		bool load(std::vector<uint8_t>&& pool);
+
+		// Where the objects made out of constants go.
+		void set_owner(GarbageCollector* gc, Symtab* table)
+		{
+			heap   = gc;
+			symtab = table;
+		}
+
+		void set_resolver(ImportResolver* r) { resolver = r; }
+
+		size_t size() { return count; }
+
+		// The section as it was loaded.
+		const uint8_t* data() { return bytes; }
+		size_t data_size() { return length; }
+
+		// What is in the pool, for looking at it without making anything out of it. The
+		// references are those of a message or an import, in the order they're stored.
+		ConstantKind kind_of(size_t i) { return entries[i].kind; }
+		intptr_t integer_of(size_t i);
+		std::string text_of(size_t i) { return text(entries[i]); }
+		std::vector<uint32_t> references_of(size_t i);
+
+		// Writes out every entry, with the constants they refer to moved up by base, for
+		// putting several pools together into one.
+		void append_to(std::vector<uint8_t>& out, uint32_t base);
+
+		inline Object* get(size_t i)
+		{
+			Object* value = values[i].load(std::memory_order_acquire);
+
+			if(value == nullptr)
+				value = materialise(i);
+			return value;
+		}
+
+	private:
+		struct Entry
+		{
+			ConstantKind kind;
+			// Where what follows the kind starts.
+			uint32_t     offset;
+		};
+
+		bool index(const uint8_t* pool, size_t length);
+		Object* materialise(size_t i);
+		Object* make(size_t i);
+		std::string text(const Entry& e);
+
+		const uint8_t*        bytes;
+		size_t                length;
+		std::vector<uint8_t>  owned;
+		std::vector<Entry>    entries;
+		std::atomic<Object*>* values;
+		size_t                count;
+		GarbageCollector*     heap;
+		Symtab*               symtab;
+		ImportResolver*       resolver;
+		std::mutex            lock;
+	};
+
+	// Puts a constant pool section together, for writing out an image.
+	class ConstantPoolBuilder
+	{
+	public:
+		ConstantPoolBuilder() : count(0) {}
+
+		uint32_t add_integer(intptr_t value);
+		uint32_t add_string(const std::string& str);
+		uint32_t add_symbol(const std::string& str);
+		uint32_t add_message(uint32_t name, const std::vector<uint32_t>& arguments);
+		uint32_t add_import(uint32_t module);
+
+		// The section, starting with the number of constants in it.
+		std::vector<uint8_t> build();
+
+	private:
+		void put32(uint32_t value);
+
+		std::vector<uint8_t> entries;
+		uint32_t             count;
+	};
+}
+
+#endif /* !__CARIBOU__CONSTANT_POOL_HPP__ */
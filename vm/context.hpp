@@ -28,59 +28,127 @@
 #include <stdint.h>
 #include <string.h>
 #include "vmmethod.hpp"
+#include "persistence.hpp"
 
-#define CARIBOU_MAX_STACK_SIZE 256
-#define CARIBOU_NUM_REGISTERS  8
+#define CARIBOU_NUM_REGISTERS      8
+#define CARIBOU_CACHE_LINE         64
+// Where the stack of a method starts out when nobody knows how deep it gets. It grows from
+// there as needed.
+#define CARIBOU_INITIAL_STACK_SIZE 16
 
 namespace Caribou
 {
 	class Object;
+	struct Timer;
 
-	struct Context
+	// Frames come out of the machine's FramePool. The first cache line holds everything an
+	// instruction needs besides its registers, which fill the second one. The operand stack
+	// is not part of the frame; it is handed in by the pool, sized for the method. If the
+	// method's stack depth isn't known, pushing past the end moves the stack to the heap.
+	struct alignas(CARIBOU_CACHE_LINE) Context
 	{
-		Context*  previous;
-		VMMethod* method;
-		uintptr_t return_address;
+		Object**     stk;
+		VMMethod*    method;
+		uintptr_t    return_address;
+		// The log this frame's stack operations are recorded in, once anything is.
+		RevisionLog* log;
+		// Frames the scheduler pushes to run a message out of a mailbox are detached, and hold
+		// the actor the message was for. The actor is busy until the frame returns, and what
+		// it returns goes to the reply its mailbox is holding, if any, instead of the frame
+		// beneath it.
+		Object*      actor;
+		// The timeout this context is waiting out in AWAITFOR, if any.
+		Timer*       wait_timer;
+		// Where this frame sits on the return stack.
+		uint32_t     depth;
+		uint32_t     sp;
+		uint32_t     capacity;
+		bool         detached;
+		// Frames captured by a continuation are frozen, and shared between the continuation
+		// and the return stack. They are never written to again; the machine makes a copy of
+		// a frozen frame before it changes anything in it.
+		bool         frozen;
+		// The stack has outgrown the space the pool gave it, and lives on the heap.
+		bool         spilled;
+		// How many cache lines of stack the pool gave the frame.
+		uint8_t      lines;
+
 		// Register 0: Reserved for the receiver of the method
 		// Register 1: Reserved for the method locals
 		// Register 2: Reserved to hold the return value of child calls
 		// Register 3-7: General purpose registers
-		Object*   registers[CARIBOU_NUM_REGISTERS];
-		uint8_t   sp;
-		Object*   stk[CARIBOU_MAX_STACK_SIZE];
-
-		Context() {}
+		alignas(CARIBOU_CACHE_LINE) Object* registers[CARIBOU_NUM_REGISTERS];
 
-		Context(Context* ctx, VMMethod* meth, uintptr_t ra)
+		Context(Context* ctx, VMMethod* meth, uintptr_t ra, Object** stack, uint32_t size)
 		{
-			previous = ctx;
+			stk = stack;
 			method = meth;
 			return_address = ra;
+			sp = 0;
+			capacity = size;
+			detached = false;
+			actor = nullptr;
+			wait_timer = nullptr;
+			frozen = false;
+			spilled = false;
+			depth = ctx != NULL ? ctx->depth + 1 : 0;
+			log = ctx != NULL ? ctx->log : nullptr;
+			memset(registers, 0, sizeof(registers));
 		}
 
-		Context(const Context& ctx)
+		Context(const Context& ctx, Object** stack, uint32_t size)
 		{
-			previous       = ctx.previous;
+			stk            = stack;
 			method         = ctx.method;
 			return_address = ctx.return_address;
-			sp             = ctx.sp;
-			memcpy(registers, ctx.registers, CARIBOU_NUM_REGISTERS);
-			memcpy(stk, ctx.stk, CARIBOU_MAX_STACK_SIZE);
+			sp             = 0;
+			capacity       = size;
+			detached       = ctx.detached;
+			actor          = ctx.actor;
+			wait_timer     = nullptr;
+			frozen         = false;
+			spilled        = false;
+			depth          = ctx.depth;
+			log            = ctx.log;
+			memcpy(registers, ctx.registers, sizeof(registers));
+			reserve(ctx.sp);
+			// Nothing above the stack pointer is ever read.
+			sp = ctx.sp;
+			memcpy(stk, ctx.stk, sp * sizeof(Object*));
 		}
 
+		Context(const Context&) = delete;
+
+		// Makes sure the stack has room for n objects.
+		inline void reserve(uint32_t n)
+		{
+			if(n > capacity)
+				grow(n);
+		}
+
+		void grow(uint32_t n);
+
 		inline void push(Object* val)
 		{
+			reserve(sp + 1);
 			stk[sp++] = val;
+			if(log != nullptr)
+				log->record_push(depth, val);
 		}
 
 		inline Object* pop()
 		{
-			return stk[--sp];
+			Object* val = stk[--sp];
+			if(log != nullptr)
+				log->record_pop(depth, val);
+			return val;
 		}
 
 		inline Object* top()
 		{
-			return stk[sp];
+			if(sp == 0)
+				return NULL;
+			return stk[sp - 1];
 		}
 	};
 }
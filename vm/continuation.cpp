@@ -22,6 +22,7 @@
  */
 
 #include "continuation.hpp"
+#include "coroutine.hpp"
 
 namespace Caribou
 {
@@ -34,12 +35,21 @@ namespace Caribou
 
 	void Continuation::save_current_stack()
 	{
-		saved_stack = machine->copy_return_stack();
+		saved_stack = machine->capture_return_stack();
 		saved_ip    = machine->get_instruction_pointer();
+		stack       = &machine->get_return_stack();
 	}
 
+	// The saved frames replace whatever is on the stack being run. Put on another stack, a
+	// coroutine's frames would end up running as though they weren't in one, and the other
+	// way round.
 	void Continuation::restore_stack()
 	{
+		if(saved_stack == nullptr)
+			throw DeadContinuationError("Continuation restored with nothing saved in it");
+		if(stack != &machine->get_return_stack())
+			throw CoroutineError("Continuation restored on a different return stack from the one it was saved on");
+
 		machine->set_return_stack(saved_stack);
 		machine->set_instruction_pointer(saved_ip);
 	}
@@ -53,4 +63,9 @@ namespace Caribou
 	{
 		// Walk the return stack, and all the contexts stacks too.
 	}
+
+	const std::string EscapeContinuation::object_name()
+	{
+		return "EscapeContinuation";
+	}
 }
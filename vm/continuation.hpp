@@ -33,13 +33,16 @@ namespace Caribou
 	struct Context;
 
 	/* Our continuations are implemented by saving the contents of our call stack onto the heap.
-	   They are also per virtual core, meaning you must pass a machine in when you create the
-	   continuation. */
+	   The frames themselves aren't copied: they are frozen and shared with the machine, which
+	   copies a frame only once it needs to write to it. They are also per virtual core,
+	   meaning you must pass a machine in when you create the continuation, and per return
+	   stack: one saved in a coroutine can only be restored in that coroutine, and one saved
+	   outside of any only outside of them. */
 	class Continuation : public Object
 	{
 	public:
-		Continuation() : machine(nullptr) {}
-		Continuation(Machine* m) : machine(m) {}
+		Continuation() : saved_stack(nullptr), stack(nullptr), machine(nullptr) {}
+		Continuation(Machine* m) : saved_stack(nullptr), stack(nullptr), machine(m) {}
 		~Continuation()
 		{
 			delete saved_stack;
@@ -56,8 +59,46 @@ namespace Caribou
 	private:
 		Stack<Context*>* saved_stack;
 		uintptr_t        saved_ip;
+		// The return stack the continuation was saved from.
+		Stack<Context*>* stack;
 		Machine*         machine;
 	};
+
+	/* An escape continuation can only be used to get back out to the frame it was made in,
+	   while that frame is still on the return stack, and only once. All it needs to know is
+	   which return stack it was, how deep it was, how deep the frame's operand stack was and
+	   where to carry on. */
+	class EscapeContinuation : public Object
+	{
+	public:
+		EscapeContinuation(Stack<Context*>* s, size_t d, uintptr_t ip, uint32_t sp) : stack(s), depth(d), resume_ip(ip), resume_sp(sp), valid(true) {}
+
+		Stack<Context*>* get_stack() { return stack; }
+		size_t get_depth() { return depth; }
+		uintptr_t get_resume_ip() { return resume_ip; }
+		uint32_t get_resume_sp() { return resume_sp; }
+		bool is_valid() { return valid; }
+		void invalidate() { valid = false; }
+
+		virtual const std::string object_name();
+
+	private:
+		Stack<Context*>* stack;
+		size_t           depth;
+		uintptr_t        resume_ip;
+		uint32_t         resume_sp;
+		bool             valid;
+	};
+
+	class DeadContinuationError
+	{
+	private:
+		std::string reason;
+
+	public:
+		DeadContinuationError(std::string why = "Escape continuation used after its frame returned, or from another coroutine") : reason(why) {}
+		const std::string message() const { return reason; }
+	};
 }
 
 #endif /* !__CARIBOU__CONTINUATION_HPP__ */
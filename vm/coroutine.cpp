@@ -0,0 +1,61 @@
+/*
+ * Caribou Virtual Machine
+ * Copyright (c) 2011, Jeremy Tregunna, All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#include "coroutine.hpp"
+
+namespace Caribou
+{
+	Coroutine::Coroutine(Context* entry, uintptr_t start) : state(kCoroutineSuspended), resume_ip(start), resumer(nullptr), return_ip(0)
+	{
+		stack.push(entry);
+	}
+
+	void Coroutine::resumed(Coroutine* by, uintptr_t ip)
+	{
+		state     = kCoroutineRunning;
+		resumer   = by;
+		return_ip = ip;
+	}
+
+	void Coroutine::suspended(uintptr_t ip)
+	{
+		state     = kCoroutineSuspended;
+		resume_ip = ip;
+	}
+
+	void Coroutine::finished()
+	{
+		state   = kCoroutineDead;
+		resumer = nullptr;
+	}
+
+	const std::string Coroutine::object_name()
+	{
+		return "Coroutine";
+	}
+
+	void Coroutine::walk()
+	{
+		// Walk the frames on our stack, like a continuation would.
+	}
+}
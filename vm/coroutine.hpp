@@ -0,0 +1,82 @@
+/*
+ * Caribou Virtual Machine
+ * Copyright (c) 2011, Jeremy Tregunna, All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef __CARIBOU__COROUTINE_HPP__
+#define __CARIBOU__COROUTINE_HPP__
+
+#include <string>
+#include "object.hpp"
+#include "stack.hpp"
+
+namespace Caribou
+{
+	enum CoroutineState
+	{
+		kCoroutineSuspended,
+		kCoroutineRunning,
+		kCoroutineDead
+	};
+
+	// A method running on a return stack of its own. Switching to it and back only swaps
+	// which stack the machine runs on, whatever is on either of them.
+	class Coroutine : public Object
+	{
+	public:
+		Coroutine(Context* entry, uintptr_t start);
+
+		Stack<Context*>* get_stack() { return &stack; }
+		CoroutineState get_state() { return state; }
+
+		// Where the coroutine carries on from the next time it is resumed.
+		uintptr_t get_resume_ip() { return resume_ip; }
+		// Who resumed it last, or nullptr for the main stack, and where they carry on.
+		Coroutine* get_resumer() { return resumer; }
+		uintptr_t get_return_ip() { return return_ip; }
+
+		void resumed(Coroutine* by, uintptr_t ip);
+		void suspended(uintptr_t ip);
+		void finished();
+
+		virtual const std::string object_name();
+		virtual void walk();
+
+	private:
+		Stack<Context*> stack;
+		CoroutineState  state;
+		uintptr_t       resume_ip;
+		Coroutine*      resumer;
+		uintptr_t       return_ip;
+	};
+
+	class CoroutineError
+	{
+	private:
+		std::string reason;
+
+	public:
+		CoroutineError(std::string why) : reason(why) {}
+		const std::string message() const { return reason; }
+	};
+}
+
+#endif /* !__CARIBOU__COROUTINE_HPP__ */
@@ -25,6 +25,7 @@
 #define __CARIBOU__ENDIAN_HPP__
 
 #include <stdint.h>
+#include <stddef.h>
 
 namespace Caribou
 {
@@ -60,6 +61,45 @@ namespace Caribou
 			endian_swap(reinterpret_cast<uint64_t&>(x));
 	}
 	#endif
+
+	// Fixed size fields in the constant pool and in snapshots are big-endian.
+	inline uint32_t read_uint32(const uint8_t* p)
+	{
+		return (uint32_t)p[0] << 24 | (uint32_t)p[1] << 16 | (uint32_t)p[2] << 8 | p[3];
+	}
+
+	inline uint64_t read_uint64(const uint8_t* p)
+	{
+		return (uint64_t)read_uint32(p) << 32 | read_uint32(p + 4);
+	}
+
+	// Reads a pointer sized immediate out of the instruction stream, the same way the
+	// machine decodes one as it goes.
+	inline uintptr_t read_intptr(const uint8_t* p)
+	{
+		uintptr_t r = 0;
+
+		for(size_t i = 0; i < sizeof(uintptr_t); i++)
+			r = (r << 8) | p[i];
+
+		if(big_endian())
+			endian_swap(r);
+
+		return r;
+	}
+
+	// The other way around, for patching an immediate in place.
+	inline void write_intptr(uint8_t* p, uintptr_t value)
+	{
+		if(big_endian())
+			endian_swap(value);
+
+		for(size_t i = sizeof(uintptr_t); i > 0; i--)
+		{
+			p[i - 1] = value & 0xff;
+			value >>= 8;
+		}
+	}
 }
 
 #endif /* !__CARIBOU__ENDIAN_HPP__ */
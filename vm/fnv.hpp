@@ -0,0 +1,47 @@
+/*
+ * Caribou Virtual Machine
+ * Copyright (c) 2011, Jeremy Tregunna, All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef __CARIBOU__FNV_HPP__
+#define __CARIBOU__FNV_HPP__
+
+#include <stdint.h>
+#include <stddef.h>
+
+namespace Caribou
+{
+	static const uint64_t kFNVOffsetBasis = 14695981039346656037ULL;
+	static const uint64_t kFNVPrime       = 1099511628211ULL;
+
+	// 64-bit FNV-1a. Start from kFNVOffsetBasis, and feed the result back in to hash more.
+	inline uint64_t fnv1a(uint64_t hash, const uint8_t* bytes, size_t length)
+	{
+		for(size_t i = 0; i < length; i++)
+		{
+			hash ^= bytes[i];
+			hash *= kFNVPrime;
+		}
+		return hash;
+	}
+}
+
+#endif /* !__CARIBOU__FNV_HPP__ */
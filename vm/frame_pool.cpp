@@ -0,0 +1,187 @@
+/*
+ * Caribou Virtual Machine
+ * Copyright (c) 2011, Jeremy Tregunna, All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <new>
+#include "frame_pool.hpp"
+#include "vmmethod.hpp"
+
+namespace Caribou
+{
+	static const uint32_t slots_per_line = CARIBOU_CACHE_LINE / sizeof(Object*);
+
+	static inline uint8_t lines_for(uint32_t slots)
+	{
+		return (slots + slots_per_line - 1) / slots_per_line;
+	}
+
+	static inline uint32_t slots_for(VMMethod* method)
+	{
+		uint32_t slots = method->facts.max_stack;
+
+		if(slots == CARIBOU_STACK_UNKNOWN)
+			slots = CARIBOU_INITIAL_STACK_SIZE;
+		return slots;
+	}
+
+	// Each frame is followed by its operand stack.
+	static inline size_t frame_size(uint8_t lines)
+	{
+		return sizeof(Context) + lines * CARIBOU_CACHE_LINE;
+	}
+
+	void Context::grow(uint32_t n)
+	{
+		uint32_t size = capacity * 2;
+
+		if(size < CARIBOU_INITIAL_STACK_SIZE)
+			size = CARIBOU_INITIAL_STACK_SIZE;
+		if(size < n)
+			size = n;
+
+		Object** bigger = static_cast<Object**>(malloc(size * sizeof(Object*)));
+		if(bigger == nullptr)
+			throw std::bad_alloc();
+
+		memcpy(bigger, stk, sp * sizeof(Object*));
+		if(spilled)
+			free(stk);
+
+		stk      = bigger;
+		capacity = size;
+		spilled  = true;
+	}
+
+	FramePool::FramePool()
+	{
+		memset(free_lists, 0, sizeof(free_lists));
+	}
+
+	FramePool::~FramePool()
+	{
+		for(void* chunk : chunks)
+			free(chunk);
+	}
+
+	void FramePool::grow(uint8_t lines)
+	{
+		size_t size = frame_size(lines);
+		void* chunk;
+
+		if(posix_memalign(&chunk, CARIBOU_CACHE_LINE, size * CARIBOU_FRAMES_PER_CHUNK) != 0)
+			throw std::bad_alloc();
+		chunks.push_back(chunk);
+
+		for(size_t i = CARIBOU_FRAMES_PER_CHUNK; i > 0; i--)
+		{
+			FreeFrame* f = reinterpret_cast<FreeFrame*>(static_cast<char*>(chunk) + (i - 1) * size);
+			f->next = free_lists[lines];
+			free_lists[lines] = f;
+		}
+	}
+
+	void* FramePool::allocate(uint8_t lines)
+	{
+		if(lines > CARIBOU_POOLED_STACK_LINES)
+		{
+			void* frame;
+			if(posix_memalign(&frame, CARIBOU_CACHE_LINE, frame_size(lines)) != 0)
+				throw std::bad_alloc();
+			return frame;
+		}
+
+		if(free_lists[lines] == nullptr)
+			grow(lines);
+
+		FreeFrame* f = free_lists[lines];
+		free_lists[lines] = f->next;
+		return f;
+	}
+
+	Context* FramePool::acquire(Context* previous, VMMethod* method, uintptr_t return_address)
+	{
+		uint8_t lines = lines_for(slots_for(method));
+		void* frame = allocate(lines);
+		Context* ctx = new(frame) Context(previous, method, return_address, stack_of(frame), lines * slots_per_line);
+		ctx->lines = lines;
+		return ctx;
+	}
+
+	Context* FramePool::reuse(Context* ctx, VMMethod* method)
+	{
+		uintptr_t    return_address = ctx->return_address;
+		Object*      actor          = ctx->actor;
+		bool         detached       = ctx->detached;
+		uint32_t     depth          = ctx->depth;
+		RevisionLog* log            = ctx->log;
+		Context*     frame;
+
+		if(ctx->frozen || ctx->lines < lines_for(slots_for(method)))
+		{
+			frame = acquire(NULL, method, return_address);
+			if(!ctx->frozen)
+				release(ctx);
+		}
+		else
+		{
+			uint8_t lines = ctx->lines;
+
+			if(ctx->spilled)
+				free(ctx->stk);
+
+			frame = new(ctx) Context(NULL, method, return_address, stack_of(ctx), lines * slots_per_line);
+			frame->lines = lines;
+		}
+
+		frame->actor    = actor;
+		frame->detached = detached;
+		frame->depth    = depth;
+		frame->log      = log;
+		return frame;
+	}
+
+	Context* FramePool::copy(const Context& other)
+	{
+		void* frame = allocate(other.lines);
+		Context* ctx = new(frame) Context(other, stack_of(frame), other.lines * slots_per_line);
+		ctx->lines = other.lines;
+		return ctx;
+	}
+
+	void FramePool::release(Context* ctx)
+	{
+		if(ctx->spilled)
+			free(ctx->stk);
+
+		if(ctx->lines > CARIBOU_POOLED_STACK_LINES)
+		{
+			free(ctx);
+			return;
+		}
+
+		FreeFrame* f = reinterpret_cast<FreeFrame*>(ctx);
+		f->next = free_lists[ctx->lines];
+		free_lists[ctx->lines] = f;
+	}
+}
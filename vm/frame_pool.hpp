@@ -0,0 +1,75 @@
+/*
+ * Caribou Virtual Machine
+ * Copyright (c) 2011, Jeremy Tregunna, All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef __CARIBOU__FRAME_POOL_HPP__
+#define __CARIBOU__FRAME_POOL_HPP__
+
+#include <vector>
+#include "context.hpp"
+
+// How many frames to allocate at a time.
+#define CARIBOU_FRAMES_PER_CHUNK   32
+// Frames with more stack than this, in cache lines, are allocated one at a time.
+#define CARIBOU_POOLED_STACK_LINES 32
+
+namespace Caribou
+{
+	// Where a machine gets its frames from. Each frame is allocated together with room for
+	// the deepest its method's stack gets, rounded up to a cache line. Frames with the same
+	// amount of room are allocated CARIBOU_FRAMES_PER_CHUNK at a time, and frames which are
+	// released are kept on a free list to be handed out again. Everything is freed along
+	// with the pool.
+	class FramePool
+	{
+	public:
+		FramePool();
+		~FramePool();
+
+		Context* acquire(Context* previous, VMMethod* method, uintptr_t return_address);
+		// Hands a frame over to another method, in place if it has room enough for its stack.
+		// The frame keeps where it sits, where it returns to and who it replies to.
+		Context* reuse(Context* ctx, VMMethod* method);
+		// A new frame with the same contents as another.
+		Context* copy(const Context&);
+		void release(Context*);
+
+	private:
+		struct FreeFrame
+		{
+			FreeFrame* next;
+		};
+
+		void* allocate(uint8_t lines);
+		void grow(uint8_t lines);
+
+		static inline Object** stack_of(void* frame)
+		{
+			return reinterpret_cast<Object**>(static_cast<Context*>(frame) + 1);
+		}
+
+		FreeFrame*         free_lists[CARIBOU_POOLED_STACK_LINES + 1];
+		std::vector<void*> chunks;
+	};
+}
+
+#endif /* !__CARIBOU__FRAME_POOL_HPP__ */
@@ -0,0 +1,56 @@
+/*
+ * Caribou Virtual Machine
+ * Copyright (c) 2011, Jeremy Tregunna, All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef __CARIBOU__FUTURE_HPP__
+#define __CARIBOU__FUTURE_HPP__
+
+#include "object.hpp"
+
+namespace Caribou
+{
+	// The reply to an asynchronous send. It is handed back to the sender straight away, and
+	// resolved with the return value once the receiver's method executes RET.
+	class Future : public Object
+	{
+	public:
+		Future() : value(nullptr), resolved(false) {}
+
+		void resolve(Object* v)
+		{
+			value    = v;
+			resolved = true;
+		}
+
+		bool is_resolved() { return resolved; }
+		Object* get_value() { return value; }
+
+		virtual const std::string object_name();
+		virtual void walk();
+
+	private:
+		Object* value;
+		bool    resolved;
+	};
+}
+
+#endif /* !__CARIBOU__FUTURE_HPP__ */
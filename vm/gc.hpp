@@ -26,6 +26,7 @@
 
 #include <vector>
 #include <stdint.h>
+#include <stdlib.h>
 #include <limits.h>
 #include "address.hpp"
 
@@ -37,7 +38,8 @@ namespace Caribou
 	class GCObject;
 	class GarbageCollector;
 
-	extern GarbageCollector* collector;
+	// The heap of the machine running on the current thread.
+	extern thread_local GarbageCollector* collector;
 
 	enum GCColours
 	{
@@ -55,7 +57,7 @@ namespace Caribou
 		uint8_t   reserved:6;
 		GCObject* object;
 
-		GCMarker(unsigned int c = kGCColourFreed) : colour(c) {}
+		GCMarker(unsigned int c = kGCColourFreed) : next(nullptr), prev(nullptr), colour(c) {}
 
 		inline size_t count_in_set()
 		{
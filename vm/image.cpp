@@ -0,0 +1,101 @@
+/*
+ * Caribou Virtual Machine
+ * Copyright (c) 2011, Jeremy Tregunna, All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#include <sys/mman.h>
+#include <unistd.h>
+#include <algorithm>
+#include "image.hpp"
+#include "gc.hpp"
+#include "object_space.hpp"
+#include "snapshot.hpp"
+#include "method_loader.hpp"
+#include "native_code.hpp"
+
+namespace Caribou
+{
+	Image::Image() : instructions(nullptr), icount(0), version(kBytecodeFixed), mapping(nullptr), mapping_size(0), entry(0), snapshot(nullptr), methods(nullptr), native(nullptr), space(nullptr)
+	{
+		heap = new GarbageCollector(nullptr);
+
+		pool.set_owner(heap, &symtab);
+	}
+
+	Image::~Image()
+	{
+		delete snapshot;
+		delete methods;
+		delete native;
+		if(mapping != nullptr)
+			munmap(mapping, mapping_size);
+		else
+			delete[] instructions;
+	}
+
+	ObjectSpace* Image::get_object_space()
+	{
+		std::call_once(space_made, [this]()
+		{
+			if(space != nullptr)
+				return;
+
+			GarbageCollector* previous = collector;
+			collector = heap;
+			space = new ObjectSpace();
+			if(methods != nullptr)
+				methods->install(space);
+			collector = previous;
+		});
+
+		return space;
+	}
+
+	void Image::advise(int advice)
+	{
+		if(mapping != nullptr)
+			madvise(mapping, mapping_size, advice);
+	}
+
+	void Image::advise(int advice, uintptr_t offset, size_t length)
+	{
+		if(mapping == nullptr || offset >= icount)
+			return;
+
+		uintptr_t page = sysconf(_SC_PAGESIZE);
+		uintptr_t start = reinterpret_cast<uintptr_t>(instructions + offset) & ~(page - 1);
+		uintptr_t end = reinterpret_cast<uintptr_t>(instructions + offset) + std::min(length, icount - offset);
+
+		madvise(reinterpret_cast<void*>(start), end - start, advice);
+	}
+
+	void Image::set_method_loader(MethodLoader* loader)
+	{
+		delete methods;
+		methods = loader;
+	}
+
+	void Image::set_native_code(NativeCode* code)
+	{
+		delete native;
+		native = code;
+	}
+}
@@ -0,0 +1,146 @@
+/*
+ * Caribou Virtual Machine
+ * Copyright (c) 2011, Jeremy Tregunna, All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef __CARIBOU__IMAGE_HPP__
+#define __CARIBOU__IMAGE_HPP__
+
+#include <sys/types.h>
+#include <stdint.h>
+#include <mutex>
+#include <vector>
+#include "verifier.hpp"
+#include "bytecode.hpp"
+#include "constant_pool.hpp"
+#include "symtab.hpp"
+
+namespace Caribou
+{
+	class Object;
+	class ObjectSpace;
+	class GarbageCollector;
+	class Snapshot;
+	class MethodLoader;
+	class NativeCode;
+
+	// A loaded program. Once loaded it is never written to again, so any number of
+	// machines, each running in its own thread, can share one image: the instructions,
+	// the constant pool and the core ObjectSpace only exist once per process. Objects
+	// belonging to the image are allocated from its own heap, not from a machine's. The
+	// only things which change are the constants, as they're made, and the symbol table,
+	// and both do their own locking.
+	class Image
+	{
+	public:
+		Image();
+		~Image();
+
+		// Room for the instructions to be read into.
+		uint8_t* allocate_instruction_memory(size_t size)
+		{
+			uint8_t* memory = new uint8_t[size];
+
+			icount       = size;
+			instructions = memory;
+			return memory;
+		}
+
+		// Runs the instructions straight out of a read-only mapping of the whole file,
+		// starting offset bytes in. The image unmaps it when it goes.
+		void map_instructions(void* base, size_t length, size_t offset)
+		{
+			mapping      = base;
+			mapping_size = length;
+			icount       = length - offset;
+			instructions = static_cast<const uint8_t*>(base) + offset;
+		}
+
+		bool is_mapped() { return mapping != nullptr; }
+		// Tells the kernel how the mapping is going to be read, if there is one: all of it,
+		// or length bytes of the instructions from offset on.
+		void advise(int advice);
+		void advise(int advice, uintptr_t offset, size_t length);
+
+		const uint8_t* get_instructions() { return instructions; }
+		size_t get_instruction_count() { return icount; }
+
+		// How the instructions are encoded; fixed unless the header says otherwise.
+		uint8_t get_bytecode_version() { return version; }
+		void set_bytecode_version(uint8_t v) { version = v; }
+
+		// The custom header section, which holds the tables of a module.
+		const std::vector<uint8_t>& get_custom_section() { return custom; }
+		void set_custom_section(std::vector<uint8_t>&& section) { custom = std::move(section); }
+
+		ConstantPool& get_constant_pool() { return pool; }
+		Object* get_constant(size_t i) { return pool.get(i); }
+		size_t get_constant_count() { return pool.size(); }
+
+		Symtab& get_symtab() { return symtab; }
+
+		// The object space is only made when first asked for, unless a snapshot brings one.
+		ObjectSpace* get_object_space();
+		void set_object_space(ObjectSpace* s) { space = s; }
+		GarbageCollector* get_heap() { return heap; }
+
+		// What the verifier found out about the code at the start of the image.
+		const MethodFacts& get_entry_facts() { return entry_facts; }
+		void set_entry_facts(const MethodFacts& facts) { entry_facts = facts; }
+
+		// Where machines start running. Images start at the beginning, and snapshots
+		// wherever the machine they were taken from stopped.
+		uintptr_t get_entry_point() { return entry; }
+		void set_entry_point(uintptr_t ip) { entry = ip; }
+
+		// The snapshot the image was loaded from, if any. The image owns it.
+		void set_snapshot(Snapshot* s) { snapshot = s; }
+
+		// Loads the methods in the image's directory as they're called, if it has one. The
+		// image owns it, and it puts its methods in the object space when that is made.
+		MethodLoader* get_method_loader() { return methods; }
+		void set_method_loader(MethodLoader* loader);
+
+		// The image compiled ahead of time, if it has been. The image owns it.
+		NativeCode* get_native_code() { return native; }
+		void set_native_code(NativeCode* code);
+
+	private:
+		const uint8_t*    instructions;
+		size_t            icount;
+		uint8_t           version;
+		void*             mapping;
+		size_t            mapping_size;
+		MethodFacts       entry_facts;
+		uintptr_t         entry;
+		Snapshot*         snapshot;
+		MethodLoader*     methods;
+		NativeCode*       native;
+		std::vector<uint8_t> custom;
+		ConstantPool      pool;
+		Symtab            symtab;
+		ObjectSpace*      space;
+		std::once_flag    space_made;
+		GarbageCollector* heap;
+	};
+}
+
+#endif /* !__CARIBOU__IMAGE_HPP__ */
@@ -0,0 +1,202 @@
+/*
+ * Caribou Virtual Machine
+ * Copyright (c) 2011, Jeremy Tregunna, All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <vector>
+#include "image_cache.hpp"
+#include "image.hpp"
+#include "bytecode.hpp"
+#include "endian.hpp"
+#include "output_writer.hpp"
+#include "fnv.hpp"
+
+#define CACHE_RECORD_SIZE 25
+
+namespace Caribou
+{
+	// Maps a whole file read-only. Returns nullptr if it can't.
+	static const uint8_t* map_file(const char* filename, size_t& length)
+	{
+		struct stat st;
+		int fd = open(filename, O_RDONLY);
+
+		if(fd < 0)
+			return nullptr;
+
+		if(fstat(fd, &st) != 0 || !S_ISREG(st.st_mode) || st.st_size == 0)
+		{
+			close(fd);
+			return nullptr;
+		}
+
+		void* base = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+		close(fd);
+		if(base == MAP_FAILED)
+			return nullptr;
+
+		length = st.st_size;
+		return static_cast<const uint8_t*>(base);
+	}
+
+	// Where the custom header of the image in bytes ends, or 0 if it isn't an image. The
+	// constant pool starts right after the header, and is pool bytes long.
+	static size_t custom_end(const uint8_t* bytes, size_t length, uint32_t* pool_size = nullptr)
+	{
+		static const char magic[] = HEADER_MAGIC_NUMBER;
+		BytecodeHeader header;
+
+		if(length < sizeof(header))
+			return 0;
+
+		memcpy(&header, bytes, sizeof(header));
+		if(memcmp(header.name, magic, 4) != 0)
+			return 0;
+
+		uint32_t pool = header.pool_size;
+		uint32_t custom = header.custom_size;
+		if(big_endian())
+		{
+			endian_swap(pool);
+			endian_swap(custom);
+		}
+
+		uint64_t end = (uint64_t)sizeof(header) + pool + custom;
+		if(pool_size != nullptr)
+			*pool_size = pool;
+		return end <= length ? end : 0;
+	}
+
+	// What the verifier's findings about an image depend on: how its instructions are
+	// encoded, how many constants they can refer to, and the instructions themselves.
+	static uint64_t code_hash(uint8_t version, uint32_t constants, const uint8_t* code, size_t count)
+	{
+		uint8_t n[4];
+		uint64_t hash = fnv1a(kFNVOffsetBasis, &version, 1);
+
+		for(int i = 0; i < 4; i++)
+			n[i] = (constants >> (24 - 8 * i)) & 0xff;
+		hash = fnv1a(hash, n, 4);
+		return fnv1a(hash, code, count);
+	}
+
+	void ImageCache::load(Image& image, const char* filename, ImageAccess access, bool native)
+	{
+		std::string build = CARIBOU_BUILD_ID;
+		InputReader reader(image, access, native);
+		MethodFacts facts;
+		size_t length;
+		const uint8_t* bytes = map_file(filename, length);
+
+		if(bytes == nullptr || custom_end(bytes, length) == 0)
+		{
+			if(bytes != nullptr)
+				munmap(const_cast<uint8_t*>(bytes), length);
+			reader.load(filename);
+			return;
+		}
+
+		uint64_t key = fnv1a(kFNVOffsetBasis, reinterpret_cast<const uint8_t*>(build.data()), build.size());
+		key = fnv1a(key, bytes, length);
+		munmap(const_cast<uint8_t*>(bytes), length);
+
+		char name[32];
+		snprintf(name, sizeof(name), "/%016llx.crbu", (unsigned long long)key);
+		std::string path = directory + name;
+
+		if(lookup(path, key, facts))
+		{
+			reader.load(path.c_str(), &facts);
+			if(native && image.get_native_code() == nullptr)
+				reader.load_native(filename);
+			return;
+		}
+
+		reader.load(filename);
+		if(image.get_instruction_count() != 0)
+			store(image, path, key);
+	}
+
+	// Whether there is an image cached under key at path, and if so what is known about it.
+	bool ImageCache::lookup(const std::string& path, uint64_t key, MethodFacts& facts)
+	{
+		static const char magic[] = CACHE_MAGIC_NUMBER;
+		size_t length;
+		const uint8_t* bytes = map_file(path.c_str(), length);
+		bool found = false;
+
+		if(bytes == nullptr)
+			return false;
+
+		uint32_t pool = 0;
+		size_t end = custom_end(bytes, length, &pool);
+		if(end >= sizeof(BytecodeHeader) + CACHE_RECORD_SIZE)
+		{
+			const uint8_t* record = bytes + end - CACHE_RECORD_SIZE;
+			uint8_t version = reinterpret_cast<const BytecodeHeader*>(bytes)->version == kBytecodeCompact ? kBytecodeCompact : kBytecodeFixed;
+			uint32_t constants = pool >= 4 ? read_uint32(bytes + sizeof(BytecodeHeader)) : 0;
+
+			// The findings are only taken on trust for the very code they were made about.
+			if(memcmp(record, magic, 4) == 0 && read_uint64(record + 4) == key &&
+			   read_uint64(record + 12) == code_hash(version, constants, bytes + end, length - end))
+			{
+				facts.max_stack = read_uint32(record + 20);
+				facts.verified  = record[24] != 0;
+				found = true;
+			}
+		}
+
+		munmap(const_cast<uint8_t*>(bytes), length);
+		return found;
+	}
+
+	// Written somewhere else first and then moved into place, so that another process
+	// never sees half of it.
+	void ImageCache::store(Image& image, const std::string& path, uint64_t key)
+	{
+		static const char magic[] = CACHE_MAGIC_NUMBER;
+		const MethodFacts& facts = image.get_entry_facts();
+		std::vector<uint8_t> custom = image.get_custom_section();
+		std::string temporary = path + "." + std::to_string(getpid());
+		uint64_t code = code_hash(image.get_bytecode_version(), image.get_constant_count(), image.get_instructions(), image.get_instruction_count());
+
+		mkdir(directory.c_str(), 0755);
+
+		custom.insert(custom.end(), magic, magic + 4);
+		for(int shift = 56; shift >= 0; shift -= 8)
+			custom.push_back((key >> shift) & 0xff);
+		for(int shift = 56; shift >= 0; shift -= 8)
+			custom.push_back((code >> shift) & 0xff);
+		for(int shift = 24; shift >= 0; shift -= 8)
+			custom.push_back((facts.max_stack >> shift) & 0xff);
+		custom.push_back(facts.verified ? 1 : 0);
+
+		OutputWriter().dump(temporary.c_str(), image, custom);
+		if(rename(temporary.c_str(), path.c_str()) != 0)
+			unlink(temporary.c_str());
+	}
+}
@@ -0,0 +1,71 @@
+/*
+ * Caribou Virtual Machine
+ * Copyright (c) 2011, Jeremy Tregunna, All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef __CARIBOU__IMAGE_CACHE_HPP__
+#define __CARIBOU__IMAGE_CACHE_HPP__
+
+#include <stdint.h>
+#include <string>
+#include "input_reader.hpp"
+#include "verifier.hpp"
+
+#define CACHE_MAGIC_NUMBER { 'C', 'R', 'B', 'C' }
+
+// Identifies the VM the cache was filled by. Builds which verify bytecode differently must
+// not share a cache. The build gives each one a hash of the verifier's sources; otherwise
+// it is told apart by the verifier's version.
+#ifndef CARIBOU_BUILD_ID
+#define CARIBOU_BUILD_ID "verifier " CARIBOU_VERIFIER_VERSION
+#endif
+
+namespace Caribou
+{
+	class Image;
+
+	/* Keeps images in a directory once they have been loaded and verified, so loading one
+	   again costs no more than mapping it. A cached image is named after an FNV-1a hash of
+	   the file it came from and of the VM's build ID, so changing either one gives another
+	   name and nothing stale is ever picked up. It is an image like any other, with a
+	   record at the end of its custom header of the hash it was stored under, a hash of
+	   the code the record vouches for, and what the verifier found out about its entry
+	   point: "CRBC", the two 64-bit hashes, the 32-bit maximum stack depth and a byte
+	   saying whether it was verified, all big-endian. What the verifier found out is
+	   only taken on trust if the code is still what it was found out about. */
+	class ImageCache
+	{
+	public:
+		ImageCache(const std::string& dir) : directory(dir) {}
+
+		// Loads filename into image, from the cache if it is there, and puts it there if
+		// it isn't. Snapshots, and files which can't be read, are loaded as they are.
+		void load(Image& image, const char* filename, ImageAccess access = kImageAccessNormal, bool native = false);
+
+	private:
+		bool lookup(const std::string& path, uint64_t key, MethodFacts& facts);
+		void store(Image& image, const std::string& path, uint64_t key);
+
+		std::string directory;
+	};
+}
+
+#endif /* !__CARIBOU__IMAGE_CACHE_HPP__ */
@@ -23,18 +23,161 @@
 
 #include <iostream>
 #include <fstream>
+#include <string>
+#include <vector>
 #include <stdint.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include "input_reader.hpp"
-#include "machine.hpp"
+#include "image.hpp"
 #include "endian.hpp"
 #include "bytecode.hpp"
+#include "verifier.hpp"
+#include "snapshot.hpp"
+#include "module.hpp"
+#include "method_loader.hpp"
+#include "native_code.hpp"
 
 namespace Caribou
 {
-	void InputReader::load(const char* filename)
+	// The constant pool and the custom header follow the header, in that order, and the
+	// instructions follow them. Their sizes are stored little-endian. Returns false if
+	// they don't fit in the file.
+	static bool section_sizes(const BytecodeHeader& header, size_t file_size, uint32_t& pool, uint32_t& custom)
+	{
+		pool   = header.pool_size;
+		custom = header.custom_size;
+
+		if(big_endian())
+		{
+			endian_swap(pool);
+			endian_swap(custom);
+		}
+
+		return (uint64_t)sizeof(BytecodeHeader) + pool + custom <= file_size;
+	}
+
+	// Images from before there was a version to speak of are fixed.
+	static bool bytecode_version(const BytecodeHeader& header, uint8_t& version)
+	{
+		if(header.version > kBytecodeCompact)
+			return false;
+
+		version = header.version == kBytecodeCompact ? kBytecodeCompact : kBytecodeFixed;
+		return true;
+	}
+
+	void InputReader::load(const char* filename, const MethodFacts* known)
+	{
+		if(!map(filename))
+			read(filename);
+
+		Verifier verifier(image.get_instructions(), image.get_instruction_count(), image.get_constant_count(), image.get_bytecode_version());
+		MethodFacts facts;
+		if(known != nullptr)
+			image.set_entry_facts(*known);
+		else if(verifier.verify(image.get_entry_point(), facts))
+			image.set_entry_facts(facts);
+
+		if(native)
+			load_native(filename);
+
+		switch(access)
+		{
+			case kImageAccessSequential:
+				image.advise(MADV_SEQUENTIAL);
+				break;
+			case kImageAccessRandom:
+				image.advise(MADV_RANDOM);
+				break;
+			default:
+				image.advise(MADV_NORMAL);
+				break;
+		}
+	}
+
+	void InputReader::load_native(const char* filename)
+	{
+		std::string path = std::string(filename) + ".so";
+
+		if(image.get_instruction_count() != 0)
+			image.set_native_code(NativeCode::open(path.c_str(), image));
+	}
+
+	// Maps the whole file read-only, and has the image run its instructions from there
+	// without copying them. Every machine in the process, and every other process running
+	// the same file, shares the same pages. Returns false if the file can't be mapped, for
+	// it to be read instead.
+	bool InputReader::map(const char* filename)
+	{
+		struct stat st;
+		int fd = open(filename, O_RDONLY);
+
+		if(fd < 0)
+			return false;
+
+		if(fstat(fd, &st) != 0 || !S_ISREG(st.st_mode) || (size_t)st.st_size <= sizeof(BytecodeHeader))
+		{
+			close(fd);
+			return false;
+		}
+
+		void* base = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+		close(fd);
+		if(base == MAP_FAILED)
+			return false;
+
+		if(memcmp(base, "CRBS", 4) == 0)
+		{
+			if(Snapshot::open(image, static_cast<const uint8_t*>(base), st.st_size) == nullptr)
+			{
+				std::cerr << "Invalid snapshot." << std::endl;
+				image.map_instructions(base, st.st_size, st.st_size);
+			}
+			return true;
+		}
+
+		const BytecodeHeader* header = static_cast<const BytecodeHeader*>(base);
+		const uint8_t* pool = static_cast<const uint8_t*>(base) + sizeof(BytecodeHeader);
+		uint32_t pool_size, custom_size;
+		uint8_t version = kBytecodeFixed;
+
+		if(strncmp(header->name, "CRBU", 4) != 0 || !section_sizes(*header, st.st_size, pool_size, custom_size) ||
+		   !bytecode_version(*header, version))
+		{
+			std::cerr << "Invalid file format." << std::endl;
+			munmap(base, st.st_size);
+			image.allocate_instruction_memory(0);
+			return true;
+		}
+
+		image.set_bytecode_version(version);
+
+		if(!image.get_constant_pool().load(pool, pool_size))
+			std::cerr << "Invalid constant pool." << std::endl;
+		image.set_custom_section(std::vector<uint8_t>(pool + pool_size, pool + pool_size + custom_size));
+
+		image.map_instructions(base, st.st_size, sizeof(BytecodeHeader) + pool_size + custom_size);
+
+		// Unless its methods are loaded as they're called, the verifier is about to go
+		// through it from one end to the other.
+		if(!load_directory())
+		{
+			madvise(base, st.st_size, MADV_SEQUENTIAL);
+			madvise(base, st.st_size, MADV_WILLNEED);
+		}
+		return true;
+	}
+
+	void InputReader::read(const char* filename)
 	{
 		std::ifstream file(filename, std::ios::binary);
 		size_t instruction_size = 0;
+		uint32_t pool_size, custom_size;
+		uint8_t version = kBytecodeFixed;
 		BytecodeHeader header;
 		char magic[5] = {0};
 
@@ -46,20 +189,57 @@ namespace Caribou
 
 		file.seekg(0, std::ios::end);
 		instruction_size = file.tellg();
-		instruction_size -= sizeof(header);
 		file.seekg(0, std::ios::beg);
 
-		machine.allocate_instruction_memory(instruction_size);
-		uint8_t*& instructions = machine.get_instructions();
-
 		file.read((char*)&header, sizeof(BytecodeHeader));
 		strncpy(magic, header.name, 4);
-		if(strcmp(magic, "CRBU") == 0)
-			file.read((char*)instructions, instruction_size);
-		else
+		if(strcmp(magic, "CRBU") != 0 || !section_sizes(header, instruction_size, pool_size, custom_size) ||
+		   !bytecode_version(header, version))
+		{
 			std::cerr << "Invalid file format." << std::endl;
+			image.allocate_instruction_memory(0);
+			file.close();
+			return;
+		}
+
+		image.set_bytecode_version(version);
+
+		std::vector<uint8_t> pool(pool_size);
+		file.read((char*)pool.data(), pool_size);
+		if(!image.get_constant_pool().load(std::move(pool)))
+			std::cerr << "Invalid constant pool." << std::endl;
+
+		std::vector<uint8_t> custom(custom_size);
+		file.read((char*)custom.data(), custom_size);
+		image.set_custom_section(std::move(custom));
+
+		instruction_size -= sizeof(header) + pool_size + custom_size;
+		uint8_t* instructions = image.allocate_instruction_memory(instruction_size);
+		file.read((char*)instructions, instruction_size);
 		file.close();
 
-		machine.execute();
+		load_directory();
+	}
+
+	// Gives the image a loader for the methods in its directory, if it has one which fits
+	// its code. Returns whether it did.
+	bool InputReader::load_directory()
+	{
+		const std::vector<uint8_t>& custom = image.get_custom_section();
+		MethodDirectory directory;
+
+		if(!directory.parse(custom.data(), custom.size()))
+			return false;
+
+		MethodLoader* loader = new MethodLoader(image, directory);
+		if(!loader->valid())
+		{
+			std::cerr << "Invalid method directory." << std::endl;
+			delete loader;
+			return false;
+		}
+
+		image.set_method_loader(loader);
+		return true;
 	}
 }
@@ -24,21 +24,45 @@
 #ifndef __CARIBOU__INPUT_READER_HPP__
 #define __CARIBOU__INPUT_READER_HPP__
 
-#include "machine.hpp"
+#include "image.hpp"
 
 namespace Caribou
 {
+	// How the instructions are going to be read once they're running, passed on to the
+	// kernel for images which are mapped.
+	enum ImageAccess
+	{
+		kImageAccessNormal,
+		kImageAccessSequential,
+		kImageAccessRandom
+	};
+
 	class InputReader
 	{
 	public:
-		InputReader(Machine& m) : machine(m) {}
+		// Native code is only ever run if asked for: a shared object is code like any
+		// other, and loading it runs whatever it wants to before it can be checked.
+		InputReader(Image& i, ImageAccess a = kImageAccessNormal, bool n = false) : image(i), access(a), native(n) {}
 
-		// This method will overwrite the instruction_memory on the Machine
-		// passed into the constructor.
-		void load(const char*);
+		// This method will overwrite the instruction_memory on the Image
+		// passed into the constructor. The file is mapped if it can be, and read
+		// otherwise. Given what the verifier found out about the entry point when the
+		// file was last loaded, it is taken on trust rather than found out again.
+		void load(const char*, const MethodFacts* known = nullptr);
+
+		// Has the image run the native code compiled for the file, in the file's name
+		// with ".so" on the end, if it is there and was compiled from the same code.
+		// Called by load, if the reader was asked to run native code.
+		void load_native(const char*);
 
 	private:
-		Machine& machine;
+		bool map(const char*);
+		void read(const char*);
+		bool load_directory();
+
+		Image&      image;
+		ImageAccess access;
+		bool        native;
 	};
 }
 
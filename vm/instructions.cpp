@@ -0,0 +1,351 @@
+/*
+ * Caribou Virtual Machine
+ * Copyright (c) 2011, Jeremy Tregunna, All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#include "instructions.hpp"
+#include "endian.hpp"
+#include "leb128.hpp"
+
+#define W sizeof(uintptr_t)
+
+namespace Caribou
+{
+	static InstructionInfo info(const char* name, uint8_t length, uint8_t pops = 0, uint8_t pushes = 0, uint8_t flags = 0)
+	{
+		InstructionInfo i = { name, length, pops, pushes, flags };
+		return i;
+	}
+
+	static struct InstructionTable
+	{
+		InstructionInfo entries[256];
+
+		InstructionTable()
+		{
+			for(int i = 0; i < 256; i++)
+				entries[i] = info(nullptr, 0);
+
+			entries[Instructions::NOOP]      = info("NOOP",      1);
+			entries[Instructions::MOVE]      = info("MOVE",      3,      0, 0, kInsnDefinesFirst);
+			entries[Instructions::LOADI]     = info("LOADI",     2 + W,  0, 0, kInsnDefinesFirst | kInsnImmediate);
+
+			entries[Instructions::PUSH]      = info("PUSH",      1 + W,  0, 1, kInsnImmediate);
+			entries[Instructions::POP]       = info("POP",       2,      1, 0, kInsnDefinesFirst);
+			entries[Instructions::SWAP]      = info("SWAP",      1,      2, 2);
+			entries[Instructions::ROTATE]    = info("ROTATE",    2,      0, 0, kInsnVariable);
+			entries[Instructions::DUP]       = info("DUP",       1,      1, 2);
+
+			entries[Instructions::ADD]       = info("ADD",       4,      0, 0, kInsnDefinesFirst);
+			entries[Instructions::SUB]       = info("SUB",       4,      0, 0, kInsnDefinesFirst);
+			entries[Instructions::MUL]       = info("MUL",       4,      0, 0, kInsnDefinesFirst);
+			entries[Instructions::DIV]       = info("DIV",       4,      0, 0, kInsnDefinesFirst);
+			entries[Instructions::MOD]       = info("MOD",       4,      0, 0, kInsnDefinesFirst);
+			entries[Instructions::POW]       = info("POW",       4,      0, 0, kInsnDefinesFirst);
+			entries[Instructions::NOT]       = info("NOT",       3,      0, 0, kInsnDefinesFirst);
+
+			entries[Instructions::EQ]        = info("EQ",        4,      0, 0, kInsnSkip | kInsnDefinesFirst);
+			entries[Instructions::LT]        = info("LT",        4,      0, 0, kInsnSkip | kInsnDefinesFirst);
+			entries[Instructions::LTE]       = info("LTE",       4,      0, 0, kInsnSkip | kInsnDefinesFirst);
+			entries[Instructions::GT]        = info("GT",        4,      0, 0, kInsnSkip | kInsnDefinesFirst);
+			entries[Instructions::GTE]       = info("GTE",       4,      0, 0, kInsnSkip | kInsnDefinesFirst);
+
+			entries[Instructions::HALT]      = info("HALT",      1,      0, 0, kInsnTerminator);
+			entries[Instructions::SEND]      = info("SEND",      4);
+			entries[Instructions::RET]       = info("RET",       1,      0, 0, kInsnTerminator);
+			entries[Instructions::JMP]       = info("JMP",       1 + W,  0, 0, kInsnJump | kInsnTerminator);
+			entries[Instructions::SAVE]      = info("SAVE",      2,      0, 0, kInsnDefinesFirst);
+			entries[Instructions::RESTORE]   = info("RESTORE",   2,      0, 0, kInsnTerminator);
+			entries[Instructions::ASEND]     = info("ASEND",     4,      0, 0, kInsnDefinesReturn);
+			entries[Instructions::AWAIT]     = info("AWAIT",     3,      0, 0, kInsnDefinesFirst);
+			entries[Instructions::SENDAFTER] = info("SENDAFTER", 4);
+			entries[Instructions::AWAITFOR]  = info("AWAITFOR",  4,      0, 0, kInsnDefinesFirst);
+			entries[Instructions::MARK]      = info("MARK",      2,      0, 0, kInsnDefinesFirst);
+			entries[Instructions::ESCAPE]    = info("ESCAPE",    2,      0, 0, kInsnDefinesFirst);
+			entries[Instructions::COROUTINE] = info("COROUTINE", 4,      0, 0, kInsnDefinesFirst);
+			entries[Instructions::RESUME]    = info("RESUME",    3,      0, 0, kInsnDefinesReturn);
+			entries[Instructions::YIELD]     = info("YIELD",     2,      0, 0, kInsnDefinesReturn);
+			entries[Instructions::TAILSEND]  = info("TAILSEND",  4,      0, 0, kInsnTerminator);
+
+			entries[Instructions::ADDSYM]    = info("ADDSYM",    3,      0, 0, kInsnDefinesFirst);
+			entries[Instructions::FINDSYM]   = info("FINDSYM",   3,      0, 0, kInsnDefinesFirst);
+			entries[Instructions::ARRAY]     = info("ARRAY",     2,      0, 1, kInsnVariable);
+			entries[Instructions::STRING]    = info("STRING",    2,      0, 1, kInsnVariable);
+			entries[Instructions::ACTOR]     = info("ACTOR",     4);
+		}
+	} table;
+
+	const InstructionInfo& instruction_info(uint8_t opcode)
+	{
+		return table.entries[opcode];
+	}
+
+	bool decode_instruction(const uint8_t* code, size_t count, uintptr_t offset, uint8_t version, DecodedInstruction& insn)
+	{
+		if(offset >= count)
+			return false;
+
+		const InstructionInfo& info = instruction_info(code[offset]);
+		bool immediate = info.flags & (kInsnJump | kInsnImmediate);
+
+		if(info.length == 0)
+			return false;
+
+		insn.opcode    = code[offset];
+		insn.nregs     = register_operands(info);
+		insn.immediate = 0;
+
+		if(version != kBytecodeCompact)
+		{
+			if(info.length > count - offset)
+				return false;
+
+			for(uint8_t i = 0; i < insn.nregs; i++)
+				insn.registers[i] = code[offset + 1 + i];
+			if(immediate)
+				insn.immediate = read_intptr(code + offset + 1 + insn.nregs);
+
+			insn.length = info.length;
+			return true;
+		}
+
+		// Two registers to a byte, the first in the high nibble.
+		uintptr_t at = offset + 1 + (insn.nregs + 1) / 2;
+		if(at > count)
+			return false;
+
+		for(uint8_t i = 0; i < insn.nregs; i++)
+		{
+			uint8_t packed = code[offset + 1 + i / 2];
+			insn.registers[i] = (i % 2) ? (packed & 0xf) : (packed >> 4);
+		}
+
+		if(immediate)
+		{
+			uint64_t value;
+			size_t n = read_uleb128(code + at, code + count, value);
+
+			if(n == 0)
+				return false;
+			at += n;
+
+			if(info.flags & kInsnJump)
+				insn.immediate = offset + zigzag_decode(value);
+			else
+				insn.immediate = value;
+		}
+
+		insn.length = at - offset;
+		return true;
+	}
+
+	bool compact_instructions(const uint8_t* code, size_t count, std::vector<uint8_t>& out, std::vector<uintptr_t>* moved)
+	{
+		const uintptr_t padding = instruction_info(Instructions::JMP).length;
+		std::vector<DecodedInstruction> insns;
+		// Which instruction starts at each offset of the fixed code, if any.
+		std::vector<size_t> starting(count + 1, SIZE_MAX);
+		bool skipped = false;
+
+		out.clear();
+
+		for(uintptr_t offset = 0; offset < count;)
+		{
+			DecodedInstruction insn;
+
+			if(!decode_instruction(code, count, offset, kBytecodeFixed, insn))
+				return false;
+
+			// A fixed comparison skips as many bytes as a JMP takes, and they may be NOOPs
+			// instead. A compact one skips a single instruction, so they become one NOOP.
+			if(skipped && insn.opcode == Instructions::NOOP && offset + padding <= count)
+			{
+				uintptr_t n = 0;
+				while(n < padding && code[offset + n] == Instructions::NOOP)
+					n++;
+				if(n == padding)
+					insn.length = padding;
+			}
+
+			for(uint8_t i = 0; i < insn.nregs; i++)
+			{
+				if(insn.registers[i] > 0xf)
+					return false;
+			}
+
+			skipped = instruction_info(insn.opcode).flags & kInsnSkip;
+			starting[offset] = insns.size();
+			insns.push_back(insn);
+			offset += insn.length;
+		}
+		starting[count] = insns.size();
+
+		// Jumps start out as short as they can be, and are widened until every offset fits.
+		// Nothing ever gets shorter, so this settles.
+		std::vector<size_t> widths(insns.size(), 0);
+		std::vector<size_t> targets(insns.size(), 0);
+		std::vector<uintptr_t> placed(insns.size() + 1, 0);
+		bool grown = true;
+
+		for(size_t i = 0; i < insns.size(); i++)
+		{
+			uint8_t flags = instruction_info(insns[i].opcode).flags;
+
+			if(flags & kInsnJump)
+			{
+				if(insns[i].immediate > count || starting[insns[i].immediate] == SIZE_MAX)
+					return false;
+				targets[i] = starting[insns[i].immediate];
+				widths[i]  = 1;
+			}
+			else if(flags & kInsnImmediate)
+				widths[i] = uleb128_length(insns[i].immediate);
+		}
+
+		while(grown)
+		{
+			uintptr_t at = 0;
+
+			grown = false;
+			for(size_t i = 0; i < insns.size(); i++)
+			{
+				placed[i] = at;
+				at += 1 + (insns[i].nregs + 1) / 2 + widths[i];
+			}
+			placed[insns.size()] = at;
+
+			for(size_t i = 0; i < insns.size(); i++)
+			{
+				if(!(instruction_info(insns[i].opcode).flags & kInsnJump))
+					continue;
+
+				size_t needed = uleb128_length(zigzag_encode((int64_t)placed[targets[i]] - (int64_t)placed[i]));
+				if(needed > widths[i])
+				{
+					widths[i] = needed;
+					grown = true;
+				}
+			}
+		}
+
+		for(size_t i = 0; i < insns.size(); i++)
+		{
+			const DecodedInstruction& insn = insns[i];
+			uint8_t flags = instruction_info(insn.opcode).flags;
+
+			out.push_back(insn.opcode);
+			for(uint8_t r = 0; r < insn.nregs; r += 2)
+				out.push_back(insn.registers[r] << 4 | (r + 1 < insn.nregs ? insn.registers[r + 1] : 0));
+
+			if(flags & kInsnJump)
+				write_uleb128(out, zigzag_encode((int64_t)placed[targets[i]] - (int64_t)placed[i]), widths[i]);
+			else if(flags & kInsnImmediate)
+				write_uleb128(out, insn.immediate);
+		}
+
+		if(moved != nullptr)
+		{
+			moved->assign(count + 1, UINTPTR_MAX);
+			for(uintptr_t offset = 0; offset <= count; offset++)
+			{
+				if(starting[offset] != SIZE_MAX)
+					(*moved)[offset] = placed[starting[offset]];
+			}
+		}
+
+		return true;
+	}
+
+	bool expand_instructions(const uint8_t* code, size_t count, uint8_t version, std::vector<uint8_t>& out, std::vector<uintptr_t>* moved)
+	{
+		const uintptr_t padding = instruction_info(Instructions::JMP).length;
+		std::vector<DecodedInstruction> insns;
+		std::vector<uintptr_t> lengths;
+		// Where the instruction at each offset of the original code goes.
+		std::vector<uintptr_t> placed(count + 1, UINTPTR_MAX);
+		uintptr_t at = 0;
+		bool skipped = false;
+
+		out.clear();
+
+		for(uintptr_t offset = 0; offset < count;)
+		{
+			DecodedInstruction insn;
+
+			if(!decode_instruction(code, count, offset, version, insn))
+				return false;
+
+			uintptr_t length = instruction_info(insn.opcode).length;
+
+			// A compact comparison skips one instruction; the NOOP standing in for a JMP
+			// has to be as long as one.
+			if(skipped && version == kBytecodeCompact)
+			{
+				if(insn.opcode == Instructions::NOOP)
+					length = padding;
+				else if(insn.opcode != Instructions::JMP)
+					return false;
+			}
+
+			skipped = instruction_info(insn.opcode).flags & kInsnSkip;
+			placed[offset] = at;
+			insns.push_back(insn);
+			lengths.push_back(length);
+			at += length;
+			offset += insn.length;
+		}
+		placed[count] = at;
+
+		for(size_t i = 0; i < insns.size(); i++)
+		{
+			const DecodedInstruction& insn = insns[i];
+			const InstructionInfo& info = instruction_info(insn.opcode);
+			uintptr_t start = out.size();
+
+			out.push_back(insn.opcode);
+			for(uint8_t r = 0; r < insn.nregs; r++)
+				out.push_back(insn.registers[r]);
+
+			if(info.flags & (kInsnJump | kInsnImmediate))
+			{
+				uintptr_t value = insn.immediate;
+
+				if(info.flags & kInsnJump)
+				{
+					if(value > count || placed[value] == UINTPTR_MAX)
+						return false;
+					value = placed[value];
+				}
+
+				out.resize(out.size() + sizeof(uintptr_t));
+				write_intptr(out.data() + out.size() - sizeof(uintptr_t), value);
+			}
+
+			while(out.size() < start + lengths[i])
+				out.push_back(Instructions::NOOP);
+		}
+
+		if(moved != nullptr)
+			*moved = placed;
+
+		return true;
+	}
+}
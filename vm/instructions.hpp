@@ -24,6 +24,11 @@
 #ifndef __CARIBOU__INSTRUCTIONS_HPP__
 #define __CARIBOU__INSTRUCTIONS_HPP__
 
+#include <stdint.h>
+#include <stddef.h>
+#include <vector>
+#include "bytecode.hpp"
+
 namespace Caribou
 {
 	struct Instructions
@@ -53,8 +58,8 @@ namespace Caribou
 
 			// Comparison operations.
 			//  These are intended to be paired with JMP operations. On a successful
-			//  comparison, each will bump the IP by one (to the JMP). On failure,
-			//  each will bump the IP by 2 (to the instruction just past the JMP).
+			//  comparison, execution continues with the JMP. On failure, the JMP is
+			//  skipped.
 			//  Each instruction takes three registers.
 			EQ = 0x30,
 			LT,
@@ -63,20 +68,109 @@ namespace Caribou
 			GTE,
 
 			// Control flow operations.
+			//  ASEND takes the same registers as SEND, and leaves a future for the reply
+			//  in the return register. AWAIT takes a destination and a future.
+			//  SENDAFTER takes a receiver, a message and a delay in milliseconds.
+			//  AWAITFOR takes a destination, a future and a timeout in milliseconds.
+			//  MARK and ESCAPE take a register for a continuation, like SAVE.
+			//  COROUTINE takes a destination, a receiver and a message, like SEND.
+			//  TAILSEND takes the same registers as SEND.
+			//  RESUME takes a coroutine and a value to hand it. YIELD takes a value.
 			HALT = 0x40,
 			SEND,
 			RET,
 			JMP,
 			SAVE,
 			RESTORE,
+			ASEND,
+			AWAIT,
+			SENDAFTER,
+			AWAITFOR,
+			MARK,
+			ESCAPE,
+			COROUTINE,
+			RESUME,
+			YIELD,
+			TAILSEND,
 
 			// Primitive object operations.
+			//  ACTOR takes the object to make an actor of, the capacity of its mailbox (0 for
+			//  none) and what to do once that is full, as a MailboxOverflowPolicy.
 			ADDSYM = 0x50,
 			FINDSYM,
 			ARRAY,
-			STRING
+			STRING,
+			ACTOR
 		};
 	};
+
+	enum InstructionFlags
+	{
+		// Ends with where to jump to: an absolute, pointer sized target in fixed bytecode,
+		// an offset from the start of the jump in compact bytecode.
+		kInsnJump           = 1 << 0,
+		// A comparison, which skips the JMP after it when it fails.
+		kInsnSkip           = 1 << 1,
+		// Execution never falls through to the next instruction.
+		kInsnTerminator     = 1 << 2,
+		// How much is popped depends on a register. Pops and pushes are then upper bounds.
+		kInsnVariable       = 1 << 3,
+		// Ends with an immediate which isn't a jump target.
+		kInsnImmediate      = 1 << 4,
+		// The first register is written to; any others are read. Without this flag, every
+		// register is read.
+		kInsnDefinesFirst   = 1 << 5,
+		// Always leaves something in the return register.
+		kInsnDefinesReturn  = 1 << 6
+	};
+
+	// What the loader needs to know about each opcode. Unused opcodes have a length of 0.
+	// Lengths are those of fixed bytecode; compact instructions are decoded to find theirs.
+	struct InstructionInfo
+	{
+		const char* name;
+		uint8_t     length;
+		uint8_t     pops;
+		uint8_t     pushes;
+		uint8_t     flags;
+	};
+
+	const InstructionInfo& instruction_info(uint8_t opcode);
+
+	// Register operands come straight after the opcode, before any immediate.
+	inline uint8_t register_operands(const InstructionInfo& info)
+	{
+		if(info.flags & (kInsnJump | kInsnImmediate))
+			return info.length - 1 - sizeof(uintptr_t);
+		return info.length - 1;
+	}
+
+	// An instruction taken apart, whichever version it was encoded in.
+	struct DecodedInstruction
+	{
+		uint8_t   opcode;
+		uint8_t   length;
+		uint8_t   nregs;
+		uint8_t   registers[3];
+		// The immediate, or for a jump the offset it lands on.
+		uintptr_t immediate;
+	};
+
+	// Decodes the instruction at offset. Fails on an unknown opcode, or one running past
+	// the end of the code. The registers aren't checked.
+	bool decode_instruction(const uint8_t* code, size_t count, uintptr_t offset, uint8_t version, DecodedInstruction& insn);
+
+	// Rewrites fixed bytecode as compact bytecode. Jump targets are moved along with the
+	// instructions; anything else holding an offset into the code has to be fixed up by
+	// whoever made it, using moved if it's given: where the instruction at each offset of
+	// the fixed code ended up, or UINTPTR_MAX between instructions. Fails if the code can't
+	// be decoded from start to end, or a jump lands inside an instruction.
+	bool compact_instructions(const uint8_t* code, size_t count, std::vector<uint8_t>& out, std::vector<uintptr_t>* moved = nullptr);
+
+	// Rewrites bytecode of either version as fixed bytecode, the same way. Fails where
+	// compacting would, and on a compact comparison followed by anything but a JMP or a
+	// NOOP, which fixed bytecode has no way of skipping.
+	bool expand_instructions(const uint8_t* code, size_t count, uint8_t version, std::vector<uint8_t>& out, std::vector<uintptr_t>* moved = nullptr);
 }
 
 #endif /* !__CARIBOU__INSTRUCTIONS_HPP__ */
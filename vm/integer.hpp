@@ -37,6 +37,8 @@ namespace Caribou
 		virtual const std::string object_name();
 
 		intptr_t c_int() { return value; }
+		// Where the value is kept, for compiled code to read it without a call.
+		size_t value_offset() { return reinterpret_cast<char*>(&value) - reinterpret_cast<char*>(this); }
 
 	private:
 		intptr_t value;
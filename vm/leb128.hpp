@@ -0,0 +1,94 @@
+/*
+ * Caribou Virtual Machine
+ * Copyright (c) 2011, Jeremy Tregunna, All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef __CARIBOU__LEB128_HPP__
+#define __CARIBOU__LEB128_HPP__
+
+#include <stdint.h>
+#include <stddef.h>
+#include <vector>
+
+// No 64-bit value takes more than this many bytes.
+#define CARIBOU_LEB128_MAX_LENGTH 10
+
+namespace Caribou
+{
+	// Compact bytecode stores its immediates seven bits to a byte, least significant
+	// first, with the top bit set on every byte but the last. Returns how many bytes were
+	// read, or 0 if the value runs past end or is too long to be one.
+	inline size_t read_uleb128(const uint8_t* p, const uint8_t* end, uint64_t& value)
+	{
+		value = 0;
+
+		for(size_t i = 0; i < CARIBOU_LEB128_MAX_LENGTH && p + i < end; i++)
+		{
+			value |= (uint64_t)(p[i] & 0x7f) << (7 * i);
+			if(!(p[i] & 0x80))
+				return i + 1;
+		}
+		return 0;
+	}
+
+	inline size_t uleb128_length(uint64_t value)
+	{
+		size_t n = 1;
+
+		while(value >= 0x80)
+		{
+			value >>= 7;
+			n++;
+		}
+		return n;
+	}
+
+	// Writes at least length bytes, padding with empty continuation bytes, so a value can
+	// fill a space worked out before it was known.
+	inline void write_uleb128(std::vector<uint8_t>& out, uint64_t value, size_t length = 1)
+	{
+		size_t n = uleb128_length(value);
+
+		if(n < length)
+			n = length;
+
+		for(size_t i = 1; i < n; i++)
+		{
+			out.push_back((value & 0x7f) | 0x80);
+			value >>= 7;
+		}
+		out.push_back(value & 0x7f);
+	}
+
+	// Signed values are zig-zagged first, so small negative numbers stay small:
+	// 0, -1, 1, -2, 2 become 0, 1, 2, 3, 4.
+	inline uint64_t zigzag_encode(int64_t value)
+	{
+		return ((uint64_t)value << 1) ^ (uint64_t)(value >> 63);
+	}
+
+	inline int64_t zigzag_decode(uint64_t value)
+	{
+		return (int64_t)(value >> 1) ^ -(int64_t)(value & 1);
+	}
+}
+
+#endif /* !__CARIBOU__LEB128_HPP__ */
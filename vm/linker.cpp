@@ -0,0 +1,204 @@
+/*
+ * Caribou Virtual Machine
+ * Copyright (c) 2011, Jeremy Tregunna, All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#include <string.h>
+#include "linker.hpp"
+#include "image.hpp"
+#include "input_reader.hpp"
+#include "instructions.hpp"
+#include "endian.hpp"
+#include "gc.hpp"
+#include "object.hpp"
+#include "string.hpp"
+#include "vmmethod.hpp"
+#include "method_loader.hpp"
+
+namespace Caribou
+{
+	Linker::~Linker()
+	{
+		for(Module& m : modules)
+			delete m.source;
+	}
+
+	void Linker::add(const char* filename)
+	{
+		Module m = { new Image(), ModuleTables(), nullptr };
+		InputReader reader(*m.source);
+
+		modules.push_back(m);
+		reader.load(filename);
+
+		// A program which doesn't export anything has no need for the tables.
+		const std::vector<uint8_t>& custom = m.source->get_custom_section();
+		if(ModuleTables::present(custom.data(), custom.size()) && !modules.back().tables.parse(custom.data(), custom.size()))
+			throw LinkError(std::string(filename) + " has a malformed module header");
+	}
+
+	void Linker::link()
+	{
+		std::vector<uint8_t> code;
+		std::vector<uint8_t> entries;
+		std::vector<uintptr_t> moved;
+		uint32_t constants = 0;
+		bool compact = !modules.empty();
+		// The program's own method directory. The methods of modules are reached through
+		// their exports instead.
+		MethodDirectory directory;
+
+		for(Module& m : modules)
+		{
+			Image* source = m.source;
+			std::vector<uint8_t> fixed;
+			uintptr_t base = code.size();
+
+			if(!expand_instructions(source->get_instructions(), source->get_instruction_count(), source->get_bytecode_version(), fixed, &moved))
+				throw LinkError("module " + m.tables.name + " can't be relocated");
+
+			// Every jump target and constant index is at a known place in a fixed
+			// instruction, where it can be moved along with the rest.
+			for(uintptr_t offset = 0; offset < fixed.size();)
+			{
+				DecodedInstruction insn;
+
+				decode_instruction(fixed.data(), fixed.size(), offset, kBytecodeFixed, insn);
+				if(instruction_info(insn.opcode).flags & kInsnJump)
+					write_intptr(fixed.data() + offset + 1 + insn.nregs, insn.immediate + base);
+				else if(insn.opcode == Instructions::LOADI)
+					write_intptr(fixed.data() + offset + 1 + insn.nregs, insn.immediate + constants);
+				offset += insn.length;
+			}
+
+			const std::vector<uint8_t>& custom = source->get_custom_section();
+			if(&m == &modules.front() && directory.parse(custom.data(), custom.size()) && !directory.relocate(moved, base))
+				throw LinkError("the program's methods can't be relocated");
+
+			for(ModuleExport& e : m.tables.exports)
+			{
+				if(e.offset >= source->get_instruction_count() || moved[e.offset] == UINTPTR_MAX)
+					throw LinkError("export " + e.name + " of module " + m.tables.name + " doesn't start an instruction");
+				e.offset = base + moved[e.offset];
+			}
+
+			for(const std::string& name : m.tables.imports)
+			{
+				bool found = false;
+
+				for(Module& other : modules)
+					found = found || other.tables.name == name;
+				if(!found)
+					throw LinkError("module " + m.tables.name + " imports " + name + ", which isn't there");
+			}
+
+			source->get_constant_pool().append_to(entries, constants);
+			constants += source->get_constant_count();
+			code.insert(code.end(), fixed.begin(), fixed.end());
+			compact = compact && source->get_bytecode_version() == kBytecodeCompact;
+		}
+
+		// If every module was compact, so is the program.
+		if(compact)
+		{
+			std::vector<uint8_t> compacted;
+
+			if(!compact_instructions(code.data(), code.size(), compacted, &moved))
+				throw LinkError("the linked code can't be compacted");
+
+			for(Module& m : modules)
+			{
+				for(ModuleExport& e : m.tables.exports)
+					e.offset = moved[e.offset];
+			}
+			if(!directory.relocate(moved, 0))
+				throw LinkError("the linked code can't be compacted");
+			code.swap(compacted);
+		}
+
+		std::vector<uint8_t> pool;
+		for(int shift = 24; shift >= 0; shift -= 8)
+			pool.push_back((constants >> shift) & 0xff);
+		pool.insert(pool.end(), entries.begin(), entries.end());
+
+		uint8_t* instructions = image.allocate_instruction_memory(code.size());
+		memcpy(instructions, code.data(), code.size());
+		image.set_bytecode_version(compact ? kBytecodeCompact : kBytecodeFixed);
+
+		if(!image.get_constant_pool().load(std::move(pool)))
+			throw LinkError("the constant pools don't fit together");
+		image.get_constant_pool().set_resolver(this);
+
+		if(!directory.methods.empty())
+		{
+			image.set_custom_section(directory.build());
+			image.set_method_loader(new MethodLoader(image, directory));
+		}
+
+		Verifier verifier(image.get_instructions(), image.get_instruction_count(), image.get_constant_count(), image.get_bytecode_version());
+		MethodFacts facts;
+		if(verifier.verify(image.get_entry_point(), facts))
+			image.set_entry_facts(facts);
+
+		// Everything has been copied out of the modules.
+		for(Module& m : modules)
+		{
+			delete m.source;
+			m.source = nullptr;
+		}
+	}
+
+	// Called by the constant pool, on the image's heap, the first time each import
+	// constant is loaded. Machines may get here at the same time; only one of them makes
+	// the module's object.
+	Object* Linker::resolve(const std::string& name)
+	{
+		std::lock_guard<std::mutex> guard(lock);
+
+		for(Module& m : modules)
+		{
+			if(name.empty() || m.tables.name != name)
+				continue;
+
+			if(m.object == nullptr)
+			{
+				GarbageCollector* previous = collector;
+				Object* object;
+
+				collector = image.get_heap();
+				object = new Object();
+				for(const ModuleExport& e : m.tables.exports)
+				{
+					Verifier verifier(image.get_instructions(), image.get_instruction_count(), image.get_constant_count(), image.get_bytecode_version());
+					MethodFacts facts;
+
+					verifier.verify(e.offset, facts);
+					object->add_slot(e.name, new VMMethod(new String(e.name), e.offset, e.nargs, facts));
+				}
+				collector = previous;
+				m.object = object;
+			}
+			return m.object;
+		}
+
+		throw LinkError("no module " + name + " has been linked in");
+	}
+}
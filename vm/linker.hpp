@@ -0,0 +1,84 @@
+/*
+ * Caribou Virtual Machine
+ * Copyright (c) 2011, Jeremy Tregunna, All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef __CARIBOU__LINKER_HPP__
+#define __CARIBOU__LINKER_HPP__
+
+#include <stdint.h>
+#include <mutex>
+#include <string>
+#include <vector>
+#include "constant_pool.hpp"
+#include "module.hpp"
+
+namespace Caribou
+{
+	class Image;
+	class Object;
+
+	/* Loads several modules into one image, for any number of machines to run. Their code
+	   is laid out one module after another, their constant pools are put together into one,
+	   and every string and symbol in them goes into the image's symbol table. An import
+	   constant is only resolved the first time LOADI asks for it: the module it names is
+	   then given an object with a method slot for each of its exports, verified there and
+	   then, and a SEND to that object calls into the module. The program's own method
+	   directory, if it has one, comes along with it. */
+	class Linker : public ImportResolver
+	{
+	public:
+		Linker(Image& image) : image(image) {}
+		~Linker();
+
+		// Loads a module. The program starts at the beginning of the first one.
+		void add(const char* filename);
+		// Lays the modules out in the image. Fails if a module can't be relocated, or
+		// imports a module which isn't there.
+		void link();
+
+		Object* resolve(const std::string& module);
+
+	private:
+		struct Module
+		{
+			Image*       source;
+			ModuleTables tables;
+			Object*      object;
+		};
+
+		Image&              image;
+		std::vector<Module> modules;
+		std::mutex          lock;
+	};
+
+	class LinkError
+	{
+	private:
+		std::string reason;
+
+	public:
+		LinkError(std::string why) : reason(why) {}
+		const std::string message() const { return reason; }
+	};
+}
+
+#endif /* !__CARIBOU__LINKER_HPP__ */
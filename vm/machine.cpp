@@ -26,7 +26,9 @@
 #include <math.h>
 #include "machine.hpp"
 #include "continuation.hpp"
+#include "coroutine.hpp"
 #include "endian.hpp"
+#include "leb128.hpp"
 #include "gc.hpp"
 #include "object.hpp"
 #include "mailbox.hpp"
@@ -35,38 +37,76 @@
 #include "string.hpp"
 #include "nil.hpp"
 #include "boolean.hpp"
+#include "future.hpp"
+#include "vmmethod.hpp"
+#include "image.hpp"
+#include "object_space.hpp"
+#include "verifier.hpp"
 
 namespace Caribou
 {
 	class Object;
 	class Message;
 
-	GarbageCollector* collector = nullptr;
+	thread_local GarbageCollector* collector = nullptr;
 
-	Machine::Machine() : rstack()
+	Machine::Machine(Image* img) : image(img), main_stack(), rstack(&main_stack), coroutine(nullptr), scheduler(this), revisions(this)
 	{
-		collector = new GarbageCollector(this);
+		instructions = image->get_instructions();
+		icount       = image->get_instruction_count();
+		version      = image->get_bytecode_version();
+		low_nibble   = false;
+		native       = image->get_native_code() != nullptr ? image->get_native_code()->get_table() : nullptr;
+		recorder.reset(image, instructions, icount, version);
+#ifdef CARIBOU_BASELINE_JIT
+		if(native == nullptr)
+		{
+			baseline.reset(instructions, icount, version);
+			native = baseline.get_table();
+		}
+#endif
+		const_count  = image->get_constant_count();
+		heap         = new GarbageCollector(this);
 	}
 
 	Machine::~Machine()
 	{
-		delete[] instructions;
+		delete heap;
+	}
+
+	ObjectSpace* Machine::get_object_space()
+	{
+		return image->get_object_space();
 	}
 
 	uint8_t Machine::fetch_decode()
 	{
 		opcode = instructions[ip];
+		low_nibble = false;
 		return opcode;
 	}
 
 	uint8_t Machine::get_reg_opcode()
 	{
-		return instructions[++ip];
+		if(version != kBytecodeCompact)
+			return instructions[++ip];
+
+		if(low_nibble)
+		{
+			low_nibble = false;
+			return instructions[ip] & 0xf;
+		}
+
+		low_nibble = true;
+		return instructions[++ip] >> 4;
 	}
 
 	uint32_t Machine::get_int32_opcode()
 	{
-		uint32_t r = (instructions[++ip] << 24) | (instructions[++ip] << 16) | (instructions[++ip] << 8) | instructions[++ip];
+		uint32_t r = instructions[++ip] << 24;
+		r |= instructions[++ip] << 16;
+		r |= instructions[++ip] << 8;
+		r |= instructions[++ip];
 		return r;
 	}
 
@@ -74,10 +114,18 @@ namespace Caribou
 	{
 		uintptr_t r = 0;
 
+		if(version == kBytecodeCompact)
+		{
+			uint64_t value;
+			ip += read_uleb128(instructions + ip + 1, instructions + icount, value);
+			return value;
+		}
+
 		switch(sizeof(uintptr_t))
 		{
 			case 8:
-				r = static_cast<uint64_t>(get_int32_opcode()) << 32 | get_int32_opcode();
+				r = static_cast<uint64_t>(get_int32_opcode()) << 32;
+				r |= get_int32_opcode();
 				break;
 			case 4:
 				r = get_int32_opcode();
@@ -90,6 +138,32 @@ namespace Caribou
 		return r;
 	}
 
+	// Where a jump goes: an absolute offset in fixed bytecode, and an offset from the start
+	// of the jump in compact bytecode.
+	uintptr_t Machine::get_jump_opcode()
+	{
+		uintptr_t r = get_intptr_opcode();
+
+		if(version == kBytecodeCompact)
+			return insn_ip + zigzag_decode(r);
+
+		return r;
+	}
+
+	// Comparisons step over the instruction after them when they fail, once ip is on it: the
+	// length of a JMP in fixed bytecode, and whatever instruction is there in compact bytecode.
+	void Machine::skip_opcode()
+	{
+		DecodedInstruction insn;
+
+		if(version != kBytecodeCompact)
+			next(CARIBOU_JMP_LENGTH);
+		else if(decode_instruction(instructions, icount, ip, version, insn))
+			next(insn.length);
+		else
+			ip = icount;
+	}
+
 	/* Copy contents of one register to another
 	 * Inputs: Two registers - 1) Destination, 2) Source
 	 * Copies the contents of the source register to the destination register
@@ -101,11 +175,12 @@ namespace Caribou
 
 	/* Load a constant into a register
 	 * Inputs: A register and a pointer sized operand
-	 * Copies the object into the register
+	 * Copies the constant with that index in the image's pool into the register. The
+	 * constant is made into an object the first time anyone loads it.
 	 */
 	void Machine::loadi(Object** regs, uint8_t a, uintptr_t i)
 	{
-		regs[a] = constants[i];
+		regs[a] = image->get_constant(i);
 	}
 
 	/* Push an item onto the stack
@@ -160,7 +235,7 @@ namespace Caribou
 	{
 		Context* ctx = get_current_context();
 		size_t count = static_cast<Integer*>(regs[a])->c_int();
-		Object* tmp[count];
+		std::vector<Object*> tmp(count);
 		size_t i;
 
 		for(i = 0; i < count; i++)
@@ -243,8 +318,8 @@ namespace Caribou
 
 	/* Check if two objects are equal
 	 * Inputs: Three registers - 1) Destination, 2) Object A, 3) Object B
-	 * This instruction expects to be paired with a JMP instruction or 4 noop
-	 * instructions.
+	 * This instruction expects to be paired with a JMP instruction or as many noop
+	 * instructions as a JMP is long, or a single noop in compact bytecode.
 	 */
 	void Machine::eq(Object** regs, uint8_t a, uint8_t b, uint8_t c)
 	{
@@ -255,13 +330,13 @@ namespace Caribou
 
 		// Skip an extra instruction (the JMP)
 		if(r != 0)
-			next(4);
+			skip_opcode();
 	}
 
 	/* Check if an object is less than another
 	 * Inputs: Three registers - 1) Destination, 2) Object A, 3) Object B
-	 * This instruction expects to be paired with a JMP instruction or 4 noop
-	 * instructions.
+	 * This instruction expects to be paired with a JMP instruction or as many noop
+	 * instructions as a JMP is long, or a single noop in compact bytecode.
 	 */
 	void Machine::lt(Object** regs, uint8_t a, uint8_t b, uint8_t c)
 	{
@@ -271,14 +346,14 @@ namespace Caribou
 		regs[a] = new Boolean(r < 0);
 
 		// Skip an extra instruction (the JMP)
-		if(r != -1)
-			next(4);
+		if(r >= 0)
+			skip_opcode();
 	}
 
 	/* Check if an object is less than or equal to another
 	 * Inputs: Three registers - 1) Destination, 2) Object A, 3) Object B
-	 * This instruction expects to be paired with a JMP instruction or 4 noop
-	 * instructions.
+	 * This instruction expects to be paired with a JMP instruction or as many noop
+	 * instructions as a JMP is long, or a single noop in compact bytecode.
 	 */
 	void Machine::lte(Object** regs, uint8_t a, uint8_t b, uint8_t c)
 	{
@@ -289,13 +364,13 @@ namespace Caribou
 
 		// Skip an extra instruction (the JMP)
 		if(r > 0)
-			next(4);
+			skip_opcode();
 	}
 
 	/* Check if an object is greater than another
 	 * Inputs: Three registers - 1) Destination, 2) Object A, 3) Object B
-	 * This instruction expects to be paired with a JMP instruction or 4 noop
-	 * instructions.
+	 * This instruction expects to be paired with a JMP instruction or as many noop
+	 * instructions as a JMP is long, or a single noop in compact bytecode.
 	 */
 	void Machine::gt(Object** regs, uint8_t a, uint8_t b, uint8_t c)
 	{
@@ -305,14 +380,14 @@ namespace Caribou
 		regs[a] = new Boolean(r > 0);
 
 		// Skip an extra instruction (the JMP)
-		if(r == 1)
-			next(4);
+		if(r <= 0)
+			skip_opcode();
 	}
 
 	/* Check if an object is greater than or equal to another
 	 * Inputs: Three registers - 1) Destination, 2) Object A, 3) Object B
-	 * This instruction expects to be paired with a JMP instruction or 4 noop
-	 * instructions.
+	 * This instruction expects to be paired with a JMP instruction or as many noop
+	 * instructions as a JMP is long, or a single noop in compact bytecode.
 	 */
 	void Machine::gte(Object** regs, uint8_t a, uint8_t b, uint8_t c)
 	{
@@ -323,7 +398,7 @@ namespace Caribou
 
 		// Skip an extra instruction (the JMP)
 		if(r < 0)
-			next(4);
+			skip_opcode();
 	}
 
 	/* Unconditional jump
@@ -334,46 +409,374 @@ namespace Caribou
 		ip = loc;
 	}
 
+	static inline bool accepted(MailboxStatus status)
+	{
+		return status == kMailboxDelivered || status == kMailboxDroppedOldest;
+	}
+
+	/* Gives the scheduler a turn in place of the current instruction. The instruction is
+	 * retried once whatever the scheduler starts has finished. Returns false if there was
+	 * nothing to run, in which case the caller must finish the instruction on its own.
+	 */
+	bool Machine::stall()
+	{
+		if(!scheduler.has_work())
+			return false;
+
+		ip = insn_ip;
+		scheduler.run_once();
+		return true;
+	}
+
+	/* Deliver a message for SEND and ASEND. Blocking the sender means getting out of the
+	 * way: the sender is deprioritised and the instruction stalls until the receiver has
+	 * made room. Returns false if the instruction stalled.
+	 */
+	bool Machine::post(Object* receiver, Message* msg, Object* sender, Future* reply, MailboxStatus& status)
+	{
+		status = receiver->mailbox->deliver(msg, sender, reply);
+
+		if(status == kMailboxWouldBlock)
+		{
+			scheduler.throttle(sender);
+			if(stall())
+				return false;
+			status = kMailboxRejected;
+		}
+		else if(status == kMailboxDelivered)
+			scheduler.relieve(sender);
+
+		if(accepted(status))
+			scheduler.wake(receiver);
+
+		return true;
+	}
+
 	/* Send a message
 	 * Inputs: Three registers - receiver of the message, the message, sending context
 	 * Instructs the receiver to receive the message we are sending it. Passes along the
-	 * sending context.
+	 * sending context. If the receiver has a bounded mailbox, a Boolean is left in the
+	 * return register telling whether the message was accepted.
+	 *
+	 * Sends to passive objects, and from an actor to itself, don't go through the mailbox
+	 * at all: they are plain calls, made right away on the current stack. Whether the send
+	 * is from the actor itself depends on the receiver of the running method, not on the
+	 * sending context the instruction names.
 	 */
-	void Machine::send(Object** regs, uint8_t a, uint8_t b, uint8_t c)
+	bool Machine::send(Object** regs, uint8_t a, uint8_t b, uint8_t c)
 	{
-		Object*& receiver = regs[a];
-		Object*& sender = regs[c];
+		Object* receiver = regs[a];
+		MailboxStatus status;
+
+		if(!receiver->is_actor() || receiver == regs[0])
+			return call(receiver, static_cast<Message*>(regs[b]));
+
+		if(!post(receiver, static_cast<Message*>(regs[b]), regs[c], nullptr, status))
+			return false;
+
+		if(receiver->mailbox->is_bounded())
+			regs[2] = new Boolean(accepted(status));
+
+		return true;
+	}
+
+	/* Send a message asynchronously
+	 * Inputs: Three registers - receiver of the message, the message, sending context
+	 * Like SEND, but leaves a future in the return register. The future is resolved with
+	 * whatever the receiving method returns. If the message was rejected, a false Boolean
+	 * is left there instead.
+	 */
+	bool Machine::asend(Object** regs, uint8_t a, uint8_t b, uint8_t c)
+	{
+		Future* future = new Future();
+		MailboxStatus status;
+
+		if(!post(regs[a], static_cast<Message*>(regs[b]), regs[c], future, status))
+			return false;
+
+		if(accepted(status))
+			regs[2] = future;
+		else
+			regs[2] = new Boolean(false);
+
+		return true;
+	}
+
+	/* Wait for a future
+	 * Inputs: Two registers - 1) Destination, 2) Future
+	 * Places the value the future was resolved with into the destination register. Until
+	 * it is resolved, the current context is parked and the scheduler runs other actors
+	 * instead. Anything that isn't a future is treated as already resolved. If nothing is
+	 * left that could resolve the future, the destination is set to Nil.
+	 */
+	bool Machine::await(Object** regs, uint8_t a, uint8_t b)
+	{
+		Future* future = dynamic_cast<Future*>(regs[b]);
+
+		if(future == nullptr)
+		{
+			regs[a] = regs[b];
+			return true;
+		}
+
+		if(!future->is_resolved() && stall())
+			return false;
+
+		regs[a] = future->is_resolved() ? future->get_value() : Nil::instance();
+		return true;
+	}
+
+	/* Send a message after a delay
+	 * Inputs: Three registers - 1) Receiver, 2) Message, 3) Delay in milliseconds
+	 * Arranges for the message to be delivered into the receiver's mailbox once the delay
+	 * has passed. The receiver of the current method is the sender.
+	 */
+	void Machine::send_after(Object** regs, uint8_t a, uint8_t b, uint8_t c)
+	{
+		intptr_t delay = static_cast<Integer*>(regs[c])->c_int();
+		scheduler.send_after(regs[a], static_cast<Message*>(regs[b]), regs[0], delay < 0 ? 0 : delay);
+	}
+
+	/* Wait for a future, for a while
+	 * Inputs: Three registers - 1) Destination, 2) Future, 3) Timeout in milliseconds
+	 * Like AWAIT, except that if the future is still unresolved once the timeout has
+	 * passed, the destination is set to Nil.
+	 */
+	bool Machine::await_for(Object** regs, uint8_t a, uint8_t b, uint8_t c)
+	{
+		Context* ctx = get_current_context();
+		Future* future = dynamic_cast<Future*>(regs[b]);
+
+		if(future == nullptr)
+		{
+			regs[a] = regs[b];
+			return true;
+		}
+
+		if(!future->is_resolved())
+		{
+			if(ctx->wait_timer == nullptr)
+			{
+				intptr_t timeout = static_cast<Integer*>(regs[c])->c_int();
+				ctx->wait_timer = scheduler.timeout(timeout < 0 ? 0 : timeout);
+			}
+
+			if(!ctx->wait_timer->fired && stall())
+				return false;
+		}
+
+		if(ctx->wait_timer != nullptr)
+		{
+			scheduler.cancel(ctx->wait_timer);
+			delete ctx->wait_timer;
+			ctx->wait_timer = nullptr;
+		}
+
+		regs[a] = future->is_resolved() ? future->get_value() : Nil::instance();
+		return true;
+	}
+
+	void Machine::dispatch(Object* receiver, Message* msg, Future* reply)
+	{
+		Object* slot_context;
+		Object* value = receiver->lookup(msg->get_name(), slot_context);
+		VMMethod* method = dynamic_cast<VMMethod*>(value);
+		Object* result;
+
+		receiver->mailbox->set_reply(reply);
+
+		if(method != nullptr)
+		{
+			Context* ctx = enter(receiver, method, ip);
+			ctx->detached = true;
+			ctx->actor = receiver;
+			return;
+		}
+
+		if(value != nullptr)
+			result = value->activate(receiver, nullptr, msg, slot_context);
+		else
+			result = receiver->forward(nullptr, msg);
+
+		finish(receiver, result);
+	}
+
+	// The actor is done with its message. Its reply gets the result, and if more mail came
+	// in meanwhile, it is scheduled again.
+	void Machine::finish(Object* actor, Object* result)
+	{
+		Future* reply = actor->mailbox->release();
+
+		if(reply != nullptr)
+			reply->resolve(result);
+		if(!actor->mailbox->is_empty())
+			scheduler.wake(actor);
+	}
+
+	/* Call a method directly, without going through the receiver's mailbox. A method
+	 * gets a new context which returns to the instruction after the SEND, and its result
+	 * ends up in the return register like any other. Anything else found in the slot is
+	 * activated on the spot. Returns false if control was transferred to the method.
+	 */
+	bool Machine::call(Object* receiver, Message* msg)
+	{
+		Object* slot_context;
+		Object* value = receiver->lookup(msg->get_name(), slot_context);
+		VMMethod* method = dynamic_cast<VMMethod*>(value);
+
+		if(method != nullptr)
+		{
+			enter(receiver, method, ip + 1);
+			return false;
+		}
+
+		if(value != nullptr)
+			get_current_context()->registers[2] = value->activate(receiver, nullptr, msg, slot_context);
+		else
+			get_current_context()->registers[2] = receiver->forward(nullptr, msg);
+
+		return true;
+	}
+
+	/* Send a message in tail position
+	 * Inputs: Three registers - receiver of the message, the message, sending context
+	 * Like SEND followed by RET, except that what we return is whatever the call returns.
+	 * When the call is made straight to a bytecode method, the current context is handed
+	 * over to it instead of a new one being pushed, so it returns directly to our caller
+	 * and a chain of tail calls runs in constant space. Anything else is sent as SEND
+	 * would, and its result, or Nil, returned right away.
+	 */
+	void Machine::tail_send(Object** regs, uint8_t a, uint8_t b, uint8_t c)
+	{
+		Object* receiver = regs[a];
 		Message* msg = static_cast<Message*>(regs[b]);
-		receiver->mailbox->deliver(msg, sender);
+
+		if(!receiver->is_actor() || receiver == regs[0])
+		{
+			Object* slot_context;
+			Object* value = receiver->lookup(msg->get_name(), slot_context);
+			VMMethod* method = dynamic_cast<VMMethod*>(value);
+
+			if(method != nullptr)
+			{
+				reenter(receiver, method);
+				return;
+			}
+		}
+
+		regs[2] = Nil::instance();
+		if(send(regs, a, b, c))
+			return_with(get_current_context()->registers[2]);
+	}
+
+	// Pushes a context for running a method on behalf of a receiver, and jumps to it.
+	Context* Machine::enter(Object* receiver, VMMethod* method, uintptr_t return_address)
+	{
+		Context* ctx = frames.acquire(get_current_context(), method, return_address);
+		ctx->registers[0] = receiver;
+		ctx->registers[1] = method->locals;
+		rstack->push(ctx);
+		if(ctx->log != nullptr)
+			ctx->log->record_enter(ctx);
+#ifdef CARIBOU_BASELINE_JIT
+		baseline.entered(method);
+#endif
+		ip = method->get_start_ip();
+		return ctx;
+	}
+
+	// Replaces the current context with one running a method on behalf of a receiver, and
+	// jumps to it. The frame is reused if it is big enough.
+	void Machine::reenter(Object* receiver, VMMethod* method)
+	{
+		Context* ctx = rstack->pop();
+
+		if(ctx->log != nullptr)
+			ctx->log->record_leave(ctx);
+		invalidate_escapes(rstack->size());
+
+		ctx = frames.reuse(ctx, method);
+		ctx->registers[0] = receiver;
+		ctx->registers[1] = method->locals;
+		rstack->push(ctx);
+		if(ctx->log != nullptr)
+			ctx->log->record_enter(ctx);
+#ifdef CARIBOU_BASELINE_JIT
+		baseline.entered(method);
+#endif
+		ip = method->get_start_ip();
 	}
 
 	/* Return from a method
 	 * Inputs: None
-	 * Stores the top of the stack (or Nil) into the return register of the previous
-	 * context.
+	 * Pops the current context and continues at its return address. The top of the stack
+	 * (or Nil) is stored into the return register of the previous context, or, for a
+	 * context handling an actor's message, used to resolve its reply. The context goes back to the frame pool.
+	 * Returning from the outermost context of a coroutine finishes it, like a last YIELD;
+	 * returning from the outermost context of the machine halts.
 	 */
 	void Machine::ret()
 	{
-		Context* ctx = get_current_context();
-		Object** regs = ctx->previous->registers;
-		Object* r = ctx->top();
+		Object* r = get_current_context()->top();
 
 		if(r == NULL)
-			regs[2] = Nil::instance();
-		else
-			regs[2] = r;
+			r = Nil::instance();
+
+		return_with(r);
+	}
+
+	// Pops the current context, handing r to whoever it returns to.
+	void Machine::return_with(Object* r)
+	{
+		Context* ctx = get_current_context();
+
+		if(rstack->size() == 1)
+		{
+			if(coroutine != nullptr)
+			{
+				rstack->pop();
+				invalidate_escapes(0);
+				if(!ctx->frozen)
+					frames.release(ctx);
+				Coroutine* co = coroutine;
+				co->finished();
+				leave(co, r);
+				return;
+			}
+
+			ip = UINTPTR_MAX;
+			return;
+		}
+
+		rstack->pop();
+		if(ctx->log != nullptr)
+			ctx->log->record_leave(ctx);
+		invalidate_escapes(rstack->size());
+		ip = ctx->return_address;
+
+		if(ctx->actor != nullptr)
+			finish(ctx->actor, r);
+		else if(!ctx->detached)
+			get_writable_context()->registers[2] = r;
+
+		// Frozen frames still belong to a continuation or the revision log.
+		if(!ctx->frozen)
+			frames.release(ctx);
 	}
 
 	/* Save the contents of the stack in a continuation
 	 * Inputs: One register - for storing the continuation
 	 * After this instruction finishes, we save a copy of the stack including the registers
-	 * in a continuation. This continuation is placed in the destination register.
+	 * in a continuation. This continuation is placed in the destination register. The copy
+	 * is taken first, so the continuation isn't in its own copy: restoring it leaves the
+	 * destination register as it was before the SAVE.
 	 */
 	void Machine::save(Object** regs, uint8_t a)
 	{
 		Continuation* c = new Continuation(this);
 		c->save_current_stack();
-		regs[a] = reinterpret_cast<Object*>(c);
+		// The frame regs belongs to is frozen now, and shared with the continuation.
+		get_writable_context()->registers[a] = reinterpret_cast<Object*>(c);
 	}
 
 	/* Call a continuation and restore the stack
@@ -383,8 +786,211 @@ namespace Caribou
 	 */
 	void Machine::restore(Object** regs, uint8_t a)
 	{
+		EscapeContinuation* e = dynamic_cast<EscapeContinuation*>(regs[a]);
+
+		if(e != nullptr)
+		{
+			unwind(e);
+			return;
+		}
+
+		// Whatever the stack is replaced with, none of the frames escapes were made in are
+		// there any more.
+		invalidate_escapes(0);
+
+		PersistentContinuation* p = dynamic_cast<PersistentContinuation*>(regs[a]);
+
+		if(p != nullptr)
+		{
+			ip = revisions.restore(p);
+			return;
+		}
+
 		Continuation* c = static_cast<Continuation*>(regs[a]);
 		c->restore_stack();
+
+		if(revisions.is_recording())
+			revisions.discontinue();
+	}
+
+	/* Make an escape continuation
+	 * Inputs: One register - for storing the continuation
+	 * Nothing is saved but the depth of the return stack, the depth of this frame's operand
+	 * stack and the instruction after this one. RESTORE on it returns straight to this frame
+	 * from any depth, taking the top of the stack of the frame it leaves along to the return
+	 * register, like RET does. It can only be used once, and only until this frame returns.
+	 */
+	void Machine::escape(Object** regs, uint8_t a)
+	{
+		EscapeContinuation* e = new EscapeContinuation(rstack, rstack->size(), ip, get_current_context()->sp);
+		escapes.push_back(e);
+		regs[a] = e;
+	}
+
+	// Pops every frame above the one an escape continuation was made in, and carries on
+	// where it says. Replies the popped frames owed are resolved with Nil.
+	void Machine::unwind(EscapeContinuation* e)
+	{
+		if(!e->is_valid() || e->get_stack() != rstack)
+			throw DeadContinuationError();
+
+		Object* r = get_current_context()->top();
+
+		if(r == NULL)
+			r = Nil::instance();
+
+		while(rstack->size() > e->get_depth())
+		{
+			Context* ctx = rstack->pop();
+
+			if(ctx->log != nullptr)
+				ctx->log->record_leave(ctx);
+			if(ctx->actor != nullptr)
+				finish(ctx->actor, Nil::instance());
+			if(!ctx->frozen)
+				frames.release(ctx);
+		}
+
+		invalidate_escapes(e->get_depth());
+		e->invalidate();
+		for(size_t i = escapes.size(); i > 0; i--)
+		{
+			if(escapes[i - 1] == e)
+			{
+				escapes.erase(escapes.begin() + i - 1);
+				break;
+			}
+		}
+
+		// The verifier took the operand stack to be as deep at the instruction after the
+		// ESCAPE as it was at the ESCAPE, so that is how deep it has to be when we get there.
+		// Whatever was pushed since is dropped; if something it had then has been popped,
+		// there is no getting it back.
+		Context* ctx = get_writable_context();
+		if(ctx->sp < e->get_resume_sp())
+			throw InvalidBytecodeError(e->get_resume_ip(), "escape continuation resumed with less on the stack than it was made with");
+		while(ctx->sp > e->get_resume_sp())
+			ctx->pop();
+
+		ctx->registers[2] = r;
+		ip = e->get_resume_ip();
+	}
+
+	// Escapes made in frames of the running stack deeper than depth can't be used any more.
+	// Those of suspended coroutines stay as they are.
+	void Machine::invalidate_escapes(size_t depth)
+	{
+		for(size_t i = escapes.size(); i > 0; i--)
+		{
+			EscapeContinuation* e = escapes[i - 1];
+
+			if(e->get_stack() == rstack && e->get_depth() > depth)
+			{
+				e->invalidate();
+				escapes.erase(escapes.begin() + i - 1);
+			}
+		}
+	}
+
+	/* Make a coroutine
+	 * Inputs: Three registers - for storing the coroutine, receiver of the message, the message
+	 * The method the message looks up gets a frame on a return stack of its own. It doesn't
+	 * start running until the coroutine is first resumed.
+	 */
+	void Machine::make_coroutine(Object** regs, uint8_t a, uint8_t b, uint8_t c)
+	{
+		Object* receiver = regs[b];
+		Message* msg = static_cast<Message*>(regs[c]);
+		Object* slot_context;
+		VMMethod* method = dynamic_cast<VMMethod*>(receiver->lookup(msg->get_name(), slot_context));
+
+		if(method == nullptr)
+			throw CoroutineError("Coroutine needs a bytecode method for " + msg->get_name());
+
+		Context* ctx = frames.acquire(NULL, method, 0);
+		ctx->registers[0] = receiver;
+		ctx->registers[1] = method->locals;
+		ctx->detached = true;
+		regs[a] = new Coroutine(ctx, method->get_start_ip());
+	}
+
+	/* Resume a coroutine
+	 * Inputs: Two registers - the coroutine, a value to hand it
+	 * Switches to the coroutine's return stack and carries on where it last yielded, with
+	 * the value in its return register. When it yields or finishes, we carry on after this
+	 * instruction with what it yielded or returned in our return register. Resuming a
+	 * finished coroutine leaves Nil there.
+	 */
+	void Machine::resume(Object** regs, uint8_t a, uint8_t b)
+	{
+		Coroutine* co = dynamic_cast<Coroutine*>(regs[a]);
+		Object* value = regs[b];
+
+		if(co == nullptr)
+			throw CoroutineError("RESUME needs a coroutine");
+
+		if(co->get_state() == kCoroutineDead)
+		{
+			regs[2] = Nil::instance();
+			return;
+		}
+
+		if(co->get_state() == kCoroutineRunning)
+			throw CoroutineError("Coroutine resumed while it is running");
+
+		co->resumed(coroutine, ip);
+		switch_to(co);
+		ip = co->get_resume_ip();
+		get_writable_context()->registers[2] = value;
+	}
+
+	/* Yield from a coroutine
+	 * Inputs: One register - the value to hand back
+	 * Switches back to whoever resumed the running coroutine. Once resumed again, we carry
+	 * on after this instruction with the value it was resumed with in the return register.
+	 */
+	void Machine::yield(Object** regs, uint8_t a)
+	{
+		Coroutine* co = coroutine;
+
+		if(co == nullptr)
+			throw CoroutineError("YIELD outside of a coroutine");
+
+		co->suspended(ip);
+		leave(co, regs[a]);
+	}
+
+	// Makes a coroutine's return stack, or the main one, the one we run on. Nothing on
+	// either stack is touched.
+	void Machine::switch_to(Coroutine* co)
+	{
+		rstack = co != nullptr ? co->get_stack() : &main_stack;
+		coroutine = co;
+
+		// The revision log only follows one stack at a time.
+		if(revisions.is_recording())
+			revisions.discontinue();
+	}
+
+	// Goes back to whoever resumed a coroutine, handing them a value.
+	void Machine::leave(Coroutine* co, Object* value)
+	{
+		uintptr_t return_ip = co->get_return_ip();
+
+		switch_to(co->get_resumer());
+		ip = return_ip;
+		get_writable_context()->registers[2] = value;
+	}
+
+	/* Mark the current revision of the stack
+	 * Inputs: One register - for storing the continuation
+	 * Like SAVE, but nothing is copied. The continuation is only a revision in the log of
+	 * stack operations, which RESTORE gets back to by undoing and redoing operations. The
+	 * operand stacks and the return stack are restored; registers are not.
+	 */
+	void Machine::mark(Object** regs, uint8_t a)
+	{
+		regs[a] = revisions.mark(ip);
 	}
 
 	/* Make a new array
@@ -395,11 +1001,12 @@ namespace Caribou
 	void Machine::make_array(Object** regs, uint8_t a)
 	{
 		Context* ctx = get_current_context();
-		Integer* count = static_cast<Integer*>(regs[a]);
-		Object* tmp[count->c_int()];
-		for(uintptr_t i = 0; i < count->c_int(); i++)
-			tmp[i] = ctx->pop();
-		Array* array = new Array(tmp, count->c_int());
+		size_t count = static_cast<Integer*>(regs[a])->c_int();
+		// The array keeps what it is given.
+		Object** items = new Object*[count];
+		for(size_t i = 0; i < count; i++)
+			items[i] = ctx->pop();
+		Array* array = new Array(items, count);
 		ctx->push(array);
 	}
 
@@ -411,16 +1018,33 @@ namespace Caribou
 	void Machine::make_string(Object** regs, uint8_t a)
 	{
 		Context* ctx = get_current_context();
-		Integer* count = static_cast<Integer*>(regs[a]);
-		char* tmp = new char[count->c_int()];
+		size_t count = static_cast<Integer*>(regs[a])->c_int();
+		std::string bytes(count, '\0');
 
-		for(uintptr_t i = 0; i < count->c_int(); i++)
-			tmp[i] = static_cast<Integer*>(ctx->pop())->c_int();
+		for(size_t i = 0; i < count; i++)
+			bytes[i] = static_cast<Integer*>(ctx->pop())->c_int();
 
-		String* str = new String(std::string(tmp));
+		String* str = new String(bytes);
 		ctx->push(str);
+	}
+
+	/* Make an object an actor
+	 * Inputs: Three registers - 1) The object, 2) Mailbox capacity, 3) Overflow policy
+	 * From here on, sends from other objects are queued in the object's mailbox and run
+	 * by the scheduler in turn, rather than called on the sender's stack. A capacity of 0
+	 * leaves the mailbox unbounded. The policy is 0 to block the sender once it is full,
+	 * 1 to drop the oldest message and 2 to reject the send.
+	 */
+	void Machine::make_actor(Object** regs, uint8_t a, uint8_t b, uint8_t c)
+	{
+		intptr_t capacity = static_cast<Integer*>(regs[b])->c_int();
+		intptr_t policy = static_cast<Integer*>(regs[c])->c_int();
+
+		if(policy < kMailboxOverflowBlock || policy > kMailboxOverflowFail)
+			policy = kMailboxOverflowBlock;
 
-		delete tmp;
+		regs[a]->set_actor(true);
+		regs[a]->mailbox->set_capacity(capacity < 0 ? 0 : capacity, static_cast<MailboxOverflowPolicy>(policy));
 	}
 
 	/* Add a string to the symbol table.
@@ -431,7 +1055,7 @@ namespace Caribou
 	void Machine::addsym(Object** regs, uint8_t a, uint8_t b)
 	{
 		String* str = static_cast<String*>(regs[b]);
-		size_t i = symtab.add(str);
+		size_t i = image->get_symtab().add(str);
 		regs[a] = reinterpret_cast<Object*>(new Integer(i));
 	}
 
@@ -444,144 +1068,375 @@ namespace Caribou
 	void Machine::findsym(Object** regs, uint8_t a, uint8_t b)
 	{
 		Integer* idx = static_cast<Integer*>(regs[b]);
-		Object* str = reinterpret_cast<Object*>(symtab.lookup(idx->c_int()));
+		Object* str = reinterpret_cast<Object*>(image->get_symtab().lookup(idx->c_int()));
 		if(str)
 			regs[a] = str;
 		else
 			regs[a] = Nil::instance();
 	}
 
+	Stack<Context*>* Machine::capture_return_stack()
+	{
+		for(Context* ctx : rstack->get_store())
+			ctx->frozen = true;
+		return new Stack<Context*>(*rstack);
+	}
+
+	Context* Machine::get_writable_frame(size_t depth)
+	{
+		Context*& ctx = rstack->get_store()[depth];
+
+		if(ctx->frozen)
+		{
+			Context* copy = frames.copy(*ctx);
+			// A pending timeout belongs to whoever is running the frame, not to the snapshot.
+			copy->wait_timer = ctx->wait_timer;
+			ctx->wait_timer = nullptr;
+			ctx = copy;
+		}
+
+		return ctx;
+	}
+
 	void Machine::execute()
 	{
-		ip = 0;
+		// Everything this machine allocates from here on comes out of its own heap.
+		collector = heap;
+		ip = image->get_entry_point();
 
-		fetch_decode();
+		VMMethod* main = new VMMethod(new String("__main"), ip, 0, image->get_entry_facts());
+		Context* context = frames.acquire(NULL, main, 0);
+		context->registers[0] = get_object_space();
+		context->registers[1] = main->locals;
+		rstack->push(context);
 
-		VMMethod* main = new VMMethod(this, NULL, new String("__main"), ip, 0);
-		Context* context = new Context(NULL, main, 0);
-		rstack.push(context);
+		fetch_decode();
 
-		while(opcode != Instructions::HALT && ip < icount)
+		while(ip < icount)
 		{
-			process(opcode, get_current_context()->registers);
+			// Before stopping, let the actors with pending mail run. Their frames return
+			// here, to the HALT.
+			if(opcode == Instructions::HALT)
+			{
+				if(!scheduler.run_once())
+					break;
+				fetch_decode();
+				continue;
+			}
+
+			insn_ip = ip;
+			Context* ctx = get_writable_context();
+
+			// Code the verifier couldn't vouch for is checked as it runs. Code it could is
+			// run natively, where there is native code for it.
+			if(!ctx->method->facts.verified)
+				check(ctx);
+			else if(native != nullptr && native[ip] != nullptr && !recorder.recording())
+			{
+				native[ip](this, ctx->registers);
+				fetch_decode();
+				continue;
+			}
+
+			// While a loop is being recorded, so is every instruction run.
+			if(recorder.recording())
+				recorder.record(ip, ctx);
+
+			process(opcode, ctx->registers);
 			fetch_decode();
 		}
 	}
 
+	// Everything the verifier would have made sure of before running a method, for the
+	// instruction about to run.
+	void Machine::check(Context* ctx)
+	{
+		const InstructionInfo& info = instruction_info(opcode);
+		DecodedInstruction insn;
+
+		if(info.length == 0)
+			throw InvalidBytecodeError(ip, "unknown opcode");
+		if(!decode_instruction(instructions, icount, ip, version, insn))
+			throw InvalidBytecodeError(ip, "instruction runs past the end of the code");
+
+		for(uint8_t i = 0; i < insn.nregs; i++)
+		{
+			uint8_t r = insn.registers[i];
+
+			if(r >= CARIBOU_NUM_REGISTERS)
+				throw InvalidBytecodeError(ip, "no such register");
+			if(!(i == 0 && (info.flags & kInsnDefinesFirst)) && ctx->registers[r] == nullptr)
+				throw InvalidBytecodeError(ip, "register read before it is written");
+		}
+
+		if(ctx->sp < info.pops)
+			throw InvalidBytecodeError(ip, "stack underflow");
+
+		// Variable instructions pop as many as their register says.
+		if(info.flags & kInsnVariable)
+		{
+			Integer* count = dynamic_cast<Integer*>(ctx->registers[insn.registers[0]]);
+
+			if(count == nullptr)
+				throw InvalidBytecodeError(ip, "count isn't an integer");
+			if(count->c_int() < 0 || static_cast<uintptr_t>(count->c_int()) > ctx->sp)
+				throw InvalidBytecodeError(ip, "stack underflow");
+		}
+		if((info.flags & kInsnJump) && insn.immediate >= icount)
+			throw InvalidBytecodeError(ip, "jump out of the code");
+		if(opcode == Instructions::LOADI && insn.immediate >= const_count)
+			throw InvalidBytecodeError(ip, "no such constant");
+	}
+
+	// Each instruction reads its operands in order, leaving the instruction pointer on
+	// the last byte read, and then steps to the next instruction. Instructions which
+	// transfer control set the instruction pointer themselves.
 	void Machine::process(uint8_t op, Object** regs)
 	{
+		uint8_t a, b, c;
+		uintptr_t i;
+
 		switch(op)
 		{
 			case Instructions::NOOP:
 				next();
 				break;
 			case Instructions::MOVE:
-				move(regs, get_reg_opcode(), get_reg_opcode());
-				next(3);
+				a = get_reg_opcode();
+				b = get_reg_opcode();
+				move(regs, a, b);
+				next();
 				break;
 			case Instructions::LOADI:
-				loadi(regs, get_reg_opcode(), get_intptr_opcode());
-				next(2 + sizeof(uintptr_t));
+				a = get_reg_opcode();
+				i = get_intptr_opcode();
+				loadi(regs, a, i);
+				next();
 				break;
 			case Instructions::PUSH:
 				push(regs, get_intptr_opcode());
+				next();
 				break;
 			case Instructions::POP:
 				pop(regs, get_reg_opcode());
+				next();
 				break;
 			case Instructions::SWAP:
 				swap();
+				next();
 				break;
 			case Instructions::ROTATE:
 				rotate(regs, get_reg_opcode());
+				next();
 				break;
 			case Instructions::DUP:
 				dup();
+				next();
 				break;
 			case Instructions::ADD:
-				add(regs, get_reg_opcode(), get_reg_opcode(), get_reg_opcode());
-				next(4);
+				a = get_reg_opcode();
+				b = get_reg_opcode();
+				c = get_reg_opcode();
+				add(regs, a, b, c);
+				next();
 				break;
 			case Instructions::SUB:
-				sub(regs, get_reg_opcode(), get_reg_opcode(), get_reg_opcode());
-				next(4);
+				a = get_reg_opcode();
+				b = get_reg_opcode();
+				c = get_reg_opcode();
+				sub(regs, a, b, c);
+				next();
 				break;
 			case Instructions::MUL:
-				mul(regs, get_reg_opcode(), get_reg_opcode(), get_reg_opcode());
-				next(4);
+				a = get_reg_opcode();
+				b = get_reg_opcode();
+				c = get_reg_opcode();
+				mul(regs, a, b, c);
+				next();
 				break;
 			case Instructions::DIV:
-				div(regs, get_reg_opcode(), get_reg_opcode(), get_reg_opcode());
-				next(4);
+				a = get_reg_opcode();
+				b = get_reg_opcode();
+				c = get_reg_opcode();
+				div(regs, a, b, c);
+				next();
 				break;
 			case Instructions::MOD:
-				mod(regs, get_reg_opcode(), get_reg_opcode(), get_reg_opcode());
-				next(4);
+				a = get_reg_opcode();
+				b = get_reg_opcode();
+				c = get_reg_opcode();
+				mod(regs, a, b, c);
+				next();
 				break;
 			case Instructions::POW:
-				pow(regs, get_reg_opcode(), get_reg_opcode(), get_reg_opcode());
-				next(4);
+				a = get_reg_opcode();
+				b = get_reg_opcode();
+				c = get_reg_opcode();
+				pow(regs, a, b, c);
+				next();
 				break;
 			case Instructions::NOT:
-				bitwise_not(regs, get_reg_opcode(), get_reg_opcode());
-				next(3);
+				a = get_reg_opcode();
+				b = get_reg_opcode();
+				bitwise_not(regs, a, b);
+				next();
 				break;
 			case Instructions::EQ:
-				eq(regs, get_reg_opcode(), get_reg_opcode(), get_reg_opcode());
-				next(4);
+				a = get_reg_opcode();
+				b = get_reg_opcode();
+				c = get_reg_opcode();
+				next();
+				eq(regs, a, b, c);
 				break;
 			case Instructions::LT:
-				lt(regs, get_reg_opcode(), get_reg_opcode(), get_reg_opcode());
-				next(4);
+				a = get_reg_opcode();
+				b = get_reg_opcode();
+				c = get_reg_opcode();
+				next();
+				lt(regs, a, b, c);
 				break;
 			case Instructions::LTE:
-				lte(regs, get_reg_opcode(), get_reg_opcode(), get_reg_opcode());
-				next(4);
+				a = get_reg_opcode();
+				b = get_reg_opcode();
+				c = get_reg_opcode();
+				next();
+				lte(regs, a, b, c);
 				break;
 			case Instructions::GT:
-				gt(regs, get_reg_opcode(), get_reg_opcode(), get_reg_opcode());
-				next(4);
+				a = get_reg_opcode();
+				b = get_reg_opcode();
+				c = get_reg_opcode();
+				next();
+				gt(regs, a, b, c);
 				break;
 			case Instructions::GTE:
-				gte(regs, get_reg_opcode(), get_reg_opcode(), get_reg_opcode());
-				next(4);
+				a = get_reg_opcode();
+				b = get_reg_opcode();
+				c = get_reg_opcode();
+				next();
+				gte(regs, a, b, c);
 				break;
 			case Instructions::HALT:
 				ip = UINTPTR_MAX;
 				break;
 			case Instructions::SEND:
-				send(regs, get_reg_opcode(), get_reg_opcode(), get_reg_opcode());
-				next(4);
+				a = get_reg_opcode();
+				b = get_reg_opcode();
+				c = get_reg_opcode();
+				if(send(regs, a, b, c))
+					next();
+				break;
+			case Instructions::ASEND:
+				a = get_reg_opcode();
+				b = get_reg_opcode();
+				c = get_reg_opcode();
+				if(asend(regs, a, b, c))
+					next();
+				break;
+			case Instructions::AWAIT:
+				a = get_reg_opcode();
+				b = get_reg_opcode();
+				if(await(regs, a, b))
+					next();
+				break;
+			case Instructions::SENDAFTER:
+				a = get_reg_opcode();
+				b = get_reg_opcode();
+				c = get_reg_opcode();
+				send_after(regs, a, b, c);
+				next();
+				break;
+			case Instructions::AWAITFOR:
+				a = get_reg_opcode();
+				b = get_reg_opcode();
+				c = get_reg_opcode();
+				if(await_for(regs, a, b, c))
+					next();
 				break;
 			case Instructions::RET:
 				ret();
-				next();
 				break;
 			case Instructions::JMP:
-				jmp(get_intptr_opcode());
+				i = get_jump_opcode();
+				// Loops are found by the jumps back to where they start. Once one has been
+				// compiled, it runs natively until it leaves the trace.
+				if(i <= insn_ip)
+				{
+					TraceFunction trace = recorder.backward_jump(i);
+					if(trace != nullptr)
+						i = trace(regs, get_current_context());
+				}
+				jmp(i);
 				break;
 			case Instructions::SAVE:
-				save(regs, get_reg_opcode());
-				next(2);
+				// The continuation resumes after this instruction.
+				a = get_reg_opcode();
+				next();
+				save(regs, a);
 				break;
 			case Instructions::RESTORE:
 				restore(regs, get_reg_opcode());
 				break;
+			case Instructions::MARK:
+				a = get_reg_opcode();
+				next();
+				mark(regs, a);
+				break;
+			case Instructions::ESCAPE:
+				a = get_reg_opcode();
+				next();
+				escape(regs, a);
+				break;
+			case Instructions::TAILSEND:
+				a = get_reg_opcode();
+				b = get_reg_opcode();
+				c = get_reg_opcode();
+				tail_send(regs, a, b, c);
+				break;
+			case Instructions::COROUTINE:
+				a = get_reg_opcode();
+				b = get_reg_opcode();
+				c = get_reg_opcode();
+				next();
+				make_coroutine(regs, a, b, c);
+				break;
+			case Instructions::RESUME:
+				a = get_reg_opcode();
+				b = get_reg_opcode();
+				next();
+				resume(regs, a, b);
+				break;
+			case Instructions::YIELD:
+				a = get_reg_opcode();
+				next();
+				yield(regs, a);
+				break;
 			case Instructions::ADDSYM:
-				addsym(regs, get_reg_opcode(), get_reg_opcode());
-				next(3);
+				a = get_reg_opcode();
+				b = get_reg_opcode();
+				addsym(regs, a, b);
+				next();
 				break;
 			case Instructions::FINDSYM:
-				findsym(regs, get_reg_opcode(), get_reg_opcode());
-				next(3);
+				a = get_reg_opcode();
+				b = get_reg_opcode();
+				findsym(regs, a, b);
+				next();
 				break;
 			case Instructions::ARRAY:
 				make_array(regs, get_reg_opcode());
-				next(2);
+				next();
 				break;
 			case Instructions::STRING:
 				make_string(regs, get_reg_opcode());
-				next(2);
+				next();
+				break;
+			case Instructions::ACTOR:
+				a = get_reg_opcode();
+				b = get_reg_opcode();
+				c = get_reg_opcode();
+				make_actor(regs, a, b, c);
+				next();
 				break;
 		}
 	}
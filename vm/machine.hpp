@@ -30,31 +30,69 @@
 #include "symtab.hpp"
 #include "instructions.hpp"
 #include "context.hpp"
+#include "scheduler.hpp"
+#include "mailbox.hpp"
+#include "frame_pool.hpp"
+#include "native_code.hpp"
+#include "trace_recorder.hpp"
+#include "baseline_jit.hpp"
 
 #define MAX_REGISTERS 256
 
+// Fixed comparisons skip over the JMP they are paired with when they fail.
+#define CARIBOU_JMP_LENGTH (1 + sizeof(uintptr_t))
+
 namespace Caribou
 {
 	class Continuation;
+	class Coroutine;
+	class EscapeContinuation;
 	class Message;
+	class Future;
+	class Image;
+	class ObjectSpace;
 
-	extern GarbageCollector* collector;
+	extern thread_local GarbageCollector* collector;
 
+	// A virtual core. Several machines may run the same image at once, one per thread;
+	// each has its own return stack, scheduler and heap.
 	class Machine
 	{
 	private:
-		uint8_t         opcode;
-		intptr_t        fp;
-		uintptr_t       ip;
-		uint8_t*        instructions;
-		size_t          icount;
-		Stack<Context*> rstack;
-		Object**        constants;
-		size_t          const_count;
-		Symtab          symtab;
+		uint8_t           opcode;
+		intptr_t          fp;
+		uintptr_t         ip;
+		uintptr_t         insn_ip;
+		Image*            image;
+		const uint8_t*    instructions;
+		size_t            icount;
+		uint8_t           version;
+		// Compact bytecode packs two registers to a byte; set once the first of a pair
+		// has been read, and the second is in the low nibble of the byte at ip.
+		bool              low_nibble;
+		// What to run natively at each offset, if the image was compiled ahead of time.
+		const NativeFunction* native;
+		// Finds the loops the machine spends its time in, and records what they do.
+		TraceRecorder     recorder;
+		Stack<Context*>   main_stack;
+		// The return stack being run: the main one, or that of the running coroutine.
+		Stack<Context*>*  rstack;
+		Coroutine*        coroutine;
+		FramePool         frames;
+		size_t            const_count;
+		Scheduler         scheduler;
+		RevisionLog       revisions;
+		// Escape continuations whose frames are still on the return stack, deepest last.
+		std::vector<EscapeContinuation*> escapes;
+		GarbageCollector* heap;
+#ifdef CARIBOU_BASELINE_JIT
+		// Compiles warm methods, when there is no native code from ahead of time. Last, so
+		// that nothing else moves for code built without it.
+		BaselineJit       baseline;
+#endif
 
 	public:
-		Machine();
+		Machine(Image*);
 		~Machine();
 
 		uint8_t fetch_decode();
@@ -76,10 +114,20 @@ namespace Caribou
 		void mod(Object** regs, uint8_t a, uint8_t b, uint8_t c);
 		void pow(Object** regs, uint8_t a, uint8_t b, uint8_t c);
 		void bitwise_not(Object** regs, uint8_t a, uint8_t b, uint8_t c);
-		void send(Object** regs, uint8_t a, uint8_t b, uint8_t c);
+		bool send(Object** regs, uint8_t a, uint8_t b, uint8_t c);
+		void tail_send(Object** regs, uint8_t a, uint8_t b, uint8_t c);
+		bool asend(Object** regs, uint8_t a, uint8_t b, uint8_t c);
+		bool await(Object** regs, uint8_t a, uint8_t b);
+		void send_after(Object** regs, uint8_t a, uint8_t b, uint8_t c);
+		bool await_for(Object** regs, uint8_t a, uint8_t b, uint8_t c);
 		void ret();
 		void save(Object** regs, uint8_t a);
 		void restore(Object** regs, uint8_t a);
+		void mark(Object** regs, uint8_t a);
+		void escape(Object** regs, uint8_t a);
+		void make_coroutine(Object** regs, uint8_t a, uint8_t b, uint8_t c);
+		void resume(Object** regs, uint8_t a, uint8_t b);
+		void yield(Object** regs, uint8_t a);
 		void eq(Object** regs, uint8_t a, uint8_t b, uint8_t c);
 		void lt(Object** regs, uint8_t a, uint8_t b, uint8_t c);
 		void lte(Object** regs, uint8_t a, uint8_t b, uint8_t c);
@@ -87,37 +135,62 @@ namespace Caribou
 		void gte(Object** regs, uint8_t a, uint8_t b, uint8_t c);
 		void make_array(Object** regs, uint8_t a);
 		void make_string(Object** regs, uint8_t a);
+		void make_actor(Object** regs, uint8_t a, uint8_t b, uint8_t c);
 		void addsym(Object** regs, uint8_t a, uint8_t b);
 		void findsym(Object** regs, uint8_t a, uint8_t b);
 
-		Stack<Context*>& get_return_stack() { return rstack; }
-		Stack<Context*>* copy_return_stack() { return new Stack<Context*>(rstack); }
-		void set_return_stack(Stack<Context*>* rs)
-		{
-			Stack<Context*> tmp(*rs);
-			rstack = tmp;
-		}
+		// Runs a message taken out of a mailbox. Bytecode methods get a detached frame that
+		// returns to the instruction we are currently at.
+		void dispatch(Object* receiver, Message* msg, Future* reply);
+		// Lets an actor which has been handling a message take on the next one.
+		void finish(Object* actor, Object* result);
+
+		Stack<Context*>& get_return_stack() { return *rstack; }
+		// The stack the machine runs on when it isn't running a coroutine.
+		Stack<Context*>& get_main_stack() { return main_stack; }
+		// Freezes every frame on the return stack and hands back a stack sharing them.
+		Stack<Context*>* capture_return_stack();
+		void set_return_stack(Stack<Context*>* rs) { *rstack = *rs; }
 
 		uintptr_t get_instruction_pointer() { return ip; }
 		void set_instruction_pointer(uintptr_t val) { ip = val; }
 
-		void allocate_instruction_memory(size_t size)
-		{
-			icount       = size;
-			instructions = new uint8_t[size];
-		}
+		Image* get_image() { return image; }
+		ObjectSpace* get_object_space();
 
-		uint8_t*& get_instructions() { return instructions; }
+		Context* get_current_context() { return rstack->top(); }
+		// The current context, copied first if it is frozen, for instructions to write to.
+		Context* get_writable_context() { return get_writable_frame(rstack->size() - 1); }
+		Context* get_writable_frame(size_t depth);
 
-		Context* get_current_context() { return rstack.top(); }
+		Scheduler& get_scheduler() { return scheduler; }
+		RevisionLog& get_revision_log() { return revisions; }
+		TraceRecorder& get_trace_recorder() { return recorder; }
+#ifdef CARIBOU_BASELINE_JIT
+		BaselineJit& get_baseline_jit() { return baseline; }
+#endif
 
 	protected:
 		void next(uint8_t val = 1) { ip += val; }
 		uint8_t get_reg_opcode();
 		uint32_t get_int32_opcode();
 		uintptr_t get_intptr_opcode();
+		uintptr_t get_jump_opcode();
+		void skip_opcode();
 
 	private:
+		bool post(Object* receiver, Message* msg, Object* sender, Future* reply, MailboxStatus& status);
+		bool call(Object* receiver, Message* msg);
+		void check(Context* ctx);
+		void unwind(EscapeContinuation* e);
+		void invalidate_escapes(size_t depth);
+		void switch_to(Coroutine* co);
+		void leave(Coroutine* co, Object* value);
+		Context* enter(Object* receiver, VMMethod* method, uintptr_t return_address);
+		void reenter(Object* receiver, VMMethod* method);
+		void return_with(Object* r);
+		bool stall();
+
 		inline void process(uint8_t, Object**);
 	};
 }
@@ -24,29 +24,68 @@
 #ifndef __CARIBOU__MAILBOX_HPP__
 #define __CARIBOU__MAILBOX_HPP__
 
+#include <atomic>
+#include <mutex>
 #include "message.hpp"
 
 namespace Caribou
 {
-	// Mailbox is a lock-free queue safe for up to two concurrent threads manipulating
-	// it so long as one is delivering and the other is receiving. So we still need a mutex
-	// protecting the access, but fine grained: one for reading, one for writing. The way I
-	// plan on doing this is to use the state machine, each state in a different thread. I
-	// protect transitions via mutexes. So long as the states are constructed carefully, so
-	// all writing is done in one, all reading in another, then we should be fine.
+	class Future;
+
+	// What a bounded mailbox does with a delivery once it is at capacity.
+	enum MailboxOverflowPolicy
+	{
+		kMailboxOverflowBlock = 0,
+		kMailboxOverflowDropOldest,
+		kMailboxOverflowFail
+	};
+
+	enum MailboxStatus
+	{
+		kMailboxDelivered = 0,
+		kMailboxDroppedOldest,
+		kMailboxWouldBlock,
+		kMailboxRejected
+	};
+
+	// Mailbox is a queue which any number of threads can deliver to and receive from at
+	// once. Objects in the image are shared by every machine, each on a thread of its own,
+	// so any of them may be sending to an actor while another is taking its messages. The
+	// queue is guarded by a mutex; the scheduler's flags are atomic. Any scheduler may have
+	// the actor queued, but only the one which claims it runs it, and nobody else can until
+	// the method handling its message has returned on that machine.
 	class Mailbox
 	{
 	private:
 		struct Node {
-			Node(Message* msg, Object* obj = nullptr /* XXX: should be some reasonably default */) : message(msg), sender(obj), next(nullptr) {}
+			Node(Message* msg, Object* obj = nullptr /* XXX: should be some reasonably default */, Future* f = nullptr) : message(msg), sender(obj), reply(f), next(nullptr) {}
 			Message* message;
 			Object*  sender;
+			Future*  reply;
 			Node* next;
 		};
 		Node* first;
 		Node* divider;
 		Node* last;
 
+		// A capacity of 0 means the mailbox is unbounded.
+		size_t                capacity;
+		MailboxOverflowPolicy policy;
+		size_t                delivered;
+		size_t                received;
+		// Held by anything reading or changing the queue, its bounds or its counters.
+		std::mutex            lock;
+
+		// Scheduler bookkeeping for the object owning this mailbox.
+		std::atomic<bool>     scheduled;
+		std::atomic<bool>     throttled;
+		// Set from the time a message is taken out until whatever handles it returns, along
+		// with the future the reply goes to. Only whoever set it touches the reply.
+		std::atomic<bool>     busy;
+		Future*               reply;
+
+		bool full() { return capacity != 0 && delivered - received >= capacity; }
+
 		void trim_to(Node* upto)
 		{
 			while(first != upto)
@@ -60,10 +99,21 @@ namespace Caribou
 			}
 		}
 
+		// Dropping the oldest message moves the divider, which is normally the receiving
+		// side's job. The lock must be held.
+		void drop_oldest()
+		{
+			if(divider != last)
+			{
+				divider = divider->next;
+				received++;
+			}
+		}
+
 	public:
-		Mailbox()
+		Mailbox() : capacity(0), policy(kMailboxOverflowBlock), delivered(0), received(0), scheduled(false), throttled(false), busy(false), reply(nullptr)
 		{
-			first = divider = last = nullptr;
+			first = divider = last = new Node(nullptr);
 		}
 
 		~Mailbox()
@@ -71,20 +121,82 @@ namespace Caribou
 			trim_to(nullptr);
 		}
 
-		void deliver(Message* msg, Object* sender)
+		void set_capacity(size_t cap, MailboxOverflowPolicy p = kMailboxOverflowBlock)
 		{
-			last->next = new Node(msg, sender);
+			std::lock_guard<std::mutex> guard(lock);
+			capacity = cap;
+			policy   = p;
+		}
+
+		size_t get_capacity() { std::lock_guard<std::mutex> guard(lock); return capacity; }
+		MailboxOverflowPolicy get_policy() { std::lock_guard<std::mutex> guard(lock); return policy; }
+
+		size_t size() { std::lock_guard<std::mutex> guard(lock); return delivered - received; }
+		bool is_empty() { std::lock_guard<std::mutex> guard(lock); return divider == last; }
+		bool is_bounded() { std::lock_guard<std::mutex> guard(lock); return capacity != 0; }
+		bool is_full() { std::lock_guard<std::mutex> guard(lock); return full(); }
+
+		// Marks the mailbox as scheduled, returning false if it already was.
+		bool schedule() { return !scheduled.exchange(true); }
+		bool is_scheduled() { return scheduled; }
+		void set_scheduled(bool value) { scheduled = value; }
+		bool is_throttled() { return throttled; }
+		void set_throttled(bool value) { throttled = value; }
+
+		// An actor handles one message at a time. Marks it as busy with one, returning false
+		// if it already was.
+		bool claim() { return !busy.exchange(true); }
+		bool is_busy() { return busy; }
+		void set_reply(Future* f) { reply = f; }
+
+		// Marks the actor as done with its message, handing back the future its reply goes to.
+		Future* release()
+		{
+			Future* f = reply;
+			reply = nullptr;
+			busy = false;
+			return f;
+		}
+
+		MailboxStatus deliver(Message* msg, Object* sender, Future* reply = nullptr)
+		{
+			std::lock_guard<std::mutex> guard(lock);
+			MailboxStatus status = kMailboxDelivered;
+
+			if(full())
+			{
+				switch(policy)
+				{
+					case kMailboxOverflowBlock:
+						return kMailboxWouldBlock;
+					case kMailboxOverflowFail:
+						return kMailboxRejected;
+					case kMailboxOverflowDropOldest:
+						drop_oldest();
+						status = kMailboxDroppedOldest;
+						break;
+				}
+			}
+
+			last->next = new Node(msg, sender, reply);
+			last = last->next;
+			delivered++;
 			trim_to(divider);
+
+			return status;
 		}
 
-		bool receive(Message* result)
+		bool receive(Message*& msg, Object*& sender, Future*& reply)
 		{
-			if(first == last)
-				first = divider = last = new Node(result);
+			std::lock_guard<std::mutex> guard(lock);
 
 			if(divider != last)
 			{
-				result = divider->next->message;
+				msg    = divider->next->message;
+				sender = divider->next->sender;
+				reply  = divider->next->reply;
+				divider = divider->next;
+				received++;
 				return true;
 			}
 			return false;
@@ -22,21 +22,141 @@
  */
 
 #include <iostream>
+#include <vector>
+#include <thread>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
 #include "input_reader.hpp"
+#include "image.hpp"
 #include "machine.hpp"
+#include "verifier.hpp"
+#include "continuation.hpp"
+#include "coroutine.hpp"
+#include "snapshot.hpp"
+#include "linker.hpp"
+#include "image_cache.hpp"
 
 using namespace Caribou;
 
+static void execute(Machine& m)
+{
+	try
+	{
+		m.execute();
+	}
+	catch(const InvalidBytecodeError& e)
+	{
+		std::cerr << e.message() << std::endl;
+	}
+	catch(const DeadContinuationError& e)
+	{
+		std::cerr << e.message() << std::endl;
+	}
+	catch(const CoroutineError& e)
+	{
+		std::cerr << e.message() << std::endl;
+	}
+	catch(const SnapshotError& e)
+	{
+		std::cerr << e.message() << std::endl;
+	}
+	catch(const LinkError& e)
+	{
+		std::cerr << e.message() << std::endl;
+	}
+}
+
+static void run(Image* image)
+{
+	Machine m(image);
+	execute(m);
+}
+
 int main(int argc, char* argv[])
 {
-	Machine m;
-	InputReader reader = InputReader(m);
+	Image image;
+	ImageAccess access = kImageAccessNormal;
+	const char* snapshot = nullptr;
+	const char* cache = nullptr;
+	size_t cores = 1;
+	bool native = false;
+	int ch;
+
+	while((ch = getopt(argc, argv, "c:a:w:C:n")) != -1)
+	{
+		switch(ch)
+		{
+			case 'c':
+				cores = strtoul(optarg, NULL, 10);
+				break;
+			case 'a':
+				if(strcmp(optarg, "sequential") == 0)
+					access = kImageAccessSequential;
+				else if(strcmp(optarg, "random") == 0)
+					access = kImageAccessRandom;
+				break;
+			case 'w':
+				snapshot = optarg;
+				break;
+			case 'C':
+				cache = optarg;
+				break;
+			case 'n':
+				native = true;
+				break;
+			default:
+				std::cout << "Usage: " << argv[0] << " [-c cores] [-a sequential|random] [-w snapshot] [-C cache] [-n] filename [module ...]" << std::endl;
+				exit(1);
+		}
+	}
 
-	if(argv[1] == NULL)
+	InputReader reader = InputReader(image, access, native);
+	Linker linker(image);
+
+	if(argv[optind] == NULL)
 	{
 		std::cout << "Need a filename." << std::endl;
 		exit(1);
 	}
 
-	reader.load(argv[1]);
+	// Anything after the program is a module for it to import from, and they are all
+	// linked together into the one image.
+	if(argv[optind + 1] == NULL && cache != nullptr)
+		ImageCache(cache).load(image, argv[optind], access, native);
+	else if(argv[optind + 1] == NULL)
+		reader.load(argv[optind]);
+	else
+	{
+		try
+		{
+			for(int i = optind; i < argc; i++)
+				linker.add(argv[i]);
+			linker.link();
+		}
+		catch(const LinkError& e)
+		{
+			std::cerr << e.message() << std::endl;
+			exit(1);
+		}
+	}
+
+	// One machine per virtual core, all running the same image.
+	std::vector<std::thread> threads;
+	for(size_t i = 1; i < cores; i++)
+		threads.push_back(std::thread(run, &image));
+
+	Machine m(&image);
+	execute(m);
+
+	for(auto& t : threads)
+		t.join();
+
+	// The snapshot carries on after the HALT the program stopped at.
+	if(snapshot != nullptr)
+	{
+		uintptr_t stopped = m.get_instruction_pointer();
+		uintptr_t entry = stopped < image.get_instruction_count() ? stopped + 1 : image.get_instruction_count();
+		SnapshotWriter(image).dump(snapshot, entry);
+	}
 }
@@ -0,0 +1,91 @@
+/*
+ * Caribou Virtual Machine
+ * Copyright (c) 2011, Jeremy Tregunna, All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#include <sys/mman.h>
+#include "method_loader.hpp"
+#include "image.hpp"
+#include "gc.hpp"
+#include "string.hpp"
+#include "verifier.hpp"
+#include "vmmethod.hpp"
+
+namespace Caribou
+{
+	Object* MethodStub::resolve()
+	{
+		return loader->resolve(index);
+	}
+
+	const std::string MethodStub::object_name()
+	{
+		return "MethodStub";
+	}
+
+	MethodLoader::MethodLoader(Image& i, const MethodDirectory& d) : image(i), directory(d)
+	{
+		methods.assign(directory.methods.size(), nullptr);
+	}
+
+	bool MethodLoader::valid()
+	{
+		size_t count = image.get_instruction_count();
+
+		for(const MethodEntry& m : directory.methods)
+		{
+			if(m.offset >= count || m.length == 0 || m.length > count - m.offset)
+				return false;
+		}
+		return true;
+	}
+
+	void MethodLoader::install(Object* space)
+	{
+		for(uint32_t i = 0; i < directory.methods.size(); i++)
+			space->add_slot(directory.methods[i].name, new MethodStub(this, i));
+	}
+
+	// Machines may come across the same stub at the same time; only one of them loads the
+	// method. The verifier is only shown the code up to the method's end, so a method which
+	// runs past it isn't verified, and is checked as it runs instead.
+	VMMethod* MethodLoader::resolve(uint32_t index)
+	{
+		std::lock_guard<std::mutex> guard(lock);
+		const MethodEntry& m = directory.methods[index];
+
+		if(methods[index] != nullptr)
+			return methods[index];
+
+		image.advise(MADV_WILLNEED, m.offset, m.length);
+
+		Verifier verifier(image.get_instructions(), m.offset + m.length, image.get_constant_count(), image.get_bytecode_version());
+		MethodFacts facts;
+		verifier.verify(m.offset, facts);
+
+		GarbageCollector* previous = collector;
+		collector = image.get_heap();
+		methods[index] = new VMMethod(new String(m.name), m.offset, m.nargs, facts);
+		collector = previous;
+
+		return methods[index];
+	}
+}
@@ -0,0 +1,81 @@
+/*
+ * Caribou Virtual Machine
+ * Copyright (c) 2011, Jeremy Tregunna, All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef __CARIBOU__METHOD_LOADER_HPP__
+#define __CARIBOU__METHOD_LOADER_HPP__
+
+#include <stdint.h>
+#include <mutex>
+#include <vector>
+#include "object.hpp"
+#include "module.hpp"
+
+namespace Caribou
+{
+	class Image;
+	class MethodLoader;
+	class VMMethod;
+
+	// Stands in for a method in an image's directory until somebody looks it up.
+	class MethodStub : public Stub
+	{
+	public:
+		MethodStub(MethodLoader* l, uint32_t i) : loader(l), index(i) {}
+
+		Object* resolve();
+
+		virtual const std::string object_name();
+
+	private:
+		MethodLoader* loader;
+		uint32_t      index;
+	};
+
+	/* Loads the methods in an image's directory one at a time, the first time each one is
+	   called. All there is of a method up front is a stub, in the slot of the object space
+	   named after it. The first lookup to come across the stub has the method's code paged
+	   in and verified, and its VMMethod made on the image's heap. Code which is never
+	   called is never read. */
+	class MethodLoader
+	{
+	public:
+		MethodLoader(Image& image, const MethodDirectory& directory);
+
+		// Whether every method in the directory lies within the image's code.
+		bool valid();
+
+		// Puts a stub for each method into the object space.
+		void install(Object* space);
+
+		// The method a stub stands for, loaded if it hasn't been yet.
+		VMMethod* resolve(uint32_t index);
+
+	private:
+		Image&                 image;
+		MethodDirectory        directory;
+		std::vector<VMMethod*> methods;
+		std::mutex             lock;
+	};
+}
+
+#endif /* !__CARIBOU__METHOD_LOADER_HPP__ */
@@ -0,0 +1,210 @@
+/*
+ * Caribou Virtual Machine
+ * Copyright (c) 2011, Jeremy Tregunna, All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#include <string.h>
+#include "module.hpp"
+#include "endian.hpp"
+
+namespace Caribou
+{
+	// Reads the tables field by field, keeping track of whether anything ran off the end.
+	struct ModuleCursor
+	{
+		const uint8_t* bytes;
+		size_t         length;
+		size_t         offset;
+		bool           valid;
+
+		ModuleCursor(const uint8_t* b, size_t l) : bytes(b), length(l), offset(0), valid(true) {}
+
+		const uint8_t* take(size_t n)
+		{
+			static const uint8_t empty[8] = { 0 };
+
+			if(!valid || offset > length || n > length - offset)
+			{
+				valid = false;
+				return empty;
+			}
+
+			const uint8_t* p = bytes + offset;
+			offset += n;
+			return p;
+		}
+
+		uint32_t u32() { return read_uint32(take(4)); }
+		uint64_t u64() { return read_uint64(take(8)); }
+
+		std::string text()
+		{
+			uint32_t n = u32();
+			const uint8_t* p = take(n);
+			return valid ? std::string(reinterpret_cast<const char*>(p), n) : std::string();
+		}
+	};
+
+	static void put32(std::vector<uint8_t>& out, uint32_t value)
+	{
+		for(int shift = 24; shift >= 0; shift -= 8)
+			out.push_back((value >> shift) & 0xff);
+	}
+
+	static void put64(std::vector<uint8_t>& out, uint64_t value)
+	{
+		put32(out, value >> 32);
+		put32(out, value & 0xffffffff);
+	}
+
+	static void put_text(std::vector<uint8_t>& out, const std::string& str)
+	{
+		put32(out, str.size());
+		out.insert(out.end(), str.begin(), str.end());
+	}
+
+	bool ModuleTables::present(const uint8_t* section, size_t length)
+	{
+		static const char magic[] = MODULE_MAGIC_NUMBER;
+
+		return length >= 4 && memcmp(section, magic, 4) == 0;
+	}
+
+	bool ModuleTables::parse(const uint8_t* section, size_t length, size_t* used)
+	{
+		ModuleCursor cursor(section, length);
+
+		exports.clear();
+		imports.clear();
+
+		if(!present(section, length))
+			return false;
+		cursor.take(4);
+
+		name = cursor.text();
+
+		uint32_t count = cursor.u32();
+		for(uint32_t i = 0; i < count && cursor.valid; i++)
+		{
+			ModuleExport e;
+
+			e.name   = cursor.text();
+			e.nargs  = cursor.u32();
+			e.offset = cursor.u64();
+			exports.push_back(e);
+		}
+
+		count = cursor.u32();
+		for(uint32_t i = 0; i < count && cursor.valid; i++)
+			imports.push_back(cursor.text());
+
+		if(used != nullptr)
+			*used = cursor.offset;
+		return cursor.valid;
+	}
+
+	std::vector<uint8_t> ModuleTables::build() const
+	{
+		static const char magic[] = MODULE_MAGIC_NUMBER;
+		std::vector<uint8_t> out(magic, magic + 4);
+
+		put_text(out, name);
+
+		put32(out, exports.size());
+		for(const ModuleExport& e : exports)
+		{
+			put_text(out, e.name);
+			put32(out, e.nargs);
+			put64(out, e.offset);
+		}
+
+		put32(out, imports.size());
+		for(const std::string& module : imports)
+			put_text(out, module);
+
+		return out;
+	}
+
+	bool MethodDirectory::parse(const uint8_t* section, size_t length)
+	{
+		static const char magic[] = DIRECTORY_MAGIC_NUMBER;
+		size_t used = 0;
+
+		methods.clear();
+
+		// Past the module tables, if there are any.
+		if(ModuleTables::present(section, length) && !ModuleTables().parse(section, length, &used))
+			return false;
+
+		ModuleCursor cursor(section + used, length - used);
+
+		if(length - used < 4 || memcmp(section + used, magic, 4) != 0)
+			return false;
+		cursor.take(4);
+
+		uint32_t count = cursor.u32();
+		for(uint32_t i = 0; i < count && cursor.valid; i++)
+		{
+			MethodEntry m;
+
+			m.name   = cursor.text();
+			m.nargs  = cursor.u32();
+			m.offset = cursor.u64();
+			m.length = cursor.u64();
+			methods.push_back(m);
+		}
+
+		return cursor.valid;
+	}
+
+	std::vector<uint8_t> MethodDirectory::build() const
+	{
+		static const char magic[] = DIRECTORY_MAGIC_NUMBER;
+		std::vector<uint8_t> out(magic, magic + 4);
+
+		put32(out, methods.size());
+		for(const MethodEntry& m : methods)
+		{
+			put_text(out, m.name);
+			put32(out, m.nargs);
+			put64(out, m.offset);
+			put64(out, m.length);
+		}
+
+		return out;
+	}
+
+	bool MethodDirectory::relocate(const std::vector<uintptr_t>& moved, uintptr_t base)
+	{
+		for(MethodEntry& m : methods)
+		{
+			uint64_t end = m.offset + m.length;
+
+			if(end < m.offset || end >= moved.size() || moved[m.offset] == UINTPTR_MAX || moved[end] == UINTPTR_MAX)
+				return false;
+
+			m.length = moved[end] - moved[m.offset];
+			m.offset = base + moved[m.offset];
+		}
+
+		return true;
+	}
+}
@@ -0,0 +1,96 @@
+/*
+ * Caribou Virtual Machine
+ * Copyright (c) 2011, Jeremy Tregunna, All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef __CARIBOU__MODULE_HPP__
+#define __CARIBOU__MODULE_HPP__
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+#define MODULE_MAGIC_NUMBER    { 'C', 'R', 'B', 'M' }
+#define DIRECTORY_MAGIC_NUMBER { 'C', 'R', 'B', 'D' }
+
+namespace Caribou
+{
+	// A method a module makes available to others.
+	struct ModuleExport
+	{
+		std::string name;
+		uint32_t    nargs;
+		// Where the method starts in the module's code.
+		uint64_t    offset;
+	};
+
+	/* What makes an image a module. The tables live in the custom header section, and
+	   start with "CRBM", then the module's name, its exports and the names of the modules
+	   it imports from, each list starting with how many things are in it. Names are a
+	   32-bit length and that many bytes; an export is its name, its 32-bit argument count
+	   and its 64-bit offset. Everything is big-endian, like the constant pool. */
+	class ModuleTables
+	{
+	public:
+		std::string               name;
+		std::vector<ModuleExport> exports;
+		std::vector<std::string>  imports;
+
+		// Returns false if the section isn't a module's, or is malformed. Otherwise, used
+		// is set to how much of the section the tables take up.
+		bool parse(const uint8_t* section, size_t length, size_t* used = nullptr);
+		std::vector<uint8_t> build() const;
+
+		// Whether the section starts with a module's tables.
+		static bool present(const uint8_t* section, size_t length);
+	};
+
+	// A method in an image's directory: the code from offset up to offset + length.
+	struct MethodEntry
+	{
+		std::string name;
+		uint32_t    nargs;
+		uint64_t    offset;
+		uint64_t    length;
+	};
+
+	/* The methods of a program, so each one can be loaded when it is first called instead
+	   of along with everything else. The directory goes in the custom header section, after
+	   the module tables if there are any, and starts with "CRBD" and how many methods there
+	   are; a method is its name, its 32-bit argument count, and its 64-bit offset and
+	   length. */
+	class MethodDirectory
+	{
+	public:
+		std::vector<MethodEntry> methods;
+
+		// Returns false if the section has no directory in it, or it is malformed.
+		bool parse(const uint8_t* section, size_t length);
+		std::vector<uint8_t> build() const;
+
+		// Moves every method along with the code, given where each offset of the code went
+		// as compact_instructions or expand_instructions hand back, and then on by base.
+		// Returns false if a method doesn't start and end on an instruction.
+		bool relocate(const std::vector<uintptr_t>& moved, uintptr_t base);
+	};
+}
+
+#endif /* !__CARIBOU__MODULE_HPP__ */
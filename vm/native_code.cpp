@@ -0,0 +1,105 @@
+/*
+ * Caribou Virtual Machine
+ * Copyright (c) 2011, Jeremy Tregunna, All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <stdio.h>
+#include <dlfcn.h>
+#include <string.h>
+#include <unistd.h>
+#include "native_code.hpp"
+#include "image.hpp"
+#include "fnv.hpp"
+
+namespace Caribou
+{
+	NativeCode::~NativeCode()
+	{
+		dlclose(handle);
+	}
+
+	uint64_t NativeCode::fingerprint(Image& image)
+	{
+		uint8_t version = image.get_bytecode_version();
+		uint64_t hash = fnv1a(kFNVOffsetBasis, &version, 1);
+
+		return fnv1a(hash, image.get_instructions(), image.get_instruction_count());
+	}
+
+	std::string NativeCode::stamp(uint64_t fingerprint)
+	{
+		char text[32];
+
+		snprintf(text, sizeof(text), "CRBN%016llx", (unsigned long long)fingerprint);
+		return text;
+	}
+
+	NativeCode* NativeCode::open(const char* path, Image& image)
+	{
+		if(access(path, R_OK) != 0)
+			return nullptr;
+
+		// Loading a shared object runs its constructors, so it has to be known to be the
+		// one compiled for this image before then.
+		std::ifstream in(path, std::ios::binary);
+		std::ostringstream contents;
+		contents << in.rdbuf();
+		if(contents.str().find(stamp(fingerprint(image))) == std::string::npos)
+		{
+			std::cerr << "Native code in " << path << " doesn't match the image; interpreting it." << std::endl;
+			return nullptr;
+		}
+
+		// Without a slash, dlopen would go looking through the library path instead.
+		std::string file = strchr(path, '/') != nullptr ? path : std::string("./") + path;
+		void* handle = dlopen(file.c_str(), RTLD_NOW | RTLD_LOCAL);
+		if(handle == nullptr)
+		{
+			std::cerr << "Can't load native code: " << dlerror() << std::endl;
+			return nullptr;
+		}
+
+		const uint64_t* compiled = static_cast<const uint64_t*>(dlsym(handle, "caribou_native_fingerprint"));
+		const NativeEntry* entries = static_cast<const NativeEntry*>(dlsym(handle, "caribou_native_entries"));
+		const size_t* count = static_cast<const size_t*>(dlsym(handle, "caribou_native_entry_count"));
+
+		if(compiled == nullptr || entries == nullptr || count == nullptr || *compiled != fingerprint(image))
+		{
+			std::cerr << "Native code in " << path << " doesn't match the image; interpreting it." << std::endl;
+			dlclose(handle);
+			return nullptr;
+		}
+
+		NativeCode* code = new NativeCode(handle);
+		code->table.assign(image.get_instruction_count(), nullptr);
+		for(size_t i = 0; i < *count; i++)
+		{
+			if(entries[i].offset < code->table.size())
+				code->table[entries[i].offset] = entries[i].function;
+		}
+
+		return code;
+	}
+}
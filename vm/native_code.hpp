@@ -0,0 +1,99 @@
+/*
+ * Caribou Virtual Machine
+ * Copyright (c) 2011, Jeremy Tregunna, All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef __CARIBOU__NATIVE_CODE_HPP__
+#define __CARIBOU__NATIVE_CODE_HPP__
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string>
+#include <vector>
+
+namespace Caribou
+{
+	class Machine;
+	class Object;
+	class Image;
+
+	// Runs verified code natively from wherever the machine's ip is, with the registers of
+	// the current context, for as long as it can. Leaves ip on the instruction the
+	// interpreter is to carry on from.
+	typedef void (*NativeFunction)(Machine*, Object**);
+
+	// An instruction a native object can start running from.
+	struct NativeEntry
+	{
+		uint64_t       offset;
+		NativeFunction function;
+	};
+}
+
+// What caot writes out, and what a native object has to define: the fingerprint of the
+// code it was compiled from, the same again as text that can be found in the file
+// without loading it, and where it can start running that code.
+extern "C"
+{
+	extern const uint64_t             caribou_native_fingerprint;
+	extern const char                 caribou_native_stamp[];
+	extern const Caribou::NativeEntry caribou_native_entries[];
+	extern const size_t               caribou_native_entry_count;
+}
+
+namespace Caribou
+{
+	/* An image compiled ahead of time: a shared object made from the C++ caot writes for
+	   the image. Each of its functions runs the instructions of a method by calling the
+	   same handlers the interpreter does, until it gets to one it leaves to the
+	   interpreter. The machine goes native whenever it gets to an instruction there is an
+	   entry for, in a method which is verified. */
+	class NativeCode
+	{
+	public:
+		~NativeCode();
+
+		// What the native code of an image has to have been compiled from: its
+		// instructions, and how they are encoded. The constants aren't part of it, as
+		// they are only ever looked up when the code runs.
+		static uint64_t fingerprint(Image& image);
+
+		// The text a shared object compiled from code with this fingerprint holds.
+		static std::string stamp(uint64_t fingerprint);
+
+		// Opens the shared object at path, if there is one and it was compiled from the
+		// image. Returns nullptr otherwise, for the image to be interpreted. The file is
+		// searched for the image's stamp first, so that nothing in a shared object made
+		// for some other image, or not by caot at all, runs.
+		static NativeCode* open(const char* path, Image& image);
+
+		// The function to run for each offset into the instructions, or nullptr.
+		const NativeFunction* get_table() { return table.data(); }
+
+	private:
+		NativeCode(void* h) : handle(h) {}
+
+		void*                       handle;
+		std::vector<NativeFunction> table;
+	};
+}
+
+#endif /* !__CARIBOU__NATIVE_CODE_HPP__ */
@@ -31,7 +31,7 @@
 
 namespace Caribou
 {
-	Object::Object() : mailbox(new Mailbox()), slots(), traits()
+	Object::Object() : actor(false), mailbox(new Mailbox()), slots(), traits(), stub(false)
 	{
 		collector->add_value(dynamic_cast<GCMarker*>(this));
 	}
@@ -101,20 +101,37 @@ namespace Caribou
 	void Object::receive(Context* ctx)
 	{
 		Message* msg = nullptr;
-		if(mailbox->receive(msg))
+		Object* sender = nullptr;
+		Future* reply = nullptr;
+		if(mailbox->receive(msg, sender, reply))
 		{
 			Object* slot_context;
 			lookup(msg->get_name(), slot_context);
 		}
 	}
 
+	// Slots and traits are shared by every machine running the image, so any number of them
+	// may come across the same stub at once. Each puts what it resolved in the stub's place
+	// only if the stub is still there; whoever loses takes what the winner put there instead.
+	static Object* unstub(Object*& place)
+	{
+		Object* seen = __atomic_load_n(&place, __ATOMIC_ACQUIRE);
+		if(!seen->is_stub())
+			return seen;
+
+		Object* value = static_cast<Stub*>(seen)->resolve();
+		if(__atomic_compare_exchange_n(&place, &seen, value, false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
+			return value;
+		return seen;
+	}
+
 	bool Object::local_lookup(const std::string str, Object*& value, Object*& slot_context)
 	{
 		SlotTable::iterator it = slots.find(str);
 		if(it != slots.end())
 		{
 			slot_context = this;
-			value = it->second;
+			value = unstub(it->second);
 			return true;
 		}
 		return false;
@@ -127,9 +144,9 @@ namespace Caribou
 		if(local_lookup(str, value, slot_context))
 			return value;
 
-		for(auto t : traits)
+		for(auto& t : traits)
 		{
-			if(t->local_lookup(str, value, slot_context))
+			if(unstub(t)->local_lookup(str, value, slot_context))
 				return value;
 		}
 
@@ -49,12 +49,21 @@ namespace Caribou
 
 		bool                 activatable;
 
+		// Actors process their messages in turn from their mailbox. Everything else is a
+		// passive object, which messages are sent to by calling straight into the method.
+		bool                 actor;
+
 		// The slot table is our local container to hold slot definitions.
 		SlotTable            slots;
 
 		// Our traits list contains other composable objects of behaviour and state.
 		std::vector<Object*> traits;
 
+	protected:
+		// Stands in for an object which hasn't been loaded yet. Slots and traits holding
+		// one are replaced with the real object the first time a lookup comes across them.
+		bool                 stub;
+
 	public:
 		Object();
 		~Object();
@@ -84,8 +93,12 @@ namespace Caribou
 		Object* activate(Object*, Object*, Message*, Object*);
 		bool is_activatable() { return activatable; }
 		void set_activatable(bool value) { activatable = value; }
+		bool is_actor() { return actor; }
+		void set_actor(bool value) { actor = value; }
 
 		SlotTable& slot_table() { return slots; }
+		std::vector<Object*>& trait_list() { return traits; }
+		bool is_stub() { return stub; }
 
 		virtual int compare(Object*);
 
@@ -106,6 +119,15 @@ namespace Caribou
 		bool implements(const std::string&, Object*& obj);
 	};
 
+	// Stands in for an object until somebody looks it up, and makes it then.
+	class Stub : public Object
+	{
+	public:
+		Stub() { stub = true; }
+
+		virtual Object* resolve() = 0;
+	};
+
 	class SlotExistsError
 	{
 	private:
@@ -32,8 +32,11 @@
 
 namespace Caribou
 {
-	ObjectSpace::ObjectSpace()
+	ObjectSpace::ObjectSpace(bool populate)
 	{
+		if(!populate)
+			return;
+
 		Object* lobby = new Object();
 		lobby->add_slot("ObjectSpace", static_cast<Object*>(this));
 		add_slot("Lobby", lobby);
@@ -31,7 +31,9 @@ namespace Caribou
 	class ObjectSpace : public Object
 	{
 	public:
-		ObjectSpace();
+		// Unless populate is false, which leaves it empty for a snapshot to fill in, the
+		// object space starts out with the core prototypes.
+		explicit ObjectSpace(bool populate = true);
 
 		virtual const std::string object_name();
 	};
@@ -28,24 +28,107 @@
 #include "output_writer.hpp"
 #include "endian.hpp"
 #include "bytecode.hpp"
+#include "instructions.hpp"
+#include "image.hpp"
 
 namespace Caribou
 {
 	void OutputWriter::dump(const char* filename, const uint8_t* bytes, size_t length)
 	{
-		// I know we don't need to endian_swap on the constants_size here, but
-		// we do it so in the future when we make use of this space, we don't
-		// forget to do it.
-		uint8_t  release_id = 1;
-		uint32_t custom_size = 0;
+		dump(filename, std::vector<uint8_t>(), bytes, length);
+	}
+
+	void OutputWriter::dump(const char* filename, const std::vector<uint8_t>& pool, const uint8_t* bytes, size_t length)
+	{
+		std::vector<uint8_t> compacted;
+		uint8_t release_id = compact(bytes, length, compacted, nullptr);
+
+		write(filename, release_id, pool, std::vector<uint8_t>(), bytes, length);
+	}
+
+	void OutputWriter::dump(const char* filename, const std::vector<uint8_t>& pool, const ModuleTables& tables, const uint8_t* bytes, size_t length)
+	{
+		dump(filename, pool, &tables, MethodDirectory(), bytes, length);
+	}
+
+	void OutputWriter::dump(const char* filename, const std::vector<uint8_t>& pool, const ModuleTables* tables, const MethodDirectory& directory, const uint8_t* bytes, size_t length)
+	{
+		std::vector<uint8_t> compacted;
+		std::vector<uint8_t> custom;
+		std::vector<uintptr_t> moved;
+		MethodDirectory methods = directory;
+		uint8_t release_id = compact(bytes, length, compacted, &moved);
+
+		if(tables != nullptr)
+		{
+			ModuleTables module = *tables;
+
+			if(release_id == kBytecodeCompact)
+			{
+				for(ModuleExport& e : module.exports)
+					e.offset = e.offset < moved.size() ? moved[e.offset] : UINTPTR_MAX;
+			}
+			custom = module.build();
+		}
+
+		if(!methods.methods.empty())
+		{
+			if(release_id == kBytecodeCompact && !methods.relocate(moved, 0))
+				std::cerr << "Methods don't line up with the instructions, leaving the directory out." << std::endl;
+			else
+			{
+				std::vector<uint8_t> section = methods.build();
+				custom.insert(custom.end(), section.begin(), section.end());
+			}
+		}
+
+		write(filename, release_id, pool, custom, bytes, length);
+	}
+
+	void OutputWriter::dump(const char* filename, Image& image, const std::vector<uint8_t>& custom)
+	{
+		ConstantPool& pool = image.get_constant_pool();
+		std::vector<uint8_t> section(pool.data(), pool.data() + pool.data_size());
+
+		write(filename, image.get_bytecode_version(), section, custom, image.get_instructions(), image.get_instruction_count());
+	}
+
+	// Compacts the instructions if that was asked for, pointing bytes at the result, and
+	// hands back the version they are in.
+	uint8_t OutputWriter::compact(const uint8_t*& bytes, size_t& length, std::vector<uint8_t>& compacted, std::vector<uintptr_t>* moved)
+	{
+		if(version != kBytecodeCompact)
+			return kBytecodeFixed;
+
+		if(!compact_instructions(bytes, length, compacted, moved))
+		{
+			std::cerr << "Unable to compact instructions, writing them as they are." << std::endl;
+			return kBytecodeFixed;
+		}
+
+		bytes  = compacted.data();
+		length = compacted.size();
+		return kBytecodeCompact;
+	}
+
+	void OutputWriter::write(const char* filename, uint8_t release_id, const std::vector<uint8_t>& pool, const std::vector<uint8_t>& custom, const uint8_t* bytes, size_t length)
+	{
+		uint32_t pool_size = pool.size();
+		uint32_t custom_size = custom.size();
 
+		// Sizes in the header are little-endian.
 		if(big_endian())
+		{
+			endian_swap(pool_size);
 			endian_swap(custom_size);
+		}
 
-		BytecodeHeader header = (BytecodeHeader){ HEADER_MAGIC_NUMBER, release_id, custom_size };
+		BytecodeHeader header = (BytecodeHeader){ HEADER_MAGIC_NUMBER, release_id, pool_size, custom_size };
 		std::ofstream output_file(filename, std::ios::binary);
 
 		output_file.write((char*)&header, sizeof(header));
+		output_file.write((const char*)pool.data(), pool.size());
+		output_file.write((const char*)custom.data(), custom.size());
 		output_file.write((char*)bytes, length);
 		output_file.close();
 	}
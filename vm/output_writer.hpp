@@ -26,15 +26,40 @@
 
 #include <iostream>
 #include <fstream>
+#include <vector>
+#include <stdint.h>
+#include "bytecode.hpp"
+#include "module.hpp"
 
 namespace Caribou
 {
+	class Image;
+
 	class OutputWriter
 	{
 	public:
-		OutputWriter() {}
+		// Instructions are handed over as fixed bytecode, and written out compacted when
+		// version asks for it.
+		OutputWriter(uint8_t version = kBytecodeFixed) : version(version) {}
 
 		void dump(const char* filename, const uint8_t* bytes, size_t length);
+		// The same, with a constant pool section put together by a ConstantPoolBuilder.
+		void dump(const char* filename, const std::vector<uint8_t>& pool, const uint8_t* bytes, size_t length);
+		// The same, for a module, with its tables in the custom header. Export offsets are
+		// into bytes, and move along with the instructions if they're compacted.
+		void dump(const char* filename, const std::vector<uint8_t>& pool, const ModuleTables& tables, const uint8_t* bytes, size_t length);
+		// The same, with a directory of the methods in bytes, and the tables of a module if
+		// tables isn't null. The methods move along with the instructions as well.
+		void dump(const char* filename, const std::vector<uint8_t>& pool, const ModuleTables* tables, const MethodDirectory& directory, const uint8_t* bytes, size_t length);
+		// Writes a loaded image back out as it is, whatever encoding its instructions are
+		// in, with custom as its custom header.
+		void dump(const char* filename, Image& image, const std::vector<uint8_t>& custom);
+
+	private:
+		uint8_t compact(const uint8_t*& bytes, size_t& length, std::vector<uint8_t>& compacted, std::vector<uintptr_t>* moved);
+		void write(const char* filename, uint8_t release_id, const std::vector<uint8_t>& pool, const std::vector<uint8_t>& custom, const uint8_t* bytes, size_t length);
+
+		uint8_t version;
 	};
 }
 
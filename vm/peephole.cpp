@@ -0,0 +1,384 @@
+/*
+ * Caribou Virtual Machine
+ * Copyright (c) 2011, Jeremy Tregunna, All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#include <string.h>
+#include <map>
+#include <set>
+#include "peephole.hpp"
+#include "instructions.hpp"
+
+namespace Caribou
+{
+	void PeepholeOptimizer::run()
+	{
+		bool changed = true;
+
+		while(changed)
+		{
+			changed = thread_jumps();
+			changed |= remove_dead_code();
+			changed |= remove_moves();
+			changed |= remove_swaps();
+			changed |= fold_constants();
+		}
+	}
+
+	bool PeepholeOptimizer::pinned(size_t i)
+	{
+		return i > 0 && (instruction_info(program.code[i - 1].opcode).flags & kInsnSkip);
+	}
+
+	// Anything jumping to the instruction goes to the one after it instead.
+	bool PeepholeOptimizer::remove(size_t i)
+	{
+		std::vector<AsmInstruction>& code = program.code;
+
+		if(!code[i].labels.empty())
+		{
+			if(i + 1 >= code.size())
+				return false;
+			code[i + 1].labels.insert(code[i + 1].labels.begin(), code[i].labels.begin(), code[i].labels.end());
+		}
+		code.erase(code.begin() + i);
+		return true;
+	}
+
+	bool PeepholeOptimizer::thread_jumps()
+	{
+		std::vector<AsmInstruction>& code = program.code;
+		std::map<std::string, size_t> labels;
+		bool changed = false;
+
+		for(size_t i = 0; i < code.size(); i++)
+		{
+			for(const std::string& label : code[i].labels)
+				labels[label] = i;
+		}
+
+		for(size_t i = 0; i < code.size(); i++)
+		{
+			if(code[i].opcode != Instructions::JMP)
+				continue;
+
+			// Bounded by the length of the code, in case the jumps go round in a circle.
+			std::string target = code[i].target;
+			for(size_t hops = 0; hops < code.size(); hops++)
+			{
+				auto it = labels.find(target);
+				if(it == labels.end() || code[it->second].opcode != Instructions::JMP)
+					break;
+				target = code[it->second].target;
+			}
+
+			if(target != code[i].target)
+			{
+				code[i].target = target;
+				changed = true;
+			}
+
+			auto it = labels.find(target);
+			if(it != labels.end() && it->second == i + 1 && !pinned(i) && remove(i))
+				return true;
+		}
+
+		return changed;
+	}
+
+	// Labels nothing goes to are dropped, so what follows one can be looked at along with
+	// what comes before it. An instruction with no label, after one which never falls
+	// through, can't be reached at all, unless a comparison skips to it.
+	bool PeepholeOptimizer::remove_dead_code()
+	{
+		std::vector<AsmInstruction>& code = program.code;
+		std::set<std::string> used;
+		bool changed = false;
+
+		for(const AsmInstruction& insn : code)
+		{
+			if(instruction_info(insn.opcode).flags & kInsnJump)
+				used.insert(insn.target);
+		}
+		for(const AsmExport& e : program.exports)
+			used.insert(e.label);
+		for(const AsmMethod& m : program.methods)
+		{
+			used.insert(m.label);
+			used.insert(m.end);
+		}
+
+		for(AsmInstruction& insn : code)
+		{
+			for(size_t j = 0; j < insn.labels.size();)
+			{
+				if(used.count(insn.labels[j]) == 0)
+				{
+					insn.labels.erase(insn.labels.begin() + j);
+					changed = true;
+				}
+				else
+					j++;
+			}
+		}
+
+		for(size_t i = 1; i < code.size(); i++)
+		{
+			if((instruction_info(code[i - 1].opcode).flags & kInsnTerminator) && !pinned(i - 1) && code[i].labels.empty())
+			{
+				remove(i);
+				return true;
+			}
+		}
+
+		return changed;
+	}
+
+	bool PeepholeOptimizer::remove_moves()
+	{
+		std::vector<AsmInstruction>& code = program.code;
+
+		for(size_t i = 0; i < code.size(); i++)
+		{
+			const AsmInstruction& insn = code[i];
+
+			if(insn.opcode != Instructions::MOVE || pinned(i))
+				continue;
+
+			uint8_t a = insn.registers[0];
+			uint8_t b = insn.registers[1];
+
+			if(a == b && remove(i))
+				return true;
+
+			if(i + 1 >= code.size())
+				continue;
+
+			const AsmInstruction& next = code[i + 1];
+
+			// MOVE a b; MOVE b a: the second one puts back what is already there, unless it
+			// can be jumped to on its own.
+			if(next.opcode == Instructions::MOVE && next.labels.empty() && next.registers[0] == b && next.registers[1] == a)
+			{
+				remove(i + 1);
+				return true;
+			}
+
+			// a is written again before anything reads it.
+			if((next.opcode == Instructions::LOADI || (next.opcode == Instructions::MOVE && next.registers[1] != a)) && next.registers[0] == a && remove(i))
+				return true;
+		}
+
+		return false;
+	}
+
+	bool PeepholeOptimizer::remove_swaps()
+	{
+		std::vector<AsmInstruction>& code = program.code;
+
+		for(size_t i = 0; i + 1 < code.size(); i++)
+		{
+			const AsmInstruction& insn = code[i];
+			const AsmInstruction& next = code[i + 1];
+
+			if(next.opcode != Instructions::SWAP || !next.labels.empty() || pinned(i + 1))
+				continue;
+
+			if(insn.opcode == Instructions::DUP)
+			{
+				remove(i + 1);
+				return true;
+			}
+
+			if(insn.opcode == Instructions::SWAP && !pinned(i) && (insn.labels.empty() || i + 2 < code.size()))
+			{
+				remove(i + 1);
+				remove(i);
+				return true;
+			}
+		}
+
+		return false;
+	}
+
+	// Worked out the way the machine would, wrapping around on overflow. Division by zero
+	// and overflowing division are left for the machine to trip over.
+	static bool evaluate(uint8_t opcode, intptr_t x, intptr_t y, intptr_t& result)
+	{
+		switch(opcode)
+		{
+			case Instructions::ADD:
+				result = (intptr_t)((uintptr_t)x + (uintptr_t)y);
+				return true;
+			case Instructions::SUB:
+				result = (intptr_t)((uintptr_t)x - (uintptr_t)y);
+				return true;
+			case Instructions::MUL:
+				result = (intptr_t)((uintptr_t)x * (uintptr_t)y);
+				return true;
+			case Instructions::DIV:
+			case Instructions::MOD:
+				if(y == 0 || (x == INTPTR_MIN && y == -1))
+					return false;
+				result = opcode == Instructions::DIV ? x / y : x % y;
+				return true;
+			case Instructions::POW:
+				result = x ^ y;
+				return true;
+			case Instructions::NOT:
+				result = ~x;
+				return true;
+		}
+		return false;
+	}
+
+	// Whether what instruction i leaves in its register is only ever read by arithmetic,
+	// which only looks at the integer in it. Anything else could tell a constant from the
+	// pool apart from a new integer with the same value, since comparisons go by identity.
+	// Only straight-line code is followed; a value still there where it ends, other than
+	// at a RET, is taken to be used.
+	bool PeepholeOptimizer::only_arithmetic_reads(size_t i)
+	{
+		std::vector<AsmInstruction>& code = program.code;
+		uint32_t live = 1 << code[i].registers[0];
+
+		for(size_t j = i + 1; j < code.size() && live != 0; j++)
+		{
+			const AsmInstruction& insn = code[j];
+			const InstructionInfo& info = instruction_info(insn.opcode);
+			uint32_t reads = 0;
+			uint32_t writes = 0;
+
+			if(!insn.labels.empty())
+				return false;
+
+			for(uint8_t r = 0; r < insn.nregs; r++)
+			{
+				if(r == 0 && (info.flags & kInsnDefinesFirst))
+					writes = 1 << insn.registers[0];
+				else
+					reads |= 1 << insn.registers[r];
+			}
+
+			switch(insn.opcode)
+			{
+				case Instructions::ADD:
+				case Instructions::SUB:
+				case Instructions::MUL:
+				case Instructions::DIV:
+				case Instructions::MOD:
+				case Instructions::POW:
+				case Instructions::NOT:
+				case Instructions::LOADI:
+					break;
+				case Instructions::MOVE:
+					if(reads & live)
+					{
+						live |= writes;
+						continue;
+					}
+					break;
+				case Instructions::RET:
+					return true;
+				default:
+					if((reads & live) || insn.opcode >= Instructions::HALT || (info.flags & (kInsnJump | kInsnSkip | kInsnTerminator)))
+						return false;
+					break;
+			}
+
+			live &= ~writes;
+		}
+
+		return live == 0;
+	}
+
+	// Only follows straight-line code: what is known is forgotten at every label, and at
+	// anything which could run other code or go elsewhere.
+	bool PeepholeOptimizer::fold_constants()
+	{
+		std::vector<AsmInstruction>& code = program.code;
+		bool known[16];
+		intptr_t values[16];
+		bool changed = false;
+
+		memset(known, 0, sizeof(known));
+
+		for(size_t i = 0; i < code.size(); i++)
+		{
+			AsmInstruction& insn = code[i];
+			const InstructionInfo& info = instruction_info(insn.opcode);
+			uint8_t a = insn.registers[0];
+			uint8_t b = insn.registers[1];
+
+			if(!insn.labels.empty())
+				memset(known, 0, sizeof(known));
+
+			switch(insn.opcode)
+			{
+				case Instructions::LOADI:
+					known[a] = insn.immediate < program.constants.size() && program.constants[insn.immediate].kind == kConstantInteger;
+					if(known[a])
+						values[a] = program.constants[insn.immediate].value;
+					break;
+				case Instructions::MOVE:
+					known[a]  = known[b];
+					values[a] = values[b];
+					break;
+				case Instructions::ADD:
+				case Instructions::SUB:
+				case Instructions::MUL:
+				case Instructions::DIV:
+				case Instructions::MOD:
+				case Instructions::POW:
+				case Instructions::NOT:
+				{
+					uint8_t c = insn.registers[insn.nregs - 1];
+					intptr_t result;
+
+					if(!known[b] || !known[c] || !evaluate(insn.opcode, values[b], values[c], result))
+					{
+						known[a] = false;
+						break;
+					}
+
+					known[a]  = true;
+					values[a] = result;
+					if(pinned(i) || !only_arithmetic_reads(i))
+						break;
+
+					insn.opcode    = Instructions::LOADI;
+					insn.nregs     = 1;
+					insn.immediate = program.integer_constant(result);
+					changed        = true;
+					break;
+				}
+				default:
+					if(insn.opcode >= Instructions::HALT || (info.flags & kInsnTerminator))
+						memset(known, 0, sizeof(known));
+					else if(info.flags & kInsnDefinesFirst)
+						known[a] = false;
+					break;
+			}
+		}
+
+		return changed;
+	}
+}
@@ -0,0 +1,66 @@
+/*
+ * Caribou Virtual Machine
+ * Copyright (c) 2011, Jeremy Tregunna, All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef __CARIBOU__PEEPHOLE_HPP__
+#define __CARIBOU__PEEPHOLE_HPP__
+
+#include <stdint.h>
+#include "assembler.hpp"
+
+namespace Caribou
+{
+	/* Rewrites a program before it is laid out, until there is nothing left to rewrite:
+	   jumps to jumps go straight to where the last one goes, jumps to the next instruction
+	   go away, and so does code nothing can reach; moves which do nothing, or whose result
+	   is written over before it is read, go away, as do SWAPs undoing a SWAP or a DUP;
+	   and arithmetic on registers known to hold integer constants becomes a LOADI of the
+	   result, where nothing but more arithmetic reads it. A SEND right before a RET is left as it is: RET returns the top of the
+	   stack, not what the SEND left in the return register, so a TAILSEND would change
+	   what the method returns.
+
+	   The only ways into the code are taken to be its start, its exports, its methods and
+	   its jumps. The instruction after a comparison is left alone, since a failed
+	   comparison skips over it by its length. */
+	class PeepholeOptimizer
+	{
+	public:
+		PeepholeOptimizer(AsmProgram& program) : program(program) {}
+
+		void run();
+
+	private:
+		bool thread_jumps();
+		bool remove_dead_code();
+		bool remove_moves();
+		bool remove_swaps();
+		bool fold_constants();
+		bool only_arithmetic_reads(size_t i);
+
+		bool pinned(size_t i);
+		bool remove(size_t i);
+
+		AsmProgram& program;
+	};
+}
+
+#endif /* !__CARIBOU__PEEPHOLE_HPP__ */
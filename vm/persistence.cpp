@@ -0,0 +1,414 @@
+/*
+ * Caribou Virtual Machine
+ * Copyright (c) 2011, Jeremy Tregunna, All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#include <string.h>
+#include <algorithm>
+#include <unordered_map>
+#include "persistence.hpp"
+#include "machine.hpp"
+#include "continuation.hpp"
+
+namespace Caribou
+{
+	// The first revision is the stack as it was when recording started.
+	void RevisionLog::start()
+	{
+		Revision root;
+		root.parent     = 0;
+		root.depth      = 0;
+		root.checkpoint = 0;
+		root.frame      = 0;
+		root.kind       = kRevisionRoot;
+		root.ip         = 0;
+		log.push_back(root);
+		head = 0;
+		recording = true;
+		adopt();
+	}
+
+	// Whatever is on the return stack now is recorded from here on, and is what any
+	// revisions after this one are replayed on top of.
+	void RevisionLog::adopt()
+	{
+		for(Context* ctx : machine->get_return_stack().get_store())
+			ctx->log = this;
+		checkpoint();
+	}
+
+	// Forgets the whole log. Frames left from here on go back to the pool.
+	void RevisionLog::stop()
+	{
+		for(PersistentContinuation* p : marks)
+			p->invalidate();
+		marks.clear();
+		log.clear();
+		checkpoints.clear();
+		head = 0;
+		recording = false;
+
+		for(Context* ctx : machine->get_return_stack().get_store())
+			ctx->log = nullptr;
+		for(Context* ctx : machine->get_main_stack().get_store())
+			ctx->log = nullptr;
+	}
+
+	void RevisionLog::discontinue()
+	{
+		append(kRevisionRoot, 0)->ip = 0;
+		adopt();
+		tidy();
+	}
+
+	Revision* RevisionLog::append(uint8_t kind, uint32_t frame)
+	{
+		Revision r;
+		r.parent     = head;
+		r.depth      = log[head].depth + 1;
+		r.checkpoint = log[head].checkpoint;
+		r.frame      = frame;
+		r.kind       = kind;
+		log.push_back(r);
+		head = log.size() - 1;
+
+		// The stack is already up to date when a revision is recorded, so this is a good
+		// time to take a picture of it.
+		if(r.depth - log[checkpoints[r.checkpoint].revision].depth >= CARIBOU_CHECKPOINT_INTERVAL)
+			checkpoint();
+
+		return &log[head];
+	}
+
+	void RevisionLog::record_enter(Context* ctx)
+	{
+		if(!recording)
+			return;
+		append(kRevisionEnter, ctx->depth)->context = ctx;
+		tidy();
+	}
+
+	// A frame which has been left is kept as it was, so that rewinding can put it back.
+	void RevisionLog::record_leave(Context* ctx)
+	{
+		if(!recording)
+			return;
+		ctx->frozen = true;
+		append(kRevisionLeave, ctx->depth)->context = ctx;
+		tidy();
+	}
+
+	PersistentContinuation* RevisionLog::mark(uintptr_t ip)
+	{
+		if(!recording)
+			start();
+
+		append(kRevisionMark, 0)->ip = ip;
+		PersistentContinuation* p = new PersistentContinuation(head);
+		marks.push_back(p);
+		return p;
+	}
+
+	uintptr_t RevisionLog::restore(PersistentContinuation* p)
+	{
+		if(!p->is_valid())
+			throw DeadContinuationError("Continuation restored after nothing was found to be holding on to it");
+
+		uint32_t revision = p->get_revision();
+		const Checkpoint& cp = checkpoints[log[revision].checkpoint];
+		uint32_t from = cp.revision;
+		uint32_t replayed = log[revision].depth - log[from].depth;
+		uint32_t lca = common_ancestor(head, revision, replayed);
+
+		if(lca == UINT32_MAX)
+			load(cp);
+		else
+		{
+			for(uint32_t r = head; r != lca; r = log[r].parent)
+				rewind(log[r]);
+			from = lca;
+		}
+
+		std::vector<uint32_t> path;
+		for(uint32_t r = revision; r != from; r = log[r].parent)
+			path.push_back(r);
+		for(auto it = path.rbegin(); it != path.rend(); ++it)
+			replay(log[*it]);
+
+		head = revision;
+		return log[revision].ip;
+	}
+
+	// Where the histories of two revisions meet, or UINT32_MAX if that means going through
+	// more than limit revisions in all, or rewinding past a discontinuity.
+	uint32_t RevisionLog::common_ancestor(uint32_t a, uint32_t b, uint32_t limit)
+	{
+		uint32_t steps = 0;
+
+		while(a != b)
+		{
+			if(++steps > limit)
+				return UINT32_MAX;
+
+			// There is no undoing or redoing a discontinuity, or what came before a revision
+			// whose history has been forgotten.
+			if(log[a].depth >= log[b].depth)
+			{
+				if(log[a].kind == kRevisionRoot || log[a].parent == a)
+					return UINT32_MAX;
+				a = log[a].parent;
+			}
+			else
+			{
+				if(log[b].kind == kRevisionRoot || log[b].parent == b)
+					return UINT32_MAX;
+				b = log[b].parent;
+			}
+		}
+
+		return a;
+	}
+
+	void RevisionLog::rewind(const Revision& r)
+	{
+		Context* ctx;
+
+		switch(r.kind)
+		{
+			case kRevisionPush:
+				machine->get_writable_frame(r.frame)->sp--;
+				break;
+			case kRevisionPop:
+				ctx = machine->get_writable_frame(r.frame);
+				ctx->reserve(ctx->sp + 1);
+				ctx->stk[ctx->sp++] = r.value;
+				break;
+			case kRevisionEnter:
+				machine->get_return_stack().pop();
+				break;
+			case kRevisionLeave:
+				machine->get_return_stack().push(r.context);
+				break;
+		}
+	}
+
+	void RevisionLog::replay(const Revision& r)
+	{
+		Context* ctx;
+
+		switch(r.kind)
+		{
+			case kRevisionPush:
+				ctx = machine->get_writable_frame(r.frame);
+				ctx->reserve(ctx->sp + 1);
+				ctx->stk[ctx->sp++] = r.value;
+				break;
+			case kRevisionPop:
+				machine->get_writable_frame(r.frame)->sp--;
+				break;
+			case kRevisionEnter:
+				// A frame always starts out with an empty stack.
+				machine->get_return_stack().push(r.context);
+				machine->get_writable_frame(r.frame)->sp = 0;
+				break;
+			case kRevisionLeave:
+				machine->get_return_stack().pop();
+				break;
+		}
+	}
+
+	void RevisionLog::checkpoint()
+	{
+		Checkpoint cp;
+
+		cp.revision = head;
+		cp.frames = machine->get_return_stack().get_store();
+		for(Context* ctx : cp.frames)
+		{
+			cp.sizes.push_back(ctx->sp);
+			cp.slots.insert(cp.slots.end(), ctx->stk, ctx->stk + ctx->sp);
+		}
+
+		log[head].checkpoint = checkpoints.size();
+		checkpoints.push_back(cp);
+	}
+
+	void RevisionLog::load(const Checkpoint& cp)
+	{
+		Object* const* slots = cp.slots.data();
+
+		machine->get_return_stack().get_store() = cp.frames;
+		for(size_t i = 0; i < cp.frames.size(); i++)
+		{
+			Context* ctx = machine->get_writable_frame(i);
+			ctx->reserve(cp.sizes[i]);
+			ctx->sp = cp.sizes[i];
+			std::copy(slots, slots + ctx->sp, ctx->stk);
+			slots += ctx->sp;
+		}
+	}
+
+	/* Forgets every revision no continuation can get back to.
+	 *
+	 * A continuation is reachable if a frame on either stack holds it, in a register or on
+	 * its operand stack, or if something the log keeps for a reachable continuation does:
+	 * restoring that would bring it back. The stacks hold numbers as well as objects, so
+	 * what is found there is only ever compared with the continuations the log made, never
+	 * followed. Continuations held anywhere else, like in an array, aren't found, and can't
+	 * be restored after this.
+	 *
+	 * What is kept is the current revision, with a checkpoint of its own, and for each
+	 * reachable continuation the revisions from its checkpoint to it. The rest goes, and
+	 * what is left is renumbered. A revision whose parent has gone can't be rewound past,
+	 * so getting to another revision from it goes through that revision's checkpoint.
+	 */
+	void RevisionLog::collect()
+	{
+		checkpoint();
+
+		std::unordered_map<Object*, PersistentContinuation*> unreached;
+		std::vector<PersistentContinuation*> reached;
+		std::vector<bool> kept(log.size(), false);
+		std::vector<bool> kept_checkpoints(checkpoints.size(), false);
+		std::vector<Object*> found;
+
+		for(PersistentContinuation* p : marks)
+			unreached[p] = p;
+
+		auto look_in = [&](Context* ctx) {
+			found.insert(found.end(), ctx->registers, ctx->registers + CARIBOU_NUM_REGISTERS);
+			found.insert(found.end(), ctx->stk, ctx->stk + ctx->sp);
+		};
+		auto keep = [&](uint32_t r) {
+			if(kept[r])
+				return;
+			kept[r] = true;
+			if(log[r].kind == kRevisionPush || log[r].kind == kRevisionPop)
+				found.push_back(log[r].value);
+			else if(log[r].kind == kRevisionEnter || log[r].kind == kRevisionLeave)
+				look_in(log[r].context);
+		};
+		auto keep_checkpoint = [&](uint32_t c) {
+			if(kept_checkpoints[c])
+				return;
+			kept_checkpoints[c] = true;
+			for(Context* ctx : checkpoints[c].frames)
+				look_in(ctx);
+			found.insert(found.end(), checkpoints[c].slots.begin(), checkpoints[c].slots.end());
+		};
+
+		for(Context* ctx : machine->get_return_stack().get_store())
+			look_in(ctx);
+		for(Context* ctx : machine->get_main_stack().get_store())
+			look_in(ctx);
+
+		keep(head);
+		keep_checkpoint(log[head].checkpoint);
+
+		while(!found.empty())
+		{
+			Object* word = found.back();
+			found.pop_back();
+
+			auto it = unreached.find(word);
+			if(it == unreached.end())
+				continue;
+
+			PersistentContinuation* p = it->second;
+			unreached.erase(it);
+			reached.push_back(p);
+
+			uint32_t r = p->get_revision();
+			uint32_t from = checkpoints[log[r].checkpoint].revision;
+			keep_checkpoint(log[r].checkpoint);
+			for(;; r = log[r].parent)
+			{
+				keep(r);
+				if(r == from)
+					break;
+			}
+		}
+
+		for(auto& entry : unreached)
+			entry.second->invalidate();
+		marks = reached;
+
+		if(marks.empty())
+		{
+			stop();
+			return;
+		}
+
+		std::vector<uint32_t> renumbered(log.size(), UINT32_MAX);
+		std::vector<uint32_t> renumbered_checkpoints(checkpoints.size(), UINT32_MAX);
+		std::vector<Revision> kept_log;
+		std::vector<Checkpoint> kept_cps;
+		// Each revision's depth is counted from the first revision of its history left.
+		std::vector<uint32_t> origin;
+
+		for(uint32_t c = 0; c < checkpoints.size(); c++)
+		{
+			if(!kept_checkpoints[c])
+				continue;
+			renumbered_checkpoints[c] = kept_cps.size();
+			kept_cps.push_back(std::move(checkpoints[c]));
+		}
+
+		for(uint32_t r = 0; r < log.size(); r++)
+		{
+			if(!kept[r])
+				continue;
+
+			Revision rev = log[r];
+			uint32_t index = kept_log.size();
+			renumbered[r] = index;
+
+			if(rev.parent != r && kept[rev.parent])
+			{
+				rev.parent = renumbered[rev.parent];
+				origin.push_back(origin[rev.parent]);
+			}
+			else
+			{
+				rev.parent = index;
+				origin.push_back(rev.depth);
+			}
+			rev.depth -= origin[index];
+			rev.checkpoint = renumbered_checkpoints[rev.checkpoint];
+			kept_log.push_back(rev);
+		}
+
+		for(Checkpoint& cp : kept_cps)
+			cp.revision = renumbered[cp.revision];
+		for(PersistentContinuation* p : marks)
+			p->set_revision(renumbered[p->get_revision()]);
+
+		head = renumbered[head];
+		log.swap(kept_log);
+		checkpoints.swap(kept_cps);
+		collect_at = std::max<size_t>(2 * log.size(), CARIBOU_CHECKPOINT_INTERVAL);
+	}
+
+	const std::string PersistentContinuation::object_name()
+	{
+		return "PersistentContinuation";
+	}
+}
@@ -0,0 +1,173 @@
+/*
+ * Caribou Virtual Machine
+ * Copyright (c) 2011, Jeremy Tregunna, All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef __CARIBOU__PERSISTENCE_HPP__
+#define __CARIBOU__PERSISTENCE_HPP__
+
+#include <vector>
+#include <stdint.h>
+#include "object.hpp"
+
+// How many revisions may go by before the whole stack is checkpointed. This bounds how
+// much has to be replayed to get to any revision.
+#define CARIBOU_CHECKPOINT_INTERVAL 1024
+
+namespace Caribou
+{
+	class Machine;
+	class PersistentContinuation;
+	struct Context;
+
+	enum RevisionKind
+	{
+		// The start of the log, or a point the stack was replaced without going through the
+		// log. Revisions after it can only be reached from its checkpoint.
+		kRevisionRoot = 0,
+		kRevisionPush,
+		kRevisionPop,
+		kRevisionEnter,
+		kRevisionLeave,
+		kRevisionMark
+	};
+
+	// One operation on the stack. Pushes and pops apply to the operand stack of the frame at
+	// the given depth of the return stack; entering and leaving push and pop that frame. Each
+	// revision follows from its parent, so the log forms a tree: resuming an old revision and
+	// carrying on starts a new branch.
+	struct Revision
+	{
+		uint32_t parent;
+		// How far this revision is from the root of the log.
+		uint32_t depth;
+		// The closest checkpoint on the way to the root.
+		uint32_t checkpoint;
+		uint32_t frame;
+		uint8_t  kind;
+		union
+		{
+			Object*   value;
+			Context*  context;
+			uintptr_t ip;
+		};
+	};
+
+	// The whole stack as it was at some revision.
+	struct Checkpoint
+	{
+		uint32_t              revision;
+		std::vector<Context*> frames;
+		std::vector<uint32_t> sizes;
+		std::vector<Object*>  slots;
+	};
+
+	// The log of every operation on the machine's stack, from the first time a continuation
+	// was marked. Getting back to a revision means rewinding the operations between the
+	// current revision and the one we want, up to where their histories meet, and replaying
+	// the rest; or replaying from a checkpoint, if that is shorter.
+	//
+	// Only what the continuations still around can get back to is kept. Every so often,
+	// everything else is forgotten, and once no continuation is left, recording stops.
+	class RevisionLog
+	{
+	public:
+		RevisionLog(Machine* m) : head(0), machine(m), recording(false), collect_at(CARIBOU_CHECKPOINT_INTERVAL) {}
+
+		bool is_recording() { return recording; }
+		// How many revisions are being kept.
+		size_t size() { return log.size(); }
+
+		inline void record_push(uint32_t frame, Object* value)
+		{
+			if(!recording)
+				return;
+			append(kRevisionPush, frame)->value = value;
+			tidy();
+		}
+
+		inline void record_pop(uint32_t frame, Object* value)
+		{
+			if(!recording)
+				return;
+			append(kRevisionPop, frame)->value = value;
+			tidy();
+		}
+
+		void record_enter(Context*);
+		void record_leave(Context*);
+
+		// A continuation for the current revision, to be resumed at ip. Starts recording if
+		// need be.
+		PersistentContinuation* mark(uintptr_t ip);
+
+		// Puts the stack back the way it was at a marked revision, and returns where to resume.
+		uintptr_t restore(PersistentContinuation*);
+
+		// The stack was replaced by something other than the log, like a SAVE continuation.
+		void discontinue();
+
+	private:
+		void start();
+		void stop();
+		void adopt();
+		Revision* append(uint8_t kind, uint32_t frame);
+		uint32_t common_ancestor(uint32_t a, uint32_t b, uint32_t limit);
+		void rewind(const Revision&);
+		void replay(const Revision&);
+		void checkpoint();
+		void load(const Checkpoint&);
+		inline void tidy() { if(log.size() >= collect_at) collect(); }
+		void collect();
+
+		std::vector<Revision>                log;
+		std::vector<Checkpoint>              checkpoints;
+		// Every continuation marked which hasn't been found to be unreachable yet.
+		std::vector<PersistentContinuation*> marks;
+		uint32_t                             head;
+		Machine*                             machine;
+		bool                                 recording;
+		// How big the log may get before the next collection.
+		size_t                               collect_at;
+	};
+
+	// A continuation which is nothing more than a revision in the log. The log renumbers
+	// its revisions as it forgets others, and invalidates the continuation if it finds
+	// nothing referring to it.
+	class PersistentContinuation : public Object
+	{
+	public:
+		PersistentContinuation(uint32_t r) : revision(r), valid(true) {}
+
+		uint32_t get_revision() { return revision; }
+		void set_revision(uint32_t r) { revision = r; }
+		bool is_valid() { return valid; }
+		void invalidate() { valid = false; }
+
+		virtual const std::string object_name();
+
+	private:
+		uint32_t revision;
+		bool     valid;
+	};
+}
+
+#endif /* !__CARIBOU__PERSISTENCE_HPP__ */
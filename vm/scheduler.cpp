@@ -0,0 +1,169 @@
+/*
+ * Caribou Virtual Machine
+ * Copyright (c) 2011, Jeremy Tregunna, All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#include <vector>
+#include <thread>
+#include "scheduler.hpp"
+#include "machine.hpp"
+#include "object.hpp"
+#include "mailbox.hpp"
+#include "nil.hpp"
+
+namespace Caribou
+{
+	Scheduler::Scheduler(Machine* m) : epoch(std::chrono::steady_clock::now()), timers(0), machine(m)
+	{
+	}
+
+	uint64_t Scheduler::now()
+	{
+		return std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - epoch).count();
+	}
+
+	void Scheduler::wake(Object* actor)
+	{
+		Mailbox* mailbox = actor->mailbox;
+
+		if(!mailbox->schedule())
+			return;
+
+		if(mailbox->is_throttled())
+			throttled.push_back(actor);
+		else if(mailbox->is_full())
+			runnable.push_front(actor);
+		else
+			runnable.push_back(actor);
+	}
+
+	void Scheduler::throttle(Object* producer)
+	{
+		if(producer != nullptr)
+			producer->mailbox->set_throttled(true);
+	}
+
+	void Scheduler::relieve(Object* producer)
+	{
+		if(producer != nullptr)
+			producer->mailbox->set_throttled(false);
+	}
+
+	Object* Scheduler::next_actor()
+	{
+		std::deque<Object*>& queue = runnable.empty() ? throttled : runnable;
+		Object* actor = nullptr;
+
+		if(!queue.empty())
+		{
+			actor = queue.front();
+			queue.pop_front();
+		}
+
+		return actor;
+	}
+
+	Timer* Scheduler::send_after(Object* receiver, Message* msg, Object* sender, uint64_t delay)
+	{
+		Timer* t = new Timer(kTimerDeliver, now() + delay);
+		t->receiver = receiver;
+		t->message  = msg;
+		t->sender   = sender;
+		timers.insert(t);
+		return t;
+	}
+
+	Timer* Scheduler::timeout(uint64_t delay)
+	{
+		Timer* t = new Timer(kTimerTimeout, now() + delay);
+		timers.insert(t);
+		return t;
+	}
+
+	void Scheduler::cancel(Timer* t)
+	{
+		timers.cancel(t);
+	}
+
+	void Scheduler::expire_timers()
+	{
+		std::vector<Timer*> expired;
+		timers.advance(now(), expired);
+
+		for(Timer* t : expired)
+		{
+			if(t->kind != kTimerDeliver)
+				continue;
+
+			MailboxStatus status = t->receiver->mailbox->deliver(t->message, t->sender);
+
+			// A delayed message can't hold anybody up, so a full mailbox just means trying
+			// again on the next tick.
+			if(status == kMailboxWouldBlock)
+			{
+				t->expires = now() + 1;
+				timers.insert(t);
+				continue;
+			}
+
+			if(status != kMailboxRejected)
+				wake(t->receiver);
+			delete t;
+		}
+	}
+
+	bool Scheduler::run_once()
+	{
+		expire_timers();
+
+		Object* actor = next_actor();
+
+		if(actor == nullptr)
+		{
+			if(timers.is_empty())
+				return false;
+
+			// Nothing to do until the next timer goes off.
+			std::this_thread::sleep_until(epoch + std::chrono::milliseconds(timers.next_tick()));
+			expire_timers();
+			return true;
+		}
+
+		Mailbox* mailbox = actor->mailbox;
+		Message* msg = nullptr;
+		Object* sender = nullptr;
+		Future* reply = nullptr;
+
+		// An actor which is still busy with its last message is left alone; whoever has it
+		// busy wakes it again when it is done. Unscheduling it first means that wake can't be
+		// missed.
+		mailbox->set_scheduled(false);
+		if(!mailbox->claim())
+			return true;
+
+		if(mailbox->receive(msg, sender, reply))
+			machine->dispatch(actor, msg, reply);
+		else
+			machine->finish(actor, Nil::instance());
+
+		return true;
+	}
+}
@@ -0,0 +1,86 @@
+/*
+ * Caribou Virtual Machine
+ * Copyright (c) 2011, Jeremy Tregunna, All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef __CARIBOU__SCHEDULER_HPP__
+#define __CARIBOU__SCHEDULER_HPP__
+
+#include <deque>
+#include <chrono>
+#include <stdint.h>
+#include "timer_wheel.hpp"
+
+namespace Caribou
+{
+	class Object;
+	class Message;
+	class Mailbox;
+	class Machine;
+
+	// Decides which actor gets to process its mail next. Actors whose mailbox is full run
+	// first; producers that have run into a full bounded mailbox are throttled, and only run
+	// once nobody else has work, until they manage a delivery without hitting the limit again.
+	// The scheduler also keeps the machine's timers, and is the only thing that sleeps: when
+	// all that is left to do is wait for a timer.
+	class Scheduler
+	{
+	public:
+		Scheduler(Machine* m);
+
+		// Makes an actor with pending mail runnable.
+		void wake(Object*);
+
+		void throttle(Object*);
+		void relieve(Object*);
+
+		// Hands one message to the next runnable actor. Returns false if nobody had any mail.
+		// If the message selects a bytecode method, this only pushes its frame; the machine
+		// runs it from there, and the actor is busy until it returns. Actors which are busy
+		// are passed over.
+		bool run_once();
+
+		bool has_work() { return !runnable.empty() || !throttled.empty() || !timers.is_empty(); }
+
+		// Delivers a message into the receiver's mailbox once delay milliseconds have passed.
+		Timer* send_after(Object* receiver, Message* msg, Object* sender, uint64_t delay);
+
+		// A timer which only gets marked as fired. The caller owns it, and must cancel it
+		// before freeing it.
+		Timer* timeout(uint64_t delay);
+		void cancel(Timer*);
+
+		// Milliseconds since the scheduler was created. This is the tick of the timer wheel.
+		uint64_t now();
+
+	private:
+		Object* next_actor();
+		void expire_timers();
+
+		std::deque<Object*>                   runnable;
+		std::deque<Object*>                   throttled;
+		std::chrono::steady_clock::time_point epoch;
+		TimerWheel                            timers;
+		Machine*                              machine;
+	};
+}
+
+#endif /* !__CARIBOU__SCHEDULER_HPP__ */
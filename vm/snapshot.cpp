@@ -0,0 +1,504 @@
+/*
+ * Caribou Virtual Machine
+ * Copyright (c) 2011, Jeremy Tregunna, All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#include <string.h>
+#include <fstream>
+#include "snapshot.hpp"
+#include "endian.hpp"
+#include "image.hpp"
+#include "object_space.hpp"
+#include "nil.hpp"
+#include "integer.hpp"
+#include "boolean.hpp"
+#include "string.hpp"
+#include "array.hpp"
+#include "message.hpp"
+#include "vmmethod.hpp"
+#include "continuation.hpp"
+#include "mailbox.hpp"
+#include "verifier.hpp"
+
+// Everything up to the symbol table: the magic number and version, the version of the
+// bytecode the code is in, the number of objects, the index of the object space, the
+// number of symbols, and where the symbol table, constant pool, object index and code
+// are, followed by where to start running.
+#define SNAPSHOT_HEADER_SIZE 66
+// A reference to nothing at all.
+#define SNAPSHOT_NONE        UINT32_MAX
+
+#define SNAPSHOT_ACTIVATABLE (1 << 0)
+#define SNAPSHOT_ACTOR       (1 << 1)
+
+namespace Caribou
+{
+	// Reads the fields of a snapshot in turn, making sure none of them run off the end.
+	struct SnapshotCursor
+	{
+		const uint8_t* bytes;
+		size_t         length;
+		uint64_t       offset;
+
+		SnapshotCursor(const uint8_t* b, size_t l, uint64_t at) : bytes(b), length(l), offset(at) {}
+
+		const uint8_t* take(uint64_t n)
+		{
+			if(offset > length || n > length - offset)
+				throw SnapshotError("record runs past the end");
+
+			const uint8_t* p = bytes + offset;
+			offset += n;
+			return p;
+		}
+
+		uint8_t  u8()  { return *take(1); }
+		uint32_t u32() { return read_uint32(take(4)); }
+		uint64_t u64() { return read_uint64(take(8)); }
+
+		std::string text()
+		{
+			uint32_t n = u32();
+			return std::string(reinterpret_cast<const char*>(take(n)), n);
+		}
+	};
+
+	static void put8(std::vector<uint8_t>& out, uint8_t value)
+	{
+		out.push_back(value);
+	}
+
+	static void put32(std::vector<uint8_t>& out, uint32_t value)
+	{
+		for(int shift = 24; shift >= 0; shift -= 8)
+			out.push_back((value >> shift) & 0xff);
+	}
+
+	static void put64(std::vector<uint8_t>& out, uint64_t value)
+	{
+		put32(out, value >> 32);
+		put32(out, value & 0xffffffff);
+	}
+
+	static void put_text(std::vector<uint8_t>& out, const std::string& str)
+	{
+		put32(out, str.size());
+		out.insert(out.end(), str.begin(), str.end());
+	}
+
+	Object* SnapshotStub::resolve()
+	{
+		return snapshot->resolve(index);
+	}
+
+	const std::string SnapshotStub::object_name()
+	{
+		return "SnapshotStub";
+	}
+
+	Snapshot* Snapshot::open(Image& image, const uint8_t* base, size_t length)
+	{
+		static const char magic[] = SNAPSHOT_MAGIC_NUMBER;
+
+		if(length < SNAPSHOT_HEADER_SIZE || memcmp(base, magic, 4) != 0 || base[4] != SNAPSHOT_VERSION)
+			return nullptr;
+
+		SnapshotCursor header(base, length, 5);
+		uint8_t  version        = header.u8();
+		uint32_t count          = header.u32();
+		uint32_t root           = header.u32();
+		uint32_t symbol_count   = header.u32();
+		uint64_t symbols_offset = header.u64();
+		uint64_t pool_offset    = header.u64();
+		uint64_t pool_size      = header.u64();
+		uint64_t index_offset   = header.u64();
+		uint64_t code_offset    = header.u64();
+		uint64_t entry          = header.u64();
+
+		if(version != kBytecodeFixed && version != kBytecodeCompact)
+			return nullptr;
+		if(root >= count || pool_offset > length || pool_size > length - pool_offset || code_offset > length ||
+		   entry > length - code_offset || index_offset > length || (uint64_t)count * 8 > length - index_offset)
+			return nullptr;
+
+		Snapshot* snapshot = new Snapshot(base, length, image.get_heap());
+		GarbageCollector* previous = collector;
+
+		for(uint32_t i = 0; i < count; i++)
+		{
+			uint64_t offset = read_uint64(base + index_offset + (uint64_t)i * 8);
+
+			if(offset >= length)
+			{
+				delete snapshot;
+				return nullptr;
+			}
+			snapshot->offsets.push_back(offset);
+		}
+		snapshot->objects.assign(count, nullptr);
+		snapshot->stubs.assign(count, nullptr);
+
+		try
+		{
+			SnapshotCursor symbols(base, length, symbols_offset);
+
+			collector = image.get_heap();
+			for(uint32_t i = 0; i < symbol_count; i++)
+				image.get_symtab().add(new String(symbols.text()));
+			collector = previous;
+
+			if(!image.get_constant_pool().load(base + pool_offset, pool_size))
+				throw SnapshotError("bad constant pool");
+
+			snapshot->code        = base + code_offset;
+			snapshot->code_length = length - code_offset;
+			snapshot->constants   = image.get_constant_count();
+			snapshot->version     = version;
+
+			ObjectSpace* space = dynamic_cast<ObjectSpace*>(snapshot->resolve(root));
+			if(space == nullptr)
+				throw SnapshotError("no object space");
+
+			image.set_object_space(space);
+		}
+		catch(const SnapshotError&)
+		{
+			collector = previous;
+			delete snapshot;
+			return nullptr;
+		}
+
+		image.map_instructions(const_cast<uint8_t*>(base), length, code_offset);
+		image.set_bytecode_version(version);
+		image.set_entry_point(entry);
+		image.set_snapshot(snapshot);
+		return snapshot;
+	}
+
+	// Machines may come across the same stub at the same time; only one of them makes the
+	// object, on the image's heap.
+	Object* Snapshot::resolve(uint32_t index)
+	{
+		std::lock_guard<std::recursive_mutex> guard(lock);
+		GarbageCollector* previous = collector;
+		Object* obj;
+
+		collector = heap;
+		try
+		{
+			obj = object(index);
+		}
+		catch(...)
+		{
+			collector = previous;
+			throw;
+		}
+		collector = previous;
+
+		return obj;
+	}
+
+	Object* Snapshot::reference(uint32_t index)
+	{
+		if(index == SNAPSHOT_NONE)
+			return nullptr;
+		if(index >= objects.size())
+			throw SnapshotError("reference out of range");
+
+		if(objects[index] != nullptr)
+			return objects[index];
+
+		if(stubs[index] == nullptr)
+			stubs[index] = new SnapshotStub(this, index);
+		return stubs[index];
+	}
+
+	// Objects are registered before anything they refer to is made, so that references
+	// back to them find them.
+	Object* Snapshot::object(uint32_t index)
+	{
+		if(index == SNAPSHOT_NONE)
+			return nullptr;
+		if(index >= objects.size())
+			throw SnapshotError("reference out of range");
+
+		if(objects[index] != nullptr)
+			return objects[index];
+
+		SnapshotCursor c(bytes, length, offsets[index]);
+		uint8_t kind  = c.u8();
+		uint8_t flags = c.u8();
+		uint32_t capacity = 0;
+		uint8_t policy = kMailboxOverflowBlock;
+		Object* obj;
+
+		// Actors keep how their mailbox was bounded.
+		if(flags & SNAPSHOT_ACTOR)
+		{
+			capacity = c.u32();
+			policy   = c.u8();
+			if(policy > kMailboxOverflowFail)
+				throw SnapshotError("unknown mailbox overflow policy");
+		}
+
+		switch(kind)
+		{
+			case kSnapshotObject:
+				obj = objects[index] = new Object();
+				break;
+			case kSnapshotObjectSpace:
+				obj = objects[index] = new ObjectSpace(false);
+				break;
+			case kSnapshotNil:
+				obj = objects[index] = Nil::instance();
+				break;
+			case kSnapshotInteger:
+				obj = objects[index] = new Integer(static_cast<intptr_t>(c.u64()));
+				break;
+			case kSnapshotBoolean:
+				obj = objects[index] = new Boolean(c.u8() != 0);
+				break;
+			case kSnapshotString:
+				obj = objects[index] = new String(c.text());
+				break;
+			case kSnapshotArray:
+			{
+				uint32_t n = c.u32();
+				Object** data = new Object*[n];
+
+				obj = objects[index] = new Array(data, n);
+				for(uint32_t i = 0; i < n; i++)
+					data[i] = object(c.u32());
+				break;
+			}
+			case kSnapshotMessage:
+			{
+				std::string name = c.text();
+				uint32_t argc = c.u32();
+				std::vector<Message*> arguments;
+
+				for(uint32_t i = 0; i < argc; i++)
+				{
+					Message* arg = dynamic_cast<Message*>(object(c.u32()));
+					if(arg == nullptr)
+						throw SnapshotError("message argument isn't a message");
+					arguments.push_back(arg);
+				}
+				obj = objects[index] = new Message(name, arguments);
+				break;
+			}
+			case kSnapshotMethod:
+			{
+				String* name = dynamic_cast<String*>(object(c.u32()));
+				uintptr_t start = c.u64();
+				size_t nargs = c.u32();
+				MethodFacts facts;
+
+				if(start >= code_length)
+					throw SnapshotError("method starts outside the code");
+
+				// What the verifier found out when the snapshot was written is no good to a
+				// different build, or if the code has changed since; it is verified again,
+				// like a method in an image's directory.
+				Verifier(code, code_length, constants, version).verify(start, facts);
+
+				VMMethod* method = new VMMethod(name, start, nargs, facts);
+				obj = objects[index] = method;
+				method->locals = object(c.u32());
+				break;
+			}
+			case kSnapshotContinuation:
+				obj = objects[index] = new Continuation();
+				break;
+			default:
+				throw SnapshotError("unknown kind of object");
+		}
+
+		obj->set_activatable((flags & SNAPSHOT_ACTIVATABLE) != 0);
+		obj->set_actor((flags & SNAPSHOT_ACTOR) != 0);
+		obj->mailbox->set_capacity(capacity, static_cast<MailboxOverflowPolicy>(policy));
+
+		uint32_t slot_count = c.u32();
+		for(uint32_t i = 0; i < slot_count; i++)
+		{
+			std::string name = c.text();
+			obj->add_slot(name, reference(c.u32()));
+		}
+
+		uint32_t trait_count = c.u32();
+		for(uint32_t i = 0; i < trait_count; i++)
+			obj->trait_list().push_back(reference(c.u32()));
+
+		return obj;
+	}
+
+	void SnapshotWriter::dump(const char* filename, uintptr_t entry)
+	{
+		static const char magic[] = SNAPSHOT_MAGIC_NUMBER;
+		std::vector<uint8_t> out(SNAPSHOT_HEADER_SIZE);
+		std::vector<uint8_t> header;
+		std::vector<uint64_t> offsets;
+		Symtab& symtab = image.get_symtab();
+		ConstantPool& pool = image.get_constant_pool();
+
+		uint64_t symbols_offset = out.size();
+		size_t symbol_count = symtab.size();
+		for(size_t i = 0; i < symbol_count; i++)
+			put_text(out, symtab.lookup(i)->stringValue());
+
+		uint64_t pool_offset = out.size();
+		out.insert(out.end(), pool.data(), pool.data() + pool.data_size());
+
+		indices.clear();
+		order.clear();
+		uint32_t root = reference(image.get_object_space());
+
+		// Records discover more objects as they're written.
+		for(size_t i = 0; i < order.size(); i++)
+		{
+			offsets.push_back(out.size());
+			record(order[i], out);
+		}
+
+		uint64_t index_offset = out.size();
+		for(uint64_t offset : offsets)
+			put64(out, offset);
+
+		uint64_t code_offset = out.size();
+		out.insert(out.end(), image.get_instructions(), image.get_instructions() + image.get_instruction_count());
+
+		header.insert(header.end(), magic, magic + 4);
+		put8(header, SNAPSHOT_VERSION);
+		put8(header, image.get_bytecode_version());
+		put32(header, order.size());
+		put32(header, root);
+		put32(header, symbol_count);
+		put64(header, symbols_offset);
+		put64(header, pool_offset);
+		put64(header, pool.data_size());
+		put64(header, index_offset);
+		put64(header, code_offset);
+		put64(header, entry);
+		memcpy(out.data(), header.data(), SNAPSHOT_HEADER_SIZE);
+
+		std::ofstream output_file(filename, std::ios::binary);
+		output_file.write((const char*)out.data(), out.size());
+		output_file.close();
+	}
+
+	uint32_t SnapshotWriter::reference(Object* obj)
+	{
+		if(obj == nullptr)
+			return SNAPSHOT_NONE;
+
+		if(obj->is_stub())
+			obj = static_cast<Stub*>(obj)->resolve();
+
+		std::map<Object*, uint32_t>::iterator it = indices.find(obj);
+		if(it != indices.end())
+			return it->second;
+
+		uint32_t index = order.size();
+		indices[obj] = index;
+		order.push_back(obj);
+		return index;
+	}
+
+	void SnapshotWriter::record(Object* obj, std::vector<uint8_t>& out)
+	{
+		uint8_t flags = (obj->is_activatable() ? SNAPSHOT_ACTIVATABLE : 0) | (obj->is_actor() ? SNAPSHOT_ACTOR : 0);
+		size_t kind_at = out.size();
+
+		put8(out, kSnapshotObject);
+		put8(out, flags);
+		if(obj->is_actor())
+		{
+			put32(out, obj->mailbox->get_capacity());
+			put8(out, obj->mailbox->get_policy());
+		}
+
+		if(dynamic_cast<ObjectSpace*>(obj) != nullptr)
+			out[kind_at] = kSnapshotObjectSpace;
+		else if(obj == Nil::instance())
+		{
+			// There is only ever one nil, which brings its own slots.
+			out[kind_at] = kSnapshotNil;
+			put32(out, 0);
+			put32(out, 0);
+			return;
+		}
+		else if(Integer* i = dynamic_cast<Integer*>(obj))
+		{
+			out[kind_at] = kSnapshotInteger;
+			put64(out, static_cast<uint64_t>(i->c_int()));
+		}
+		else if(Boolean* b = dynamic_cast<Boolean*>(obj))
+		{
+			out[kind_at] = kSnapshotBoolean;
+			put8(out, b->value());
+		}
+		else if(String* s = dynamic_cast<String*>(obj))
+		{
+			out[kind_at] = kSnapshotString;
+			put_text(out, s->stringValue());
+		}
+		else if(Array* a = dynamic_cast<Array*>(obj))
+		{
+			out[kind_at] = kSnapshotArray;
+			put32(out, a->size());
+			for(size_t i = 0; i < a->size(); i++)
+				put32(out, reference(a->at(i)));
+		}
+		else if(Message* m = dynamic_cast<Message*>(obj))
+		{
+			std::vector<Message*> arguments = m->get_arguments();
+
+			out[kind_at] = kSnapshotMessage;
+			put_text(out, m->get_name());
+			put32(out, arguments.size());
+			for(Message* arg : arguments)
+				put32(out, reference(arg));
+		}
+		else if(VMMethod* m = dynamic_cast<VMMethod*>(obj))
+		{
+			out[kind_at] = kSnapshotMethod;
+			put32(out, reference(m->get_name()));
+			put64(out, m->get_start_ip());
+			put32(out, m->nargs);
+			put32(out, reference(m->locals));
+		}
+		else if(dynamic_cast<Continuation*>(obj) != nullptr)
+			out[kind_at] = kSnapshotContinuation;
+
+		SlotTable& slots = obj->slot_table();
+		put32(out, slots.size());
+		for(auto& slot : slots)
+		{
+			put_text(out, slot.first);
+			put32(out, reference(slot.second));
+		}
+
+		std::vector<Object*>& traits = obj->trait_list();
+		put32(out, traits.size());
+		for(Object* trait : traits)
+			put32(out, reference(trait));
+	}
+}
@@ -0,0 +1,138 @@
+/*
+ * Caribou Virtual Machine
+ * Copyright (c) 2011, Jeremy Tregunna, All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef __CARIBOU__SNAPSHOT_HPP__
+#define __CARIBOU__SNAPSHOT_HPP__
+
+#include <stdint.h>
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+#include "object.hpp"
+
+#define SNAPSHOT_MAGIC_NUMBER { 'C', 'R', 'B', 'S' }
+#define SNAPSHOT_VERSION      4
+
+namespace Caribou
+{
+	class Image;
+	class ObjectSpace;
+	class Snapshot;
+
+	// What a record in a snapshot makes. Objects of any other kind are saved as plain
+	// objects, with their slots and traits but without whatever else they hold.
+	enum SnapshotKind
+	{
+		kSnapshotObject = 0,
+		kSnapshotObjectSpace,
+		kSnapshotNil,
+		kSnapshotInteger,
+		kSnapshotBoolean,
+		kSnapshotString,
+		kSnapshotArray,
+		kSnapshotMessage,
+		kSnapshotMethod,
+		kSnapshotContinuation
+	};
+
+	// Stands in for an object in a snapshot until somebody looks it up.
+	class SnapshotStub : public Stub
+	{
+	public:
+		SnapshotStub(Snapshot* s, uint32_t i) : snapshot(s), index(i) {}
+
+		Object* resolve();
+
+		virtual const std::string object_name();
+
+	private:
+		Snapshot* snapshot;
+		uint32_t  index;
+	};
+
+	/* A heap saved from a running image, along with its code, constant pool and symbol
+	   table, mapped back in. Nothing but the object space itself is made when the snapshot
+	   is opened: the slots and traits of an object hold stubs for the objects they refer
+	   to, which are only made the first time a lookup comes across them. */
+	class Snapshot
+	{
+	public:
+		// Reads the header and the symbol table, and sets the image up to run the code in
+		// the snapshot, which has to stay mapped for as long as the image is around.
+		// Returns nullptr if the snapshot is malformed.
+		static Snapshot* open(Image& image, const uint8_t* base, size_t length);
+
+		// The object a stub stands for, made if it hasn't been yet.
+		Object* resolve(uint32_t index);
+
+	private:
+		Snapshot(const uint8_t* base, size_t length, GarbageCollector* gc) : bytes(base), length(length), heap(gc), code(nullptr), code_length(0), constants(0), version(0) {}
+
+		Object* object(uint32_t index);
+		Object* reference(uint32_t index);
+
+		const uint8_t*             bytes;
+		size_t                     length;
+		std::vector<uint64_t>      offsets;
+		std::vector<Object*>       objects;
+		std::vector<SnapshotStub*> stubs;
+		GarbageCollector*          heap;
+		std::recursive_mutex       lock;
+		// What the methods in the snapshot are verified against as they are made.
+		const uint8_t*             code;
+		size_t                     code_length;
+		size_t                     constants;
+		uint8_t                    version;
+	};
+
+	// Saves everything reachable from an image's object space, and the image's code,
+	// constant pool and symbol table, so that running the snapshot carries on from entry.
+	class SnapshotWriter
+	{
+	public:
+		SnapshotWriter(Image& i) : image(i) {}
+
+		void dump(const char* filename, uintptr_t entry);
+
+	private:
+		uint32_t reference(Object* obj);
+		void record(Object* obj, std::vector<uint8_t>& out);
+
+		Image&                       image;
+		std::map<Object*, uint32_t>  indices;
+		std::vector<Object*>         order;
+	};
+
+	class SnapshotError
+	{
+	private:
+		std::string reason;
+
+	public:
+		SnapshotError(std::string why) : reason(why) {}
+		const std::string message() const { return "Invalid snapshot: " + reason; }
+	};
+}
+
+#endif /* !__CARIBOU__SNAPSHOT_HPP__ */
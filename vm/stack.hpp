@@ -35,15 +35,6 @@ namespace Caribou
 	public:
 		Stack() {}
 
-		Stack(Stack<Context*>& other)
-		{
-			for(Context* e : other.store)
-			{
-				Context* a = new Context(*e);
-				store.push_back(a);
-			}
-		}
-
 		void push(const T& val)
 		{
 			store.push_back(val);
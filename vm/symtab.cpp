@@ -29,14 +29,14 @@
 
 namespace Caribou
 {
-	size_t Symtab::add(String* str)
+	size_t Symtab::append(String* str)
 	{
 		mapping.push_back(str);
-		symbols.insert(std::pair<String*, size_t>(str, mapping.size() - 1));
-		return symbols.size() - 1;
+		symbols.insert(std::pair<std::string, size_t>(str->stringValue(), mapping.size() - 1));
+		return mapping.size() - 1;
 	}
 
-	size_t Symtab::lookup(String* str)
+	size_t Symtab::find(const std::string& str)
 	{
 		SymMap::iterator it = symbols.find(str);
 		if(it == symbols.end())
@@ -44,21 +44,45 @@ namespace Caribou
 		return it->second;
 	}
 
+	size_t Symtab::add(String* str)
+	{
+		std::lock_guard<std::mutex> guard(lock);
+		return append(str);
+	}
+
+	size_t Symtab::lookup(String* str)
+	{
+		std::lock_guard<std::mutex> guard(lock);
+		return find(str->stringValue());
+	}
+
 	size_t Symtab::lookup_or_add(String* str)
 	{
-		size_t idx = lookup(str);
+		std::lock_guard<std::mutex> guard(lock);
+		size_t idx = find(str->stringValue());
+		if(idx == SYMTAB_NOT_FOUND)
+			idx = append(str);
+		return idx;
+	}
+
+	size_t Symtab::intern(const std::string& str)
+	{
+		std::lock_guard<std::mutex> guard(lock);
+		size_t idx = find(str);
 		if(idx == SYMTAB_NOT_FOUND)
-			idx = add(str);
+			idx = append(new String(str));
 		return idx;
 	}
 
 	String* Symtab::lookup(const uintptr_t idx)
 	{
+		std::lock_guard<std::mutex> guard(lock);
 		return mapping.at(idx);
 	}
 
 	size_t Symtab::size()
 	{
-		return symbols.size();
+		std::lock_guard<std::mutex> guard(lock);
+		return mapping.size();
 	}
 }
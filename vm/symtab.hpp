@@ -28,6 +28,7 @@
 #include <string>
 #include <vector>
 #include <map>
+#include <mutex>
 #include "string.hpp"
 
 // This is INT32_MAX instead of INTPTR_MAX due to ILP64 systems who define
@@ -37,8 +38,10 @@
 
 namespace Caribou
 {
-	typedef std::map<String*, size_t> SymMap;
+	typedef std::map<std::string, size_t> SymMap;
 
+	// Symbols are looked up by their text. There is one table per image, shared by every
+	// machine running it, so it does its own locking.
 	class Symtab
 	{
 	public:
@@ -48,11 +51,18 @@ namespace Caribou
 		size_t lookup_or_add(String* str);
 		String* lookup(const uintptr_t idx);
 
+		// The symbol with the given text, made a new String if there isn't one yet.
+		size_t intern(const std::string& str);
+
 		size_t size();
 
 	private:
+		size_t append(String* str);
+		size_t find(const std::string& str);
+
 		std::vector<String*> mapping;
 		SymMap               symbols;
+		std::mutex           lock;
 	};
 }
 
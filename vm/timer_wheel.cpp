@@ -0,0 +1,266 @@
+/*
+ * Caribou Virtual Machine
+ * Copyright (c) 2011, Jeremy Tregunna, All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#include <string.h>
+#include "timer_wheel.hpp"
+
+namespace Caribou
+{
+	TimerWheel::TimerWheel(uint64_t now) : current(now), count(0), far(nullptr)
+	{
+		memset(slots, 0, sizeof(slots));
+		memset(occupied, 0, sizeof(occupied));
+	}
+
+	static void release(Timer*& head)
+	{
+		while(head != nullptr)
+		{
+			Timer* t = head;
+			t->unlink();
+			if(t->kind == kTimerDeliver)
+				delete t;
+		}
+	}
+
+	TimerWheel::~TimerWheel()
+	{
+		for(int level = 0; level < CARIBOU_TIMER_LEVELS; level++)
+		{
+			for(int slot = 0; slot < CARIBOU_TIMER_SLOTS; slot++)
+				release(slots[level][slot]);
+		}
+		release(far);
+	}
+
+	void TimerWheel::insert(Timer* t)
+	{
+		t->fired = false;
+		count++;
+		place(t);
+	}
+
+	void TimerWheel::cancel(Timer* t)
+	{
+		if(t->pprev == nullptr)
+			return;
+
+		t->unlink();
+		count--;
+
+		if(t->level < CARIBOU_TIMER_LEVELS)
+			vacate_if_empty(t->level, t->slot);
+	}
+
+	void TimerWheel::place(Timer* t)
+	{
+		uint64_t expires = t->expires < current ? current : t->expires;
+		uint64_t diff = expires ^ current;
+		Timer** head;
+		int level;
+
+		if(diff >> (CARIBOU_TIMER_BITS * CARIBOU_TIMER_LEVELS))
+		{
+			t->level = CARIBOU_TIMER_LEVELS;
+			head = &far;
+		}
+		else
+		{
+			for(level = CARIBOU_TIMER_LEVELS - 1; level > 0; level--)
+			{
+				if(diff >> (CARIBOU_TIMER_BITS * level))
+					break;
+			}
+
+			int slot = (expires >> (CARIBOU_TIMER_BITS * level)) & CARIBOU_TIMER_MASK;
+			t->level = level;
+			t->slot  = slot;
+			head = &slots[level][slot];
+			occupied[level][slot / 64] |= 1ULL << (slot % 64);
+		}
+
+		t->next = *head;
+		if(t->next != nullptr)
+			t->next->pprev = &t->next;
+		*head = t;
+		t->pprev = head;
+	}
+
+	void TimerWheel::relink(Timer* list)
+	{
+		while(list != nullptr)
+		{
+			Timer* t = list;
+			list = t->next;
+			t->next  = nullptr;
+			t->pprev = nullptr;
+			place(t);
+		}
+	}
+
+	// Called whenever the index of a level wraps around to zero: the slot the next level up
+	// has just reached is emptied into the levels below it.
+	void TimerWheel::cascade(int level)
+	{
+		Timer* list;
+
+		if(level == CARIBOU_TIMER_LEVELS)
+		{
+			list = far;
+			far = nullptr;
+			relink(list);
+			return;
+		}
+
+		int slot = (current >> (CARIBOU_TIMER_BITS * level)) & CARIBOU_TIMER_MASK;
+		if(slot == 0)
+			cascade(level + 1);
+
+		list = slots[level][slot];
+		slots[level][slot] = nullptr;
+		occupied[level][slot / 64] &= ~(1ULL << (slot % 64));
+		relink(list);
+	}
+
+	void TimerWheel::vacate_if_empty(int level, int slot)
+	{
+		if(slots[level][slot] == nullptr)
+			occupied[level][slot / 64] &= ~(1ULL << (slot % 64));
+	}
+
+	// First slot at or after from with any timers in it, or -1.
+	int TimerWheel::next_occupied(int level, int from)
+	{
+		for(int word = from / 64; word < CARIBOU_TIMER_SLOTS / 64; word++)
+		{
+			uint64_t bits = occupied[level][word];
+
+			if(word == from / 64)
+				bits &= ~0ULL << (from % 64);
+
+			if(bits != 0)
+				return word * 64 + __builtin_ctzll(bits);
+		}
+		return -1;
+	}
+
+	// The next tick at which the wheel has something to do: the first slot on the bottom level
+	// with timers in it, or else the start of the first slot with any in it on the lowest
+	// level above, where they are cascaded down. Every slot in between is empty, so the wheel
+	// can go straight there.
+	uint64_t TimerWheel::next_event()
+	{
+		for(int level = 0; level < CARIBOU_TIMER_LEVELS; level++)
+		{
+			int shift = CARIBOU_TIMER_BITS * level;
+			int slot = next_occupied(level, (current >> shift) & CARIBOU_TIMER_MASK);
+
+			if(slot >= 0)
+				return (current >> (shift + CARIBOU_TIMER_BITS) << (shift + CARIBOU_TIMER_BITS)) + ((uint64_t)slot << shift);
+		}
+
+		// Only the far list is left, which needn't be looked at again until the block of 2^32
+		// ticks the first of its timers expires in.
+		int shift = CARIBOU_TIMER_BITS * CARIBOU_TIMER_LEVELS;
+		uint64_t earliest = UINT64_MAX;
+		for(Timer* t = far; t != nullptr; t = t->next)
+		{
+			if(t->expires < earliest)
+				earliest = t->expires;
+		}
+
+		uint64_t next = ((current >> shift) + 1) << shift;
+		earliest = earliest >> shift << shift;
+		return earliest > next ? earliest : next;
+	}
+
+	void TimerWheel::advance(uint64_t now, std::vector<Timer*>& expired)
+	{
+		while(current <= now)
+		{
+			int slot = current & CARIBOU_TIMER_MASK;
+
+			if(slot == 0)
+				cascade(1);
+
+			Timer*& head = slots[0][slot];
+			while(head != nullptr)
+			{
+				Timer* t = head;
+				t->unlink();
+				t->fired = true;
+				count--;
+				expired.push_back(t);
+			}
+			occupied[0][slot / 64] &= ~(1ULL << (slot % 64));
+
+			current++;
+
+			if(count == 0)
+			{
+				current = now + 1;
+				break;
+			}
+
+			uint64_t target = next_event();
+			if(target > now + 1)
+				target = now + 1;
+			if(target > current)
+				current = target;
+		}
+	}
+
+	// Timers on the bottom level expire on the tick their slot stands for. Above it, a slot
+	// covers many ticks, so the earliest of them is found by looking through the first slot
+	// with any in it on the lowest level which has any; everything later on that level, or
+	// on any level above, expires after them.
+	uint64_t TimerWheel::next_tick()
+	{
+		if(count == 0)
+			return UINT64_MAX;
+
+		Timer* list = far;
+
+		for(int level = 0; level < CARIBOU_TIMER_LEVELS; level++)
+		{
+			int slot = next_occupied(level, (current >> (CARIBOU_TIMER_BITS * level)) & CARIBOU_TIMER_MASK);
+
+			if(slot < 0)
+				continue;
+			if(level == 0)
+				return (current & ~(uint64_t)CARIBOU_TIMER_MASK) + slot;
+
+			list = slots[level][slot];
+			break;
+		}
+
+		uint64_t earliest = UINT64_MAX;
+		for(Timer* t = list; t != nullptr; t = t->next)
+		{
+			if(t->expires < earliest)
+				earliest = t->expires;
+		}
+
+		return earliest < current ? current : earliest;
+	}
+}
@@ -0,0 +1,115 @@
+/*
+ * Caribou Virtual Machine
+ * Copyright (c) 2011, Jeremy Tregunna, All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef __CARIBOU__TIMER_WHEEL_HPP__
+#define __CARIBOU__TIMER_WHEEL_HPP__
+
+#include <vector>
+#include <stdint.h>
+
+#define CARIBOU_TIMER_LEVELS 4
+#define CARIBOU_TIMER_BITS   8
+#define CARIBOU_TIMER_SLOTS  (1 << CARIBOU_TIMER_BITS)
+#define CARIBOU_TIMER_MASK   (CARIBOU_TIMER_SLOTS - 1)
+
+namespace Caribou
+{
+	class Object;
+	class Message;
+
+	enum TimerKind
+	{
+		kTimerDeliver = 0,
+		kTimerTimeout
+	};
+
+	// Timers are intrusive, so cancelling one is just unlinking it. A delivery timer belongs
+	// to the wheel and is freed once the message is in the mailbox; a timeout belongs to
+	// whoever is waiting on it, and is only marked as fired.
+	struct Timer
+	{
+		Timer*    next;
+		Timer**   pprev;
+		uint64_t  expires;
+		uint8_t   level;
+		uint8_t   slot;
+		TimerKind kind;
+		bool      fired;
+		Object*   receiver;
+		Message*  message;
+		Object*   sender;
+
+		Timer(TimerKind k, uint64_t when) : next(nullptr), pprev(nullptr), expires(when), level(0), slot(0), kind(k), fired(false), receiver(nullptr), message(nullptr), sender(nullptr) {}
+
+		inline void unlink()
+		{
+			*pprev = next;
+			if(next != nullptr)
+				next->pprev = pprev;
+			next  = nullptr;
+			pprev = nullptr;
+		}
+	};
+
+	// A hierarchical timing wheel with one tick per millisecond. Each of the four levels has
+	// 256 slots. A timer goes into the level of the highest byte in which its expiry differs
+	// from the current tick, and drops down a level when the wheel reaches its slot. Inserting
+	// and cancelling are O(1), and advancing goes straight from one slot which holds timers to
+	// the next, on whichever level it is, no matter how far apart they are or how many are
+	// outstanding. Anything more than 2^32 ticks out waits on a separate list.
+	class TimerWheel
+	{
+	public:
+		TimerWheel(uint64_t now);
+		~TimerWheel();
+
+		void insert(Timer*);
+		void cancel(Timer*);
+
+		// Moves the wheel up to and including now, collecting the timers which expired.
+		void advance(uint64_t now, std::vector<Timer*>& expired);
+
+		// The tick the first timer expires on.
+		uint64_t next_tick();
+
+		bool is_empty() { return count == 0; }
+		size_t size() { return count; }
+
+	private:
+		void place(Timer*);
+		void cascade(int level);
+		void relink(Timer* list);
+		void vacate_if_empty(int level, int slot);
+		int next_occupied(int level, int from);
+		uint64_t next_event();
+
+		// The next tick to be processed.
+		uint64_t current;
+		size_t   count;
+		Timer*   slots[CARIBOU_TIMER_LEVELS][CARIBOU_TIMER_SLOTS];
+		uint64_t occupied[CARIBOU_TIMER_LEVELS][CARIBOU_TIMER_SLOTS / 64];
+		Timer*   far;
+	};
+}
+
+#endif /* !__CARIBOU__TIMER_WHEEL_HPP__ */
@@ -0,0 +1,337 @@
+/*
+ * Caribou Virtual Machine
+ * Copyright (c) 2011, Jeremy Tregunna, All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+#include "llvm/IR/LLVMContext.h"
+#include "llvm/IR/Module.h"
+#include "llvm/IR/IRBuilder.h"
+#include "llvm/IR/Verifier.h"
+#include "llvm/ExecutionEngine/ExecutionEngine.h"
+#include "llvm/ExecutionEngine/MCJIT.h"
+#include "llvm/Support/TargetSelect.h"
+#include "trace_recorder.hpp"
+#include "image.hpp"
+#include "integer.hpp"
+#include "boolean.hpp"
+
+namespace Caribou
+{
+	using namespace llvm;
+
+	// What compiled traces call on for anything they don't do inline.
+	static Object* trace_integer(intptr_t value)
+	{
+		return new Integer(value);
+	}
+
+	static Object* trace_boolean(int32_t value)
+	{
+		return new Boolean(value != 0);
+	}
+
+	static void trace_push(Context* ctx, Object* o)
+	{
+		ctx->push(o);
+	}
+
+	static Object* trace_pop(Context* ctx)
+	{
+		return ctx->pop();
+	}
+
+	static void trace_dup(Context* ctx)
+	{
+		ctx->push(ctx->top());
+	}
+
+	static void trace_swap(Context* ctx)
+	{
+		Object* a = ctx->pop();
+		Object* b = ctx->pop();
+		ctx->push(a);
+		ctx->push(b);
+	}
+
+	static std::once_flag native_target;
+
+	void TraceRecorder::release()
+	{
+		delete engine;
+		delete context;
+		engine  = nullptr;
+		context = nullptr;
+	}
+
+	/* Lowers a trace to a function which goes round the loop until a guard fails. The
+	   registers the trace uses are loaded once on the way in, and kept in values from then
+	   on, with a phi for each at the top of the loop. A failed guard is a side exit: the
+	   registers are written back to the frame, and the function returns the offset of the
+	   instruction the interpreter is to carry on from. The operand stack is always the
+	   frame's own, so it never has to be put back together.
+
+	   Arithmetic is done inline, behind a guard that each operand is an integer, and only
+	   the result is boxed. Comparisons compare identities, as Object::compare does, and
+	   guard that they go the same way as when the trace was recorded. */
+	bool TraceRecorder::compile(Trace* trace)
+	{
+		std::call_once(native_target, []()
+		{
+			InitializeNativeTarget();
+			InitializeNativeTargetAsmPrinter();
+		});
+
+		if(context == nullptr)
+			context = new LLVMContext();
+
+		std::string name = "trace_" + std::to_string(trace->header);
+		Type* byte = Type::getInt8Ty(*context);
+		Type* word = Type::getIntNTy(*context, sizeof(intptr_t) * 8);
+		PointerType* object = Type::getInt8PtrTy(*context);
+		PointerType* frame = Type::getInt8PtrTy(*context);
+		FunctionType* type = FunctionType::get(word, { PointerType::getUnqual(object), frame }, false);
+		Function* function;
+		IRBuilder<> builder(*context);
+		Value* regs[CARIBOU_NUM_REGISTERS];
+		bool used[CARIBOU_NUM_REGISTERS] = { false };
+		std::map<Value*, Value*> unboxed;
+
+		module   = new Module(name, *context);
+		function = Function::Create(type, Function::ExternalLinkage, name, module);
+		data     = function->getArg(0);
+		Value* ctx = function->getArg(1);
+
+		auto address = [&](const void* p, Type* t) -> Constant*
+		{
+			return ConstantExpr::getIntToPtr(ConstantInt::get(word, reinterpret_cast<uintptr_t>(p)), t);
+		};
+
+		auto helper = [&](const void* p, Type* result, std::vector<Type*> params) -> FunctionCallee
+		{
+			FunctionType* t = FunctionType::get(result, params, false);
+			return FunctionCallee(t, address(p, PointerType::getUnqual(t)));
+		};
+
+		FunctionCallee box     = helper(reinterpret_cast<const void*>(trace_integer), object, { word });
+		FunctionCallee boolean = helper(reinterpret_cast<const void*>(trace_boolean), object, { builder.getInt32Ty() });
+		FunctionCallee push    = helper(reinterpret_cast<const void*>(trace_push), builder.getVoidTy(), { frame, object });
+		FunctionCallee pop     = helper(reinterpret_cast<const void*>(trace_pop), object, { frame });
+		FunctionCallee dup     = helper(reinterpret_cast<const void*>(trace_dup), builder.getVoidTy(), { frame });
+		FunctionCallee swap    = helper(reinterpret_cast<const void*>(trace_swap), builder.getVoidTy(), { frame });
+
+		auto side_exit = [&](uintptr_t ip) -> BasicBlock*
+		{
+			BasicBlock* block = BasicBlock::Create(*context, "exit", function);
+			IRBuilder<> out(block);
+
+			for(int r = 0; r < CARIBOU_NUM_REGISTERS; r++)
+			{
+				if(used[r])
+					out.CreateStore(regs[r], out.CreateConstGEP1_32(object, data, r));
+			}
+			out.CreateRet(ConstantInt::get(word, ip));
+			return block;
+		};
+
+		auto guard = [&](Value* holds, uintptr_t ip)
+		{
+			BasicBlock* next = BasicBlock::Create(*context, "", function);
+			builder.CreateCondBr(holds, next, side_exit(ip));
+			builder.SetInsertPoint(next);
+		};
+
+		// The value of an integer, leaving the trace at ip if it isn't one.
+		auto integer = [&](Value* v, uintptr_t ip) -> Value*
+		{
+			auto it = unboxed.find(v);
+			if(it != unboxed.end())
+				return it->second;
+
+			Value* vtable = builder.CreateLoad(object, builder.CreateBitCast(v, PointerType::getUnqual(object)));
+			guard(builder.CreateICmpEQ(vtable, address(integer_vtable, object)), ip);
+
+			Value* field = builder.CreateConstGEP1_64(byte, v, integer_offset);
+			Value* n = builder.CreateLoad(word, builder.CreateBitCast(field, PointerType::getUnqual(word)));
+			unboxed[v] = n;
+			return n;
+		};
+
+		for(const TracePair& pair : trace->pairs)
+		{
+			for(uint8_t i = 0; i < pair.insn.nregs; i++)
+				used[pair.insn.registers[i]] = true;
+		}
+
+		BasicBlock* entry = BasicBlock::Create(*context, "entry", function);
+		header = BasicBlock::Create(*context, "loop", function);
+
+		builder.SetInsertPoint(entry);
+		for(int r = 0; r < CARIBOU_NUM_REGISTERS; r++)
+		{
+			if(used[r])
+				regs[r] = builder.CreateLoad(object, builder.CreateConstGEP1_32(object, data, r));
+		}
+		builder.CreateBr(header);
+
+		builder.SetInsertPoint(header);
+		for(int r = 0; r < CARIBOU_NUM_REGISTERS; r++)
+		{
+			header_phi[r] = nullptr;
+			if(!used[r])
+				continue;
+
+			header_phi[r] = builder.CreatePHI(object, 2);
+			header_phi[r]->addIncoming(regs[r], entry);
+			regs[r] = header_phi[r];
+		}
+
+		for(size_t i = 0; i < trace->pairs.size(); i++)
+		{
+			const TracePair& pair = trace->pairs[i];
+			const uint8_t* r = pair.insn.registers;
+			uintptr_t next = pair.ip + pair.insn.length;
+			uintptr_t after = i + 1 < trace->pairs.size() ? trace->pairs[i + 1].ip : trace->header;
+			Value* a;
+			Value* b;
+			Value* result = nullptr;
+
+			switch(pair.insn.opcode)
+			{
+				case Instructions::MOVE:
+					regs[r[0]] = regs[r[1]];
+					break;
+				case Instructions::LOADI:
+					regs[r[0]] = address(image->get_constant(pair.insn.immediate), object);
+					break;
+				case Instructions::PUSH:
+					builder.CreateCall(push, { ctx, address(reinterpret_cast<const void*>(pair.insn.immediate), object) });
+					break;
+				case Instructions::POP:
+					regs[r[0]] = builder.CreateCall(pop, { ctx });
+					break;
+				case Instructions::SWAP:
+					builder.CreateCall(swap, { ctx });
+					break;
+				case Instructions::DUP:
+					builder.CreateCall(dup, { ctx });
+					break;
+				case Instructions::ADD:
+				case Instructions::SUB:
+				case Instructions::MUL:
+				case Instructions::DIV:
+				case Instructions::MOD:
+				case Instructions::POW:
+					a = integer(regs[r[1]], pair.ip);
+					b = integer(regs[r[2]], pair.ip);
+
+					// Division by zero is left to the interpreter.
+					if(pair.insn.opcode == Instructions::DIV || pair.insn.opcode == Instructions::MOD)
+						guard(builder.CreateICmpNE(b, ConstantInt::get(word, 0)), pair.ip);
+
+					if(pair.insn.opcode == Instructions::ADD)
+						result = builder.CreateAdd(a, b);
+					else if(pair.insn.opcode == Instructions::SUB)
+						result = builder.CreateSub(a, b);
+					else if(pair.insn.opcode == Instructions::MUL)
+						result = builder.CreateMul(a, b);
+					else if(pair.insn.opcode == Instructions::DIV)
+						result = builder.CreateSDiv(a, b);
+					else if(pair.insn.opcode == Instructions::MOD)
+						result = builder.CreateSRem(a, b);
+					else
+						result = builder.CreateXor(a, b);
+
+					regs[r[0]] = builder.CreateCall(box, { result });
+					unboxed[regs[r[0]]] = result;
+					break;
+				case Instructions::NOT:
+					result = builder.CreateNot(integer(regs[r[1]], pair.ip));
+					regs[r[0]] = builder.CreateCall(box, { result });
+					unboxed[regs[r[0]]] = result;
+					break;
+				case Instructions::EQ:
+				case Instructions::LT:
+				case Instructions::LTE:
+				case Instructions::GT:
+				case Instructions::GTE:
+				{
+					a = builder.CreatePtrToInt(regs[r[1]], word);
+					b = builder.CreatePtrToInt(regs[r[2]], word);
+
+					if(pair.insn.opcode == Instructions::EQ)
+						result = builder.CreateICmpEQ(a, b);
+					else if(pair.insn.opcode == Instructions::LT)
+						result = builder.CreateICmpULT(a, b);
+					else if(pair.insn.opcode == Instructions::LTE)
+						result = builder.CreateICmpULE(a, b);
+					else if(pair.insn.opcode == Instructions::GT)
+						result = builder.CreateICmpUGT(a, b);
+					else
+						result = builder.CreateICmpUGE(a, b);
+
+					regs[r[0]] = builder.CreateCall(boolean, { builder.CreateZExt(result, builder.getInt32Ty()) });
+
+					// Whichever way it went when it was recorded, the other way leaves the trace.
+					BasicBlock* stay = BasicBlock::Create(*context, "", function);
+					if(after == next)
+						builder.CreateCondBr(result, stay, side_exit(skip_target(next)));
+					else
+						builder.CreateCondBr(result, side_exit(next), stay);
+					builder.SetInsertPoint(stay);
+					break;
+				}
+				default:
+					break;
+			}
+		}
+
+		for(int r = 0; r < CARIBOU_NUM_REGISTERS; r++)
+		{
+			if(used[r])
+				header_phi[r]->addIncoming(regs[r], builder.GetInsertBlock());
+		}
+		builder.CreateBr(header);
+
+		std::unique_ptr<Module> owned(module);
+		module = nullptr;
+		header = nullptr;
+		data   = nullptr;
+
+		if(verifyFunction(*function))
+			return false;
+
+		if(engine == nullptr)
+		{
+			engine = EngineBuilder(std::move(owned)).setEngineKind(EngineKind::JIT).create();
+			if(engine == nullptr)
+				return false;
+		}
+		else
+			engine->addModule(std::move(owned));
+
+		trace->function = reinterpret_cast<TraceFunction>(engine->getFunctionAddress(name));
+		return trace->function != nullptr;
+	}
+}
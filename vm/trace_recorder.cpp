@@ -21,17 +21,221 @@
  * DEALINGS IN THE SOFTWARE.
  */
 
+#include <string.h>
 #include "trace_recorder.hpp"
+#include "context.hpp"
+#include "object.hpp"
+#include "integer.hpp"
+#include "boolean.hpp"
+
+// Set as a loop's count once it has a trace, or never will, so it isn't counted again.
+#define DONE_COUNTING UINT8_MAX
+// Set instead once its trace has been compiled.
+#define COMPILED      (UINT8_MAX - 1)
 
 namespace Caribou
 {
-	TraceRecorder::TraceRecorder()
+	TraceRecorder::TraceRecorder() : mode(kTraceModeProfiling), image(nullptr), code(nullptr), count(0), version(kBytecodeFixed), iteration_count(nullptr), loop(0), frame(nullptr), context(nullptr), integer_vtable(nullptr), integer_offset(0), module(nullptr), header(nullptr), data(nullptr), engine(nullptr)
 	{
-
+		memset(header_phi, 0, sizeof(header_phi));
+		trace_begin = new TracePair[CARIBOU_TRACE_LENGTH];
+		trace_end   = trace_begin + CARIBOU_TRACE_LENGTH;
+		trace_tail  = trace_begin;
 	}
 
 	TraceRecorder::~TraceRecorder()
 	{
+		for(auto& t : trace_map)
+			delete t.second;
+		delete[] iteration_count;
+		delete[] trace_begin;
+		release();
+	}
+
+	void TraceRecorder::reset(Image* i, const uint8_t* c, size_t n, uint8_t v)
+	{
+		for(auto& t : trace_map)
+			delete t.second;
+		trace_map.clear();
+		blacklist.clear();
+
+		release();
+
+		delete[] iteration_count;
+		iteration_count = new uint8_t[n]();
+		image   = i;
+		code    = c;
+		count   = n;
+		version = v;
+		mode    = kTraceModeProfiling;
+	}
+
+	TraceFunction TraceRecorder::backward_jump(uintptr_t target)
+	{
+		if(mode != kTraceModeProfiling || target >= count)
+			return nullptr;
+
+		uint8_t& n = iteration_count[target];
+		if(n == COMPILED)
+			return find(target)->function;
+		if(n == DONE_COUNTING || ++n < CARIBOU_HOT_LOOP)
+			return nullptr;
+
+		loop       = target;
+		frame      = nullptr;
+		trace_tail = trace_begin;
+		mode       = kTraceModeRecording;
+		return nullptr;
+	}
+
+	void TraceRecorder::record(uintptr_t ip, Context* ctx)
+	{
+		if(frame == nullptr)
+		{
+			// Only code the verifier has passed is worth compiling.
+			if(!ctx->method->facts.verified)
+			{
+				abort(true);
+				return;
+			}
+			frame = ctx;
+		}
+		else if(ctx != frame)
+		{
+			abort(false);
+			return;
+		}
+
+		if(ip == loop && trace_tail != trace_begin)
+		{
+			finish();
+			return;
+		}
+
+		if(trace_tail == trace_end)
+		{
+			abort(true);
+			return;
+		}
+
+		TracePair& pair = *trace_tail;
+		if(!decode_instruction(code, count, ip, version, pair.insn) || !supported(pair.insn.opcode))
+		{
+			abort(true);
+			return;
+		}
+
+		pair.ip    = ip;
+		pair.depth = ctx->sp;
+		for(uint8_t i = 0; i < 3; i++)
+		{
+			uint8_t r = pair.insn.registers[i];
+			pair.types[i] = i < pair.insn.nregs && r < CARIBOU_NUM_REGISTERS ? type_of(ctx->registers[r]) : (uint8_t)kTraceTypeEmpty;
+		}
+
+		// Arithmetic is only ever done on integers.
+		if(pair.insn.opcode >= Instructions::ADD && pair.insn.opcode <= Instructions::NOT)
+		{
+			bool binary = pair.insn.opcode != Instructions::NOT;
+			if(pair.types[1] != kTraceTypeInteger || (binary && pair.types[2] != kTraceTypeInteger))
+			{
+				abort(true);
+				return;
+			}
+		}
+
+		trace_tail++;
+	}
+
+	Trace* TraceRecorder::find(uintptr_t ip)
+	{
+		auto it = trace_map.find(ip);
+		return it != trace_map.end() ? it->second : nullptr;
+	}
+
+	void TraceRecorder::finish()
+	{
+		Trace* trace = new Trace;
+
+		trace->header = loop;
+		trace->pairs.assign(trace_begin, trace_tail);
+		trace_map[loop] = trace;
+		iteration_count[loop] = compile(trace) ? COMPILED : DONE_COUNTING;
+		mode = kTraceModeProfiling;
+	}
+
+	// Gives up on the recording. Unless it is forever, the loop has to get hot all over
+	// again before it is tried again.
+	void TraceRecorder::abort(bool forever)
+	{
+		if(forever)
+		{
+			blacklist.insert(loop);
+			iteration_count[loop] = DONE_COUNTING;
+		}
+		else
+			iteration_count[loop] = 0;
+
+		mode = kTraceModeProfiling;
+	}
+
+	// Where a failed comparison carries on, given where the instruction after it starts.
+	uintptr_t TraceRecorder::skip_target(uintptr_t next)
+	{
+		DecodedInstruction skipped;
+
+		if(version == kBytecodeCompact && decode_instruction(code, count, next, version, skipped))
+			return next + skipped.length;
+		return next + instruction_info(Instructions::JMP).length;
+	}
+
+	bool TraceRecorder::supported(uint8_t opcode)
+	{
+		switch(opcode)
+		{
+			case Instructions::NOOP:
+			case Instructions::MOVE:
+			case Instructions::LOADI:
+			case Instructions::PUSH:
+			case Instructions::POP:
+			case Instructions::SWAP:
+			case Instructions::DUP:
+			case Instructions::ADD:
+			case Instructions::SUB:
+			case Instructions::MUL:
+			case Instructions::DIV:
+			case Instructions::MOD:
+			case Instructions::POW:
+			case Instructions::NOT:
+			case Instructions::EQ:
+			case Instructions::LT:
+			case Instructions::LTE:
+			case Instructions::GT:
+			case Instructions::GTE:
+			case Instructions::JMP:
+				return true;
+			default:
+				return false;
+		}
+	}
+
+	uint8_t TraceRecorder::type_of(Object* o)
+	{
+		if(o == nullptr)
+			return kTraceTypeEmpty;
 
+		Integer* i = dynamic_cast<Integer*>(o);
+		if(i != nullptr)
+		{
+			if(integer_vtable == nullptr)
+			{
+				memcpy(&integer_vtable, o, sizeof(integer_vtable));
+				integer_offset = i->value_offset();
+			}
+			return kTraceTypeInteger;
+		}
+		if(dynamic_cast<Boolean*>(o) != nullptr)
+			return kTraceTypeBoolean;
+		return kTraceTypeObject;
 	}
 }
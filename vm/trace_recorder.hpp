@@ -25,64 +25,149 @@
 #define __CARIBOU__TRACE_RECORDER_HPP__
 
 #include <stdint.h>
-#include "llvm/LLVMContext.h"
-#include "llvm/Module.h"
-#include "llvm/ExecutionEngine/GenericValue.h"
-#include "llvm/ExecutionEngine/JIT.h"
-#include "llvm/Support/IRBuilder.h"
-#include "llvm/ADT/DenseMap.h"
-#include "llvm/ADT/DenseSet.h"
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+#include "instructions.hpp"
+#include "context.hpp"
+
+// How many times a loop has to go round before it is recorded.
+#define CARIBOU_HOT_LOOP     50
+// Traces with more instructions than this are given up on.
+#define CARIBOU_TRACE_LENGTH 512
+
+namespace llvm
+{
+	class LLVMContext;
+	class Module;
+	class BasicBlock;
+	class PHINode;
+	class Value;
+	class ExecutionEngine;
+}
 
 namespace Caribou
 {
-	using namespace llvm;
+	class Object;
+	class Image;
 
-	typedef std::pair<uint8_t, size_t> TracePair;
+	// A loop compiled to native code. Runs it in the frame whose registers and context are
+	// given until one of its guards fails, and returns where the interpreter is to carry on.
+	typedef uintptr_t (*TraceFunction)(Object**, Context*);
 
-	class TraceRecorder
+	// What a register held when a trace went through an instruction.
+	enum TraceType
 	{
-		struct TraceNode
-		{
-			uint8_t    opcode;
-			size_t     ip;
-			size_t     depth;
+		kTraceTypeEmpty = 0,
+		kTraceTypeInteger,
+		kTraceTypeBoolean,
+		kTraceTypeObject
+	};
 
-			TraceNode(uint8_t o, size_t p, size_t d) : opcode(o), ip(p), depth(d), left(nullptr), right(nullptr) {}
+	// An instruction as it was run while a trace was being recorded: the instruction, what
+	// its registers held and how deep the stack was just before it ran.
+	struct TracePair
+	{
+		uintptr_t          ip;
+		DecodedInstruction insn;
+		uint8_t            types[3];
+		uint32_t           depth;
+	};
 
-			TraceNode* left;
-			TraceNode* right;
-		};
+	// One time round a loop, from its first instruction until it got back there. Which
+	// way each comparison went can be told from the instruction after it.
+	struct Trace
+	{
+		uintptr_t              header;
+		std::vector<TracePair> pairs;
+		TraceFunction          function;
 
+		Trace() : header(0), function(nullptr) {}
+	};
+
+	/* Finds the loops a machine spends its time in, and records what they do. While
+	   profiling, every jump back to an earlier instruction counts towards the loop starting
+	   there. Once a loop has gone round CARIBOU_HOT_LOOP times, the next time round is
+	   recorded instruction by instruction until it gets back to the start. Only moves,
+	   constants, stack operations, integer arithmetic, comparisons and jumps can be
+	   recorded; anything else, arithmetic on something besides integers, or a trace which
+	   gets too long, gives up on the recording and the loop is never recorded again. A
+	   recording which leaves the frame it started in is given up on too, but may be tried
+	   again.
+
+	   Finished traces are compiled straight away, and from then on a jump back to the
+	   start of the loop runs the compiled trace instead. */
+	class TraceRecorder
+	{
 		enum TraceMode
 		{
 			kTraceModeProfiling = 0,
-			kTraceModeRecording,
-			kTraceModeExpressionBegin,
-			kTraceModeExpression
+			kTraceModeRecording
 		};
 
 		TraceMode        mode;
 
-		TraceNode*       expression_root;
-		TraceNode*       expression_leaf;
+		Image*           image;
+		const uint8_t*   code;
+		size_t           count;
+		uint8_t          version;
 		uint8_t*         iteration_count;
 
+		// The loop being recorded, and the frame it runs in.
+		uintptr_t        loop;
+		Context*         frame;
 		TracePair*       trace_begin;
 		TracePair*       trace_end;
 		TracePair*       trace_tail;
 
-		DenseMap<size_t, TraceNode*> trace_map;
-		DenseSet<size_t> blacklist;
+		std::unordered_map<uintptr_t, Trace*> trace_map;
+		std::unordered_set<uintptr_t>        blacklist;
 
-		Module*          module;
-		BasicBlock*      header;
-		PHINode*         header_phi;
-		Value*           data;
-		ExecutionEngine* engine;
+		// What traces are compiled with. The module is the one being built, header is the
+		// block each time round the loop starts in, with a phi for each register, and data
+		// is the registers of the frame the trace runs in.
+		llvm::LLVMContext*     context;
+		// Integers are told apart by their vtable, which is learnt from the first one
+		// seen, as is where their value is.
+		const void*            integer_vtable;
+		size_t                 integer_offset;
+		llvm::Module*          module;
+		llvm::BasicBlock*      header;
+		llvm::PHINode*         header_phi[CARIBOU_NUM_REGISTERS];
+		llvm::Value*           data;
+		llvm::ExecutionEngine* engine;
 
 	public:
 		TraceRecorder();
 		~TraceRecorder();
+
+		// The code loops are found in, count bytes of it encoded as version, and the image
+		// its constants come from.
+		void reset(Image* image, const uint8_t* code, size_t count, uint8_t version);
+
+		bool recording() { return mode == kTraceModeRecording; }
+
+		// A jump back to target has been taken. Starts recording once the loop there is
+		// hot. Returns the loop's compiled trace, if it has one, to be run instead.
+		TraceFunction backward_jump(uintptr_t target);
+
+		// The instruction at ip is about to run in ctx.
+		void record(uintptr_t ip, Context* ctx);
+
+		// The trace recorded for the loop starting at ip, if there is one.
+		Trace* find(uintptr_t ip);
+		bool blacklisted(uintptr_t ip) { return blacklist.count(ip) != 0; }
+
+	private:
+		void finish();
+		void abort(bool forever);
+		uintptr_t skip_target(uintptr_t next);
+		// Defined with the rest of the LLVM code, in trace_compiler.cpp.
+		bool compile(Trace* trace);
+		void release();
+
+		static bool supported(uint8_t opcode);
+		uint8_t type_of(Object* o);
 	};
 }
 
@@ -0,0 +1,187 @@
+/*
+ * Caribou Virtual Machine
+ * Copyright (c) 2011, Jeremy Tregunna, All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#include <vector>
+#include <map>
+#include "verifier.hpp"
+#include "instructions.hpp"
+#include "endian.hpp"
+#include "context.hpp"
+
+namespace Caribou
+{
+	// What is known on the way into an instruction.
+	struct Entry
+	{
+		// The deepest the stack can be.
+		uint32_t depth;
+		// Registers which have been written to on every path here.
+		uint8_t  defined;
+	};
+
+	bool Verifier::verify(uintptr_t start, MethodFacts& facts)
+	{
+		// When a path reaches an instruction with a deeper stack, or fewer registers
+		// written, the instruction has to be looked at again.
+		std::map<uintptr_t, Entry> entries;
+		std::vector<uintptr_t> pending;
+		uint32_t max_stack = 0;
+		bool bounded = true;
+		bool verified = true;
+
+		auto reach = [&](uintptr_t target, uint32_t depth, uint8_t defined)
+		{
+			auto it = entries.find(target);
+
+			if(it == entries.end())
+			{
+				entries[target] = Entry { depth, defined };
+				pending.push_back(target);
+				return;
+			}
+
+			if(it->second.depth != depth)
+				verified = false;
+
+			if(it->second.depth >= depth && (it->second.defined & defined) == it->second.defined)
+				return;
+
+			if(depth > it->second.depth)
+				it->second.depth = depth;
+			it->second.defined &= defined;
+			pending.push_back(target);
+		};
+
+		// The receiver and the method locals are there from the start.
+		reach(start, 0, 0x3);
+
+		while(!pending.empty() && bounded)
+		{
+			uintptr_t offset = pending.back();
+			Entry entry = entries[offset];
+			pending.pop_back();
+
+			if(offset >= count)
+				return false;
+
+			DecodedInstruction insn;
+			if(!decode_instruction(code, count, offset, version, insn))
+				return false;
+
+			const InstructionInfo& info = instruction_info(insn.opcode);
+
+			// Variable instructions pop as much as a register says, so all we know is the
+			// most they can leave on the stack.
+			if(info.flags & kInsnVariable)
+				verified = false;
+
+			if(entry.depth < info.pops)
+			{
+				verified = false;
+				entry.depth = info.pops;
+			}
+
+			uint32_t depth = entry.depth - info.pops + info.pushes;
+			if(depth > CARIBOU_MAX_VERIFIED_STACK)
+				bounded = false;
+			if(depth > max_stack)
+				max_stack = depth;
+
+			uint8_t defined = entry.defined;
+
+			for(uint8_t i = 0; i < insn.nregs; i++)
+			{
+				uint8_t r = insn.registers[i];
+
+				if(r >= CARIBOU_NUM_REGISTERS)
+				{
+					verified = false;
+					continue;
+				}
+
+				if(i == 0 && (info.flags & kInsnDefinesFirst))
+					continue;
+
+				if(!(entry.defined & (1 << r)))
+					verified = false;
+			}
+
+			if(insn.nregs > 0 && (info.flags & kInsnDefinesFirst) && insn.registers[0] < CARIBOU_NUM_REGISTERS)
+				defined |= 1 << insn.registers[0];
+			if(info.flags & kInsnDefinesReturn)
+				defined |= 1 << 2;
+
+			if(insn.opcode == Instructions::LOADI && insn.immediate >= const_count)
+				verified = false;
+
+			uintptr_t next = offset + insn.length;
+
+			if(info.flags & kInsnJump)
+				reach(insn.immediate, depth, defined);
+
+			if(info.flags & kInsnSkip)
+			{
+				// Fixed comparisons skip as many bytes as a JMP takes, compact ones skip
+				// whatever instruction comes next.
+				DecodedInstruction skipped;
+				uintptr_t skip = instruction_info(Instructions::JMP).length;
+
+				if(version == kBytecodeCompact)
+				{
+					if(!decode_instruction(code, count, next, version, skipped))
+						return false;
+					skip = skipped.length;
+				}
+
+				reach(next, depth, defined);
+				reach(next + skip, depth, defined);
+			}
+			else if(!(info.flags & kInsnTerminator))
+				reach(next, depth, defined);
+		}
+
+		if(!bounded)
+		{
+			facts.max_stack = CARIBOU_STACK_UNKNOWN;
+			facts.verified  = false;
+			return true;
+		}
+
+		// Instructions must not overlap, or the same bytes would mean different things
+		// depending on how they were reached.
+		uintptr_t end = 0;
+		for(auto& e : entries)
+		{
+			DecodedInstruction insn;
+
+			if(e.first < end)
+				verified = false;
+			if(decode_instruction(code, count, e.first, version, insn))
+				end = e.first + insn.length;
+		}
+
+		facts.max_stack = max_stack;
+		facts.verified  = verified;
+		return true;
+	}
+}
@@ -0,0 +1,90 @@
+/*
+ * Caribou Virtual Machine
+ * Copyright (c) 2011, Jeremy Tregunna, All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef __CARIBOU__VERIFIER_HPP__
+#define __CARIBOU__VERIFIER_HPP__
+
+#include <sys/types.h>
+#include <stdint.h>
+#include <string>
+#include "bytecode.hpp"
+
+// A method whose stack depth couldn't be worked out.
+#define CARIBOU_STACK_UNKNOWN      UINT32_MAX
+// Methods which need more than this are treated as if the depth were unknown.
+#define CARIBOU_MAX_VERIFIED_STACK 1024
+// Bumped whenever a change to the verifier changes what it finds out about any code, so
+// that nothing it found out before is taken on trust.
+#define CARIBOU_VERIFIER_VERSION   "3"
+
+namespace Caribou
+{
+	// What the verifier has proven about a method.
+	struct MethodFacts
+	{
+		// The deepest the operand stack gets, or CARIBOU_STACK_UNKNOWN.
+		uint32_t max_stack;
+		// Every instruction has valid operands, jumps land on instructions within the
+		// method, the stack is the same depth whichever way an instruction is reached and
+		// never underflows, and no register is read before it is written. The machine skips
+		// its runtime checks for methods where this holds.
+		bool     verified;
+
+		MethodFacts() : max_stack(CARIBOU_STACK_UNKNOWN), verified(false) {}
+	};
+
+	// Checks bytecode before it is run, and works out what the machine needs to know to run
+	// it. A method is everything reachable from its first instruction, up to where execution
+	// leaves it through RET, HALT or RESTORE.
+	class Verifier
+	{
+	public:
+		Verifier(const uint8_t* code, size_t count, size_t constants, uint8_t version = kBytecodeFixed) : code(code), count(count), const_count(constants), version(version) {}
+
+		// Follows every path through the method from start. Fails on an opcode it doesn't
+		// know, or an instruction or a jump leading out of the code. Otherwise, works out how
+		// deep the operand stack can get, unless it keeps on growing, and whether the method
+		// can be verified.
+		bool verify(uintptr_t start, MethodFacts& facts);
+
+	private:
+		const uint8_t* code;
+		size_t         count;
+		size_t         const_count;
+		uint8_t        version;
+	};
+
+	// Raised by the machine when code it couldn't verify does something it shouldn't.
+	class InvalidBytecodeError
+	{
+	private:
+		uintptr_t   ip;
+		std::string reason;
+
+	public:
+		InvalidBytecodeError(uintptr_t at, std::string why) : ip(at), reason(why) {}
+		const std::string message() const { return "Invalid bytecode at " + std::to_string(ip) + ": " + reason; }
+	};
+}
+
+#endif /* !__CARIBOU__VERIFIER_HPP__ */
@@ -22,17 +22,16 @@
  */
 
 #include "vmmethod.hpp"
-#include "machine.hpp"
 
 namespace Caribou
 {
-	VMMethod::VMMethod(Machine* machine, Context* ctx, String* str, uintptr_t start, size_t num_args)
+	VMMethod::VMMethod(String* str, uintptr_t start, size_t num_args, const MethodFacts& proven)
 		: name(str),
 		  start_ip(start),
-		  nargs(num_args)
+		  nargs(num_args),
+		  facts(proven)
 	{
 		locals = new Object();
-		current_context = new Context(ctx, this, machine->get_instruction_pointer());
 	}
 
 	VMMethod::~VMMethod()
@@ -26,26 +26,29 @@
 
 #include <stdint.h>
 #include "object.hpp"
+#include "verifier.hpp"
 
 namespace Caribou
 {
 	class String;
-	class Context;
 
 	class VMMethod : public Object
 	{
 	public:
 		size_t    nargs;
 		Object*   locals;
+		MethodFacts facts;
 
 	private:
-		Context*  current_context;
 		String*   name;
 		uintptr_t start_ip;
 
 	public:
-		VMMethod(Machine*, Context*, String*, uintptr_t, size_t);
+		VMMethod(String*, uintptr_t, size_t, const MethodFacts& = MethodFacts());
 		~VMMethod();
+
+		uintptr_t get_start_ip() { return start_ip; }
+		String* get_name() { return name; }
 	};
 }
 